@@ -0,0 +1,515 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Benchmark of the forwarding modes: the forwarder is run once copying the
+// data through user space and once with --splice, both under the same load,
+// and the bytes received by the upstream servers are divided by the CPU time
+// consumed by the forwarder (getrusage() of the child process).
+
+// Maximum number of upstream servers.
+static constexpr const size_t max_upstreams = 16;
+
+// Maximum number of clients.
+static constexpr const size_t max_clients = 256;
+
+// Maximum file descriptor handled by the load generator.
+static constexpr const int max_fds = 1024;
+
+// Size of the buffer sent by the clients.
+static constexpr const size_t buffer_size = 64 * 1024;
+
+// Maximum number of events returned by epoll_wait().
+static constexpr const int max_events = 256;
+
+// Maximum number of milliseconds to wait for the forwarder to listen.
+static constexpr const uint64_t startup_timeout = 5000;
+
+// Options.
+struct options {
+  // Path of the forwarder.
+  const char* forwarder = "./tcpforwarder";
+
+  // Port where the forwarder listens (on the loopback interface).
+  in_port_t port = 23000;
+
+  // Number of upstream servers (each of them receives all the data).
+  size_t nupstreams = 2;
+
+  // Number of clients.
+  size_t nclients = 4;
+
+  // Duration of each run (seconds).
+  unsigned seconds = 5;
+};
+
+// Result of a run.
+struct result {
+  // Bytes received by the upstream servers.
+  uint64_t bytes = 0;
+
+  // CPU time consumed by the forwarder (seconds).
+  double cpu = 0.0;
+};
+
+// Role of a file descriptor in the load generator.
+enum class role {
+  none,
+  listener,
+  client,
+  upstream
+};
+
+static void usage(const char* program);
+static bool parse_arguments(int argc, const char** argv, options& opts);
+static bool parse_number(const char* s,
+                         uint64_t min,
+                         uint64_t max,
+                         uint64_t& n);
+static bool run(const options& opts, bool splice, result& res);
+static pid_t spawn(const options& opts,
+                   const in_port_t* ports,
+                   bool splice);
+static int listen_loopback(in_port_t& port);
+static int connect_loopback(in_port_t port);
+static void print_result(const char* mode, const result& res);
+static uint64_t now();
+
+int main(int argc, const char** argv)
+{
+  options opts;
+
+  // Parse arguments.
+  if (!parse_arguments(argc, argv, opts)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // Writing into a socket closed by the forwarder must not kill the
+  // benchmark.
+  signal(SIGPIPE, SIG_IGN);
+
+  result send;
+  result splice;
+
+  // Run the forwarder in both modes.
+  if ((!run(opts, false, send)) || (!run(opts, true, splice))) {
+    return -1;
+  }
+
+  printf("%-8s %16s %12s %20s\n",
+         "Mode",
+         "Forwarded (MB)",
+         "CPU (s)",
+         "MB per CPU-second");
+
+  print_result("send", send);
+  print_result("splice", splice);
+
+  // If both runs consumed CPU time...
+  if ((send.cpu > 0.0) && (splice.cpu > 0.0) && (send.bytes > 0)) {
+    printf("\nsplice / send: %.2f\n",
+           (splice.bytes / splice.cpu) / (send.bytes / send.cpu));
+  }
+
+  return 0;
+}
+
+void usage(const char* program)
+{
+  fprintf(stderr,
+          "Usage: %s [--forwarder <path>] [--port <port>] "
+          "[--upstreams <number-upstreams>] [--clients <number-clients>] "
+          "[--seconds <seconds>]\n",
+          program);
+
+  fprintf(stderr,
+          "\nRuns the forwarder on 127.0.0.1:<port> (one worker) with and "
+          "without --splice\nand prints the bytes forwarded per CPU-second "
+          "of the forwarder in each mode.\n");
+
+  fprintf(stderr, "\nDefault path: ./tcpforwarder\n");
+  fprintf(stderr, "Default port: 23000\n");
+  fprintf(stderr, "Default number of upstream servers: 2 (1 - %zu)\n",
+          max_upstreams);
+  fprintf(stderr, "Default number of clients: 4 (1 - %zu)\n", max_clients);
+  fprintf(stderr, "Default duration of each run: 5 seconds\n");
+}
+
+bool parse_arguments(int argc, const char** argv, options& opts)
+{
+  int i = 1;
+  while (i + 1 < argc) {
+    uint64_t n;
+
+    if (strcasecmp(argv[i], "--forwarder") == 0) {
+      opts.forwarder = argv[i + 1];
+    } else if (strcasecmp(argv[i], "--port") == 0) {
+      if (!parse_number(argv[i + 1], 1, 65535, n)) {
+        return false;
+      }
+
+      opts.port = static_cast<in_port_t>(n);
+    } else if (strcasecmp(argv[i], "--upstreams") == 0) {
+      if (!parse_number(argv[i + 1], 1, max_upstreams, n)) {
+        return false;
+      }
+
+      opts.nupstreams = static_cast<size_t>(n);
+    } else if (strcasecmp(argv[i], "--clients") == 0) {
+      if (!parse_number(argv[i + 1], 1, max_clients, n)) {
+        return false;
+      }
+
+      opts.nclients = static_cast<size_t>(n);
+    } else if (strcasecmp(argv[i], "--seconds") == 0) {
+      if (!parse_number(argv[i + 1], 1, 3600, n)) {
+        return false;
+      }
+
+      opts.seconds = static_cast<unsigned>(n);
+    } else {
+      return false;
+    }
+
+    i += 2;
+  }
+
+  return (i == argc);
+}
+
+bool parse_number(const char* s, uint64_t min, uint64_t max, uint64_t& n)
+{
+  uint64_t res = 0;
+  while (*s) {
+    if ((*s < '0') || (*s > '9')) {
+      return false;
+    }
+
+    if ((res = (res * 10) + (*s - '0')) > max) {
+      return false;
+    }
+
+    s++;
+  }
+
+  if (res < min) {
+    return false;
+  }
+
+  n = res;
+  return true;
+}
+
+bool run(const options& opts, bool splice, result& res)
+{
+  // Role of each file descriptor.
+  role roles[max_fds];
+  for (int i = 0; i < max_fds; i++) {
+    roles[i] = role::none;
+  }
+
+  int epollfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollfd == -1) {
+    fprintf(stderr, "Error creating epoll instance.\n");
+    return false;
+  }
+
+  // Create the upstream servers (on ephemeral ports).
+  in_port_t ports[max_upstreams];
+  for (size_t i = 0; i < opts.nupstreams; i++) {
+    const int fd = listen_loopback(ports[i]);
+
+    if ((fd == -1) || (fd >= max_fds)) {
+      fprintf(stderr, "Error creating upstream server.\n");
+      return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+
+    roles[fd] = role::listener;
+  }
+
+  // Start the forwarder.
+  const pid_t pid = spawn(opts, ports, splice);
+  if (pid == -1) {
+    fprintf(stderr, "Error starting forwarder.\n");
+    return false;
+  }
+
+  // Wait for the forwarder to listen.
+  int fd;
+  const uint64_t deadline = now() + startup_timeout;
+  while ((fd = connect_loopback(opts.port)) == -1) {
+    int status;
+    if ((now() >= deadline) || (waitpid(pid, &status, WNOHANG) == pid)) {
+      fprintf(stderr,
+              "The forwarder didn't start listening on port %u.\n",
+              opts.port);
+
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+
+      return false;
+    }
+
+    usleep(10000);
+  }
+
+  // Connect the clients (the first one is already connected).
+  for (size_t i = 0; i < opts.nclients; i++) {
+    if (i > 0) {
+      fd = connect_loopback(opts.port);
+    }
+
+    if ((fd == -1) || (fd >= max_fds)) {
+      fprintf(stderr, "Error connecting to the forwarder.\n");
+
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+
+      return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.fd = fd;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+
+    roles[fd] = role::client;
+  }
+
+  static uint8_t buf[buffer_size];
+  memset(buf, 'x', sizeof(buf));
+
+  res.bytes = 0;
+
+  // Generate load.
+  const uint64_t end = now() + (opts.seconds * 1000ull);
+  while (now() < end) {
+    struct epoll_event events[max_events];
+    const int nevents = epoll_wait(epollfd, events, max_events, 100);
+
+    for (int i = 0; i < nevents; i++) {
+      fd = events[i].data.fd;
+
+      switch (roles[fd]) {
+        case role::listener:
+          {
+            // Accept the connection of the forwarder.
+            const int upstream = accept4(fd,
+                                         nullptr,
+                                         nullptr,
+                                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if ((upstream != -1) && (upstream < max_fds)) {
+              struct epoll_event ev;
+              ev.events = EPOLLIN;
+              ev.data.fd = upstream;
+              epoll_ctl(epollfd, EPOLL_CTL_ADD, upstream, &ev);
+
+              roles[upstream] = role::upstream;
+            } else if (upstream != -1) {
+              close(upstream);
+            }
+          }
+
+          break;
+        case role::client:
+          // Send as much as the socket takes.
+          while (write(fd, buf, sizeof(buf)) > 0);
+          break;
+        case role::upstream:
+          {
+            // Receive (and discard) the data.
+            ssize_t ret;
+            while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+              res.bytes += static_cast<uint64_t>(ret);
+            }
+
+            // If the forwarder closed the connection...
+            if ((ret == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+              close(fd);
+              roles[fd] = role::none;
+            }
+          }
+
+          break;
+        default:
+          ;
+      }
+    }
+  }
+
+  // Close all the connections.
+  for (int i = 0; i < max_fds; i++) {
+    if (roles[i] != role::none) {
+      close(i);
+    }
+  }
+
+  close(epollfd);
+
+  // Stop the forwarder and get the CPU time it consumed.
+  kill(pid, SIGINT);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid) {
+    fprintf(stderr, "Error waiting for the forwarder.\n");
+    return false;
+  }
+
+  res.cpu = usage.ru_utime.tv_sec +
+            (usage.ru_utime.tv_usec / 1000000.0) +
+            usage.ru_stime.tv_sec +
+            (usage.ru_stime.tv_usec / 1000000.0);
+
+  return true;
+}
+
+pid_t spawn(const options& opts, const in_port_t* ports, bool splice)
+{
+  // Addresses of the listener and of the upstream servers.
+  char addresses[1 + max_upstreams][32];
+
+  // Arguments of the forwarder.
+  const char* argv[10 + (2 * max_upstreams)];
+  size_t argc = 0;
+
+  argv[argc++] = opts.forwarder;
+  argv[argc++] = "--bind";
+
+  snprintf(addresses[0], sizeof(addresses[0]), "127.0.0.1:%u", opts.port);
+  argv[argc++] = addresses[0];
+
+  for (size_t i = 0; i < opts.nupstreams; i++) {
+    snprintf(addresses[1 + i],
+             sizeof(addresses[1 + i]),
+             "127.0.0.1:%u",
+             ports[i]);
+
+    argv[argc++] = "--upstream-server";
+    argv[argc++] = addresses[1 + i];
+  }
+
+  argv[argc++] = "--number-workers";
+  argv[argc++] = "1";
+
+  // The upstream servers are not faster than the clients: pause the clients
+  // instead of dropping the upstream connections.
+  argv[argc++] = "--backpressure";
+  argv[argc++] = "pause-downstream";
+
+  if (splice) {
+    argv[argc++] = "--splice";
+  }
+
+  argv[argc] = nullptr;
+
+  const pid_t pid = fork();
+
+  // Child?
+  if (pid == 0) {
+    // Discard the statistics printed by the forwarder.
+    const int devnull = open("/dev/null", O_WRONLY);
+    if (devnull != -1) {
+      dup2(devnull, STDOUT_FILENO);
+      dup2(devnull, STDERR_FILENO);
+    }
+
+    execv(opts.forwarder, const_cast<char* const*>(argv));
+    _exit(127);
+  }
+
+  return pid;
+}
+
+int listen_loopback(in_port_t& port)
+{
+  const int fd = socket(AF_INET,
+                        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        0);
+
+  if (fd != -1) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t addrlen = sizeof(addr);
+    if ((bind(fd,
+              reinterpret_cast<const struct sockaddr*>(&addr),
+              sizeof(addr)) == 0) &&
+        (listen(fd, SOMAXCONN) == 0) &&
+        (getsockname(fd,
+                     reinterpret_cast<struct sockaddr*>(&addr),
+                     &addrlen) == 0)) {
+      port = ntohs(addr.sin_port);
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+int connect_loopback(in_port_t port)
+{
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd != -1) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    // Connect (blocking) and then make the socket non-blocking.
+    if (connect(fd,
+                reinterpret_cast<const struct sockaddr*>(&addr),
+                sizeof(addr)) == 0) {
+      const int flags = fcntl(fd, F_GETFL);
+      if ((flags != -1) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1)) {
+        return fd;
+      }
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+void print_result(const char* mode, const result& res)
+{
+  printf("%-8s %16.1f %12.2f %20.1f\n",
+         mode,
+         res.bytes / (1024.0 * 1024.0),
+         res.cpu,
+         (res.cpu > 0.0) ? (res.bytes / (1024.0 * 1024.0)) / res.cpu : 0.0);
+}
+
+uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000);
+}
@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include "io/uring.h"
+
+io::uring::~uring()
+{
+  if (_M_fd != -1) {
+    munmap(_M_sq.sqes, _M_sqessize);
+
+    if (_M_cq.ring != _M_sq.ring) {
+      munmap(_M_cq.ring, _M_cq.ringsize);
+    }
+
+    munmap(_M_sq.ring, _M_sq.ringsize);
+
+    close(_M_fd);
+  }
+}
+
+bool io::uring::init(unsigned entries, unsigned cqentries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(struct io_uring_params));
+
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = cqentries;
+
+  // Create io_uring instance.
+  const int fd = static_cast<int>(syscall(__NR_io_uring_setup,
+                                          entries,
+                                          &params));
+
+  if (fd == -1) {
+    return false;
+  }
+
+  // The timeout of io_uring_enter() requires IORING_FEAT_EXT_ARG and
+  // completions shouldn't be dropped.
+  if ((params.features & (IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP)) !=
+      (IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP)) {
+    close(fd);
+
+    errno = ENOTSUP;
+    return false;
+  }
+
+  _M_sq.ringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  _M_cq.ringsize = params.cq_off.cqes +
+                   params.cq_entries * sizeof(struct io_uring_cqe);
+
+  // If the submission and completion queues can be mapped with a single
+  // mmap()...
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (_M_cq.ringsize > _M_sq.ringsize) {
+      _M_sq.ringsize = _M_cq.ringsize;
+    }
+
+    _M_cq.ringsize = _M_sq.ringsize;
+  }
+
+  // Map submission queue.
+  _M_sq.ring = mmap(nullptr,
+                    _M_sq.ringsize,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE,
+                    fd,
+                    IORING_OFF_SQ_RING);
+
+  if (_M_sq.ring != MAP_FAILED) {
+    // Map completion queue.
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      _M_cq.ring = _M_sq.ring;
+    } else {
+      _M_cq.ring = mmap(nullptr,
+                        _M_cq.ringsize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        fd,
+                        IORING_OFF_CQ_RING);
+    }
+
+    if (_M_cq.ring != MAP_FAILED) {
+      // Map submission queue entries.
+      _M_sqessize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+      void* sqes = mmap(nullptr,
+                        _M_sqessize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        fd,
+                        IORING_OFF_SQES);
+
+      if (sqes != MAP_FAILED) {
+        uint8_t* const sq = static_cast<uint8_t*>(_M_sq.ring);
+
+        _M_sq.head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        _M_sq.tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        _M_sq.mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        _M_sq.entries = params.sq_entries;
+        _M_sq.sqes = static_cast<struct io_uring_sqe*>(sqes);
+        _M_sq.local_tail = *_M_sq.tail;
+
+        // Map each slot of the submission queue to the submission queue
+        // entry with the same index.
+        unsigned* const array = reinterpret_cast<unsigned*>(
+                                  sq + params.sq_off.array
+                                );
+
+        for (unsigned i = 0; i < params.sq_entries; i++) {
+          array[i] = i;
+        }
+
+        uint8_t* const cq = static_cast<uint8_t*>(_M_cq.ring);
+
+        _M_cq.head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        _M_cq.tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        _M_cq.mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        _M_cq.cqes = reinterpret_cast<struct io_uring_cqe*>(
+                       cq + params.cq_off.cqes
+                     );
+
+        _M_fd = fd;
+
+        return true;
+      }
+
+      if (_M_cq.ring != _M_sq.ring) {
+        munmap(_M_cq.ring, _M_cq.ringsize);
+      }
+    }
+
+    munmap(_M_sq.ring, _M_sq.ringsize);
+  }
+
+  close(fd);
+
+  return false;
+}
+
+struct io_uring_sqe* io::uring::get_sqe()
+{
+  do {
+    // If the submission queue is not full...
+    if (_M_sq.local_tail - __atomic_load_n(_M_sq.head, __ATOMIC_ACQUIRE) <
+        _M_sq.entries) {
+      struct io_uring_sqe* const
+        sqe = &_M_sq.sqes[_M_sq.local_tail++ & _M_sq.mask];
+
+      memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+      return sqe;
+    }
+
+    // Submit pending entries.
+    if (!submit()) {
+      return nullptr;
+    }
+  } while (true);
+}
+
+bool io::uring::submit_and_wait(unsigned nr, int timeout)
+{
+  flush();
+
+  struct __kernel_timespec ts;
+  ts.tv_sec = timeout / 1000;
+  ts.tv_nsec = (timeout % 1000) * 1000000L;
+
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+  arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+  const unsigned to_submit = _M_sq.local_tail -
+                             __atomic_load_n(_M_sq.head, __ATOMIC_ACQUIRE);
+
+  // If the completion queue has overflowed (EBUSY) or the kernel couldn't
+  // allocate memory for the requests (EAGAIN), the completions have to be
+  // reaped before submitting again: it is not an error.
+  return ((enter(to_submit,
+                 nr,
+                 IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                 &arg,
+                 sizeof(struct io_uring_getevents_arg)) != -1) ||
+          (errno == ETIME) ||
+          (errno == EINTR) ||
+          (errno == EAGAIN) ||
+          (errno == EBUSY));
+}
+
+bool io::uring::submit()
+{
+  flush();
+
+  const unsigned to_submit = _M_sq.local_tail -
+                             __atomic_load_n(_M_sq.head, __ATOMIC_ACQUIRE);
+
+  if (to_submit > 0) {
+    do {
+      if (enter(to_submit, 0, 0, nullptr, 0) != -1) {
+        return true;
+      } else if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+        return false;
+      }
+    } while (true);
+  }
+
+  return true;
+}
+
+bool io::uring::register_files(unsigned n)
+{
+  int* const fds = static_cast<int*>(malloc(n * sizeof(int)));
+
+  // If the memory could be allocated...
+  if (fds) {
+    // All the slots are empty.
+    memset(fds, 0xff, n * sizeof(int));
+
+    const long ret = syscall(__NR_io_uring_register,
+                             _M_fd,
+                             IORING_REGISTER_FILES,
+                             fds,
+                             n);
+
+    free(fds);
+
+    if (ret == 0) {
+      _M_files = n;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool io::uring::update_file(unsigned idx, int fd)
+{
+  struct io_uring_files_update update;
+  memset(&update, 0, sizeof(struct io_uring_files_update));
+  update.offset = idx;
+  update.fds = reinterpret_cast<uint64_t>(&fd);
+
+  return (syscall(__NR_io_uring_register,
+                  _M_fd,
+                  IORING_REGISTER_FILES_UPDATE,
+                  &update,
+                  1) == 1);
+}
+
+bool io::uring::register_buffers(const struct iovec* iov, unsigned n)
+{
+  if (syscall(__NR_io_uring_register,
+              _M_fd,
+              IORING_REGISTER_BUFFERS,
+              iov,
+              n) == 0) {
+    _M_buffers = n;
+    return true;
+  }
+
+  return false;
+}
+
+int io::uring::enter(unsigned to_submit,
+                     unsigned min_complete,
+                     unsigned flags,
+                     const void* arg,
+                     size_t argsz)
+{
+  return static_cast<int>(syscall(__NR_io_uring_enter,
+                                  _M_fd,
+                                  to_submit,
+                                  min_complete,
+                                  flags,
+                                  arg,
+                                  argsz));
+}
@@ -0,0 +1,146 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+namespace io {
+  // io_uring instance (thin wrapper around the system calls, liburing is not
+  // required).
+  // Not thread-safe: each worker thread has its own instance.
+  class uring {
+    public:
+      // Constructor.
+      uring() = default;
+
+      // Destructor.
+      ~uring();
+
+      // Initialize.
+      bool init(unsigned entries, unsigned cqentries);
+
+      // Get a submission queue entry (cleared).
+      // If the submission queue is full, the pending entries are submitted
+      // first.
+      struct io_uring_sqe* get_sqe();
+
+      // Submit the pending entries and wait for, at least, `nr` completions
+      // or until `timeout` milliseconds have elapsed.
+      // Returns:
+      //   true: the completion queue might contain entries (also if the
+      //         entries couldn't be submitted because the completion queue
+      //         has to be reaped first).
+      //   false: error.
+      bool submit_and_wait(unsigned nr, int timeout);
+
+      // Submit the pending entries.
+      bool submit();
+
+      // Get the next completion queue entry (or nullptr if empty).
+      const struct io_uring_cqe* peek();
+
+      // Mark the completion queue entry returned by peek() as seen.
+      void seen();
+
+      // Register a sparse table of `n` files.
+      bool register_files(unsigned n);
+
+      // Get number of registered files.
+      unsigned files() const;
+
+      // Replace the file of the slot `idx` of the file table (-1: clear the
+      // slot) synchronously.
+      bool update_file(unsigned idx, int fd);
+
+      // Register buffers.
+      bool register_buffers(const struct iovec* iov, unsigned n);
+
+      // Get number of registered buffers.
+      unsigned buffers() const;
+
+    private:
+      // Ring file descriptor.
+      int _M_fd = -1;
+
+      // Submission queue.
+      struct {
+        unsigned* head;
+        unsigned* tail;
+        unsigned mask;
+        unsigned entries;
+        struct io_uring_sqe* sqes;
+
+        // Local tail (entries not visible to the kernel yet).
+        unsigned local_tail;
+
+        void* ring;
+        size_t ringsize;
+      } _M_sq;
+
+      // Completion queue.
+      struct {
+        unsigned* head;
+        unsigned* tail;
+        unsigned mask;
+        struct io_uring_cqe* cqes;
+
+        void* ring;
+        size_t ringsize;
+      } _M_cq;
+
+      // Size of the submission queue entries array.
+      size_t _M_sqessize;
+
+      // Number of registered files.
+      unsigned _M_files = 0;
+
+      // Number of registered buffers.
+      unsigned _M_buffers = 0;
+
+      // Flush the local tail.
+      void flush();
+
+      // Enter.
+      int enter(unsigned to_submit,
+                unsigned min_complete,
+                unsigned flags,
+                const void* arg,
+                size_t argsz);
+
+      // Disable copy constructor and assignment operator.
+      uring(const uring&) = delete;
+      uring& operator=(const uring&) = delete;
+  };
+
+  inline const struct io_uring_cqe* uring::peek()
+  {
+    const unsigned head = *_M_cq.head;
+
+    return (head != __atomic_load_n(_M_cq.tail, __ATOMIC_ACQUIRE)) ?
+             &_M_cq.cqes[head & _M_cq.mask] :
+             nullptr;
+  }
+
+  inline void uring::seen()
+  {
+    __atomic_store_n(_M_cq.head, *_M_cq.head + 1, __ATOMIC_RELEASE);
+  }
+
+  inline unsigned uring::files() const
+  {
+    return _M_files;
+  }
+
+  inline unsigned uring::buffers() const
+  {
+    return _M_buffers;
+  }
+
+  inline void uring::flush()
+  {
+    __atomic_store_n(_M_sq.tail, _M_sq.local_tail, __ATOMIC_RELEASE);
+  }
+}
+
+#endif // IO_URING_H
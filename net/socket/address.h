@@ -28,6 +28,9 @@ namespace net {
         // Get address length.
         socklen_t length() const;
 
+        // Compare.
+        bool operator==(const address& other) const;
+
         // To string.
         const char* to_string(char* dst, size_t size) const;
 
@@ -67,6 +70,12 @@ namespace net {
     {
       return _M_length;
     }
+
+    inline bool address::operator==(const address& other) const
+    {
+      return ((_M_length == other._M_length) &&
+              (memcmp(&_M_addr, &other._M_addr, _M_length) == 0));
+    }
   }
 }
 
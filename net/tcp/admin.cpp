@@ -0,0 +1,481 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "net/tcp/admin.h"
+#include "net/tcp/forwarder.h"
+
+net::tcp::admin::~admin()
+{
+  // Stop thread (if running).
+  stop();
+}
+
+bool net::tcp::admin::start(const forwarder* forwarder)
+{
+  // Save forwarder.
+  _M_forwarder = forwarder;
+
+  // Start thread.
+  if (pthread_create(&_M_thread, nullptr, run, this) == 0) {
+    _M_running = true;
+    return true;
+  }
+
+  return false;
+}
+
+void net::tcp::admin::stop()
+{
+  // If the thread is running...
+  if (_M_running) {
+    _M_running = false;
+    pthread_join(_M_thread, nullptr);
+  }
+}
+
+void* net::tcp::admin::run(void* arg)
+{
+  static_cast<admin*>(arg)->run();
+  return nullptr;
+}
+
+void net::tcp::admin::run()
+{
+  const size_t nlisteners = _M_listeners.count();
+  struct pollfd fds[max_listeners];
+
+  for (size_t i = 0; i < nlisteners; i++) {
+    fds[i].fd = _M_listeners.fd(i);
+    fds[i].events = POLLIN;
+  }
+
+  do {
+    // Wait for new connections.
+    if (poll(fds, nlisteners, timeout) > 0) {
+      // For each listener...
+      for (size_t i = 0; i < nlisteners; i++) {
+        // If there are new connections...
+        if (fds[i].revents & POLLIN) {
+          // Accept connection (blocking socket).
+          const int fd = accept4(fds[i].fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+          // If the connection could be accepted...
+          if (fd != -1) {
+            // Serve request.
+            serve(fd);
+
+            // Close socket.
+            close(fd);
+          }
+        }
+      }
+    }
+  } while (_M_running);
+}
+
+void net::tcp::admin::serve(int fd)
+{
+  // Don't let a slow client block the admin server.
+  struct timeval tv;
+  tv.tv_sec = io_timeout / 1000;
+  tv.tv_usec = (io_timeout % 1000) * 1000;
+
+  if ((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) ||
+      (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)) {
+    return;
+  }
+
+  // Receive the request headers.
+  char req[max_request + 1];
+  size_t len = 0;
+
+  do {
+    const ssize_t ret = recv(fd, req + len, max_request - len, 0);
+
+    // If some data has been received...
+    if (ret > 0) {
+      len += ret;
+      req[len] = 0;
+
+      // If the end of the headers has been received...
+      if (strstr(req, "\r\n\r\n")) {
+        break;
+      }
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return;
+    }
+  } while (len < max_request);
+
+  char header[256];
+  int n;
+
+  // If the list of upstream servers has to be reloaded...
+  if (strncmp(req, "POST /reload ", 13) == 0) {
+    // The main thread reloads the list when it receives SIGHUP.
+    const char* const status = (kill(getpid(), SIGHUP) == 0) ?
+                                 "202 Accepted" :
+                                 "500 Internal Server Error";
+
+    n = snprintf(header,
+                 sizeof(header),
+                 "HTTP/1.0 %s\r\n"
+                 "Content-Length: 0\r\n"
+                 "Connection: close\r\n"
+                 "\r\n",
+                 status);
+
+    send(fd, header, n);
+    return;
+  }
+
+  // If the metrics have been requested...
+  if (((strncmp(req, "GET /metrics ", 13) == 0) ||
+       (strncmp(req, "GET / ", 6) == 0)) &&
+      (build_metrics())) {
+    n = snprintf(header,
+                 sizeof(header),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Connection: close\r\n"
+                 "\r\n",
+                 _M_body.length());
+
+    // Send the headers and the body.
+    if (send(fd, header, n)) {
+      send(fd, _M_body.data(), _M_body.length());
+    }
+  } else {
+    n = snprintf(header,
+                 sizeof(header),
+                 "HTTP/1.0 404 Not Found\r\n"
+                 "Content-Length: 0\r\n"
+                 "Connection: close\r\n"
+                 "\r\n");
+
+    send(fd, header, n);
+  }
+}
+
+bool net::tcp::admin::build_metrics()
+{
+  const size_t nworkers = _M_forwarder->number_workers();
+  const size_t nslots = _M_forwarder->number_slots();
+
+  _M_body.clear();
+
+  // Counters of the workers.
+  static const struct {
+    const char* name;
+    const char* type;
+    const char* help;
+    const metrics::counter metrics::* counter;
+  } worker_counters[] = {
+    {
+      "tcpforwarder_accepted_connections_total",
+      "counter",
+      "Connections accepted.",
+      &metrics::accepted
+    },
+    {
+      "tcpforwarder_rejected_sessions_total",
+      "counter",
+      "Connections rejected because the connection pool was full.",
+      &metrics::rejected
+    },
+    {
+      "tcpforwarder_active_sessions",
+      "gauge",
+      "Active sessions.",
+      &metrics::active
+    },
+    {
+      "tcpforwarder_aborted_sessions_total",
+      "counter",
+      "Sessions closed because a group of upstream servers lost its quorum.",
+      &metrics::aborted
+    },
+    {
+      "tcpforwarder_received_bytes_total",
+      "counter",
+      "Bytes received from the clients.",
+      &metrics::received
+    },
+    {
+      "tcpforwarder_backpressure_pauses_total",
+      "counter",
+      "Times the sessions stopped reading because an upstream couldn't keep up.",
+      &metrics::pauses
+    },
+    {
+      "tcpforwarder_timeouts_total",
+      "counter",
+      "Connections closed because their connect, idle or write timeout expired.",
+      &metrics::timeouts
+    },
+    {
+      "tcpforwarder_reconnects_total",
+      "counter",
+      "Upstream connections opened to replay a session after a failure.",
+      &metrics::reconnects
+    },
+    {
+      "tcpforwarder_upstreams_epoch",
+      "gauge",
+      "Epoch of the list of upstream servers used for the new sessions.",
+      &metrics::epoch
+    }
+  };
+
+  for (size_t i = 0;
+       i < sizeof(worker_counters) / sizeof(worker_counters[0]);
+       i++) {
+    if (!format("# HELP %s %s\n# TYPE %s %s\n",
+                worker_counters[i].name,
+                worker_counters[i].help,
+                worker_counters[i].name,
+                worker_counters[i].type)) {
+      return false;
+    }
+
+    // For each worker...
+    for (size_t w = 0; w < nworkers; w++) {
+      const metrics& m = *_M_forwarder->metrics(w);
+
+      if (!format("%s{worker=\"%zu\"} %" PRIu64 "\n",
+                  worker_counters[i].name,
+                  w,
+                  (m.*worker_counters[i].counter).get())) {
+        return false;
+      }
+    }
+  }
+
+  // Counters of the upstream servers (aggregated over all the workers).
+  static const struct {
+    const char* name;
+    const char* type;
+    const char* help;
+    const metrics::counter metrics::upstream::* counter;
+  } upstream_counters[] = {
+    {
+      "tcpforwarder_upstream_connects_total",
+      "counter",
+      "Successful connections to the upstream server.",
+      &metrics::upstream::connects
+    },
+    {
+      "tcpforwarder_upstream_connect_failures_total",
+      "counter",
+      "Failed connections to the upstream server.",
+      &metrics::upstream::failures
+    },
+    {
+      "tcpforwarder_upstream_sent_bytes_total",
+      "counter",
+      "Bytes sent to the upstream server.",
+      &metrics::upstream::sent
+    },
+    {
+      "tcpforwarder_upstream_drops_total",
+      "counter",
+      "Connections dropped because their buffer was full.",
+      &metrics::upstream::drops
+    },
+    {
+      "tcpforwarder_upstream_eagain_total",
+      "counter",
+      "Sends which returned EAGAIN.",
+      &metrics::upstream::eagain
+    },
+    {
+      "tcpforwarder_upstream_pending_bytes",
+      "gauge",
+      "Bytes pending to be sent to the upstream server.",
+      &metrics::upstream::pending
+    },
+    {
+      "tcpforwarder_upstream_spilled_bytes_total",
+      "counter",
+      "Bytes spilled to disk because the upstream couldn't keep up.",
+      &metrics::upstream::spilled
+    }
+  };
+
+  for (size_t i = 0;
+       i < sizeof(upstream_counters) / sizeof(upstream_counters[0]);
+       i++) {
+    if (!format("# HELP %s %s\n# TYPE %s %s\n",
+                upstream_counters[i].name,
+                upstream_counters[i].help,
+                upstream_counters[i].name,
+                upstream_counters[i].type)) {
+      return false;
+    }
+
+    // For each upstream server (including the upstream servers which have
+    // been removed from the list)...
+    for (size_t u = 0; u < nslots; u++) {
+      // If the slot is free...
+      socket::address address;
+      if (!_M_forwarder->upstream_address(u, address)) {
+        continue;
+      }
+
+      // Sum the counters of all the workers.
+      uint64_t value = 0;
+      for (size_t w = 0; w < nworkers; w++) {
+        value += (_M_forwarder->metrics(w)->upstreams[u].*
+                  upstream_counters[i].counter).get();
+      }
+
+      char addr[INET6_ADDRSTRLEN + 8];
+      if (!address.to_string(addr, sizeof(addr))) {
+        *addr = 0;
+      }
+
+      if (!format("%s{upstream=\"%s\"} %" PRIu64 "\n",
+                  upstream_counters[i].name,
+                  addr,
+                  value)) {
+        return false;
+      }
+    }
+  }
+
+  // Circuit breakers of the upstream servers (shared by all the workers).
+  const tcp::health& health = _M_forwarder->health();
+  const uint64_t now = connections::now();
+
+  if (!format("# HELP tcpforwarder_upstream_up "
+              "Whether the new sessions are routed to the upstream server "
+              "(0: its circuit breaker is open).\n"
+              "# TYPE tcpforwarder_upstream_up gauge\n")) {
+    return false;
+  }
+
+  for (size_t u = 0; u < nslots; u++) {
+    // If the slot is free...
+    socket::address address;
+    if (!_M_forwarder->upstream_address(u, address)) {
+      continue;
+    }
+
+    char addr[INET6_ADDRSTRLEN + 8];
+    if (!address.to_string(addr, sizeof(addr))) {
+      *addr = 0;
+    }
+
+    if (!format("tcpforwarder_upstream_up{upstream=\"%s\"} %d\n",
+                addr,
+                health.open(u, now) ? 0 : 1)) {
+      return false;
+    }
+  }
+
+  if (!format("# HELP tcpforwarder_upstream_breaker_trips_total "
+              "Times the circuit breaker of the upstream server has opened.\n"
+              "# TYPE tcpforwarder_upstream_breaker_trips_total counter\n")) {
+    return false;
+  }
+
+  for (size_t u = 0; u < nslots; u++) {
+    // If the slot is free...
+    socket::address address;
+    if (!_M_forwarder->upstream_address(u, address)) {
+      continue;
+    }
+
+    char addr[INET6_ADDRSTRLEN + 8];
+    if (!address.to_string(addr, sizeof(addr))) {
+      *addr = 0;
+    }
+
+    if (!format("tcpforwarder_upstream_breaker_trips_total{upstream=\"%s\"} "
+                "%" PRIu64 "\n",
+                addr,
+                health.trips(u))) {
+      return false;
+    }
+  }
+
+  // Memory budget (shared by all the workers).
+  const string::budget& budget = _M_forwarder->budget();
+
+  const struct {
+    const char* name;
+    const char* help;
+    size_t value;
+  } memory_gauges[] = {
+    {
+      "tcpforwarder_memory_budget_bytes",
+      "Memory budget for the buffered data (0: unlimited).",
+      budget.limit()
+    },
+    {
+      "tcpforwarder_memory_used_bytes",
+      "Memory taken from the budget by the workers (in batches).",
+      budget.used()
+    },
+    {
+      "tcpforwarder_memory_high_water_bytes",
+      "Highest memory taken from the budget by the workers.",
+      budget.high_water()
+    }
+  };
+
+  for (size_t i = 0;
+       i < sizeof(memory_gauges) / sizeof(memory_gauges[0]);
+       i++) {
+    if (!format("# HELP %s %s\n# TYPE %s gauge\n%s %zu\n",
+                memory_gauges[i].name,
+                memory_gauges[i].help,
+                memory_gauges[i].name,
+                memory_gauges[i].name,
+                memory_gauges[i].value)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::tcp::admin::format(const char* fmt, ...)
+{
+  char buf[512];
+
+  va_list ap;
+  va_start(ap, fmt);
+  const int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  return ((n > 0) &&
+          (static_cast<size_t>(n) < sizeof(buf)) &&
+          (_M_body.append(buf, n)));
+}
+
+bool net::tcp::admin::send(int fd, const void* buf, size_t len)
+{
+  const uint8_t* b = static_cast<const uint8_t*>(buf);
+
+  while (len > 0) {
+    const ssize_t ret = ::send(fd, b, len, MSG_NOSIGNAL);
+
+    // If we could send some data...
+    if (ret > 0) {
+      b += ret;
+      len -= ret;
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  return true;
+}
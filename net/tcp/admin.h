@@ -0,0 +1,100 @@
+#ifndef NET_TCP_ADMIN_H
+#define NET_TCP_ADMIN_H
+
+#include <pthread.h>
+#include "net/tcp/listeners.h"
+#include "string/buffer.h"
+
+namespace net {
+  namespace tcp {
+    // Forward declaration.
+    class forwarder;
+
+    // Admin server: it serves the metrics of the workers over HTTP (text
+    // exposition format) from its own thread; "POST /reload" makes the
+    // process reload the list of upstream servers (SIGHUP).
+    class admin {
+      public:
+        // Constructor.
+        admin() = default;
+
+        // Destructor.
+        ~admin();
+
+        // Listen.
+        bool listen(const char* address);
+
+        // Is the admin server listening?
+        bool listening() const;
+
+        // Start.
+        bool start(const forwarder* forwarder);
+
+        // Stop.
+        void stop();
+
+      private:
+        // Maximum number of addresses the admin server can listen on.
+        static constexpr const size_t max_listeners = 8;
+
+        // Milliseconds to wait for new connections before checking whether
+        // the admin server has been stopped.
+        static constexpr const int timeout = 250;
+
+        // Milliseconds to wait for the request and to send the response.
+        static constexpr const long io_timeout = 1000;
+
+        // Maximum size of the request.
+        static constexpr const size_t max_request = 4 * 1024;
+
+        // Listeners.
+        listeners _M_listeners;
+
+        // Forwarder.
+        const forwarder* _M_forwarder;
+
+        // Response body.
+        string::buffer _M_body;
+
+        // Thread id.
+        pthread_t _M_thread;
+
+        // Running?
+        bool _M_running = false;
+
+        // Run.
+        static void* run(void* arg);
+        void run();
+
+        // Serve request.
+        void serve(int fd);
+
+        // Build the metrics in the text exposition format.
+        bool build_metrics();
+
+        // Append formatted text to the response body.
+        bool format(const char* fmt, ...)
+          __attribute__((format(printf, 2, 3)));
+
+        // Send.
+        static bool send(int fd, const void* buf, size_t len);
+
+        // Disable copy constructor and assignment operator.
+        admin(const admin&) = delete;
+        admin& operator=(const admin&) = delete;
+    };
+
+    inline bool admin::listen(const char* address)
+    {
+      return ((_M_listeners.count() < max_listeners) &&
+              (_M_listeners.listen(address)));
+    }
+
+    inline bool admin::listening() const
+    {
+      return (_M_listeners.count() > 0);
+    }
+  }
+}
+
+#endif // NET_TCP_ADMIN_H
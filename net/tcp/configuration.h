@@ -0,0 +1,195 @@
+#ifndef NET_TCP_CONFIGURATION_H
+#define NET_TCP_CONFIGURATION_H
+
+#include "net/tcp/spill.h"
+
+namespace net {
+  namespace tcp {
+    // Event loop used by the worker threads.
+    enum class event_loop {
+      epoll,
+      io_uring
+    };
+
+    // Pinning of the worker threads.
+    enum class pinning {
+      // The worker threads can run on any CPU.
+      none,
+
+      // Each worker thread runs on its own CPU.
+      core,
+
+      // Each worker thread runs on the CPUs of the NUMA node of its CPU.
+      node
+    };
+
+    // Steering of the new connections to the worker threads.
+    enum class steering_policy {
+      // The kernel hashes the connections.
+      hash,
+
+      // By the CPU processing the packets of the connection.
+      cpu,
+
+      // To the least loaded of two worker threads chosen at random.
+      load
+    };
+
+    // Routing of the sessions of a listener to the upstream servers.
+    enum class routing_policy {
+      // To all the upstream servers.
+      broadcast,
+
+      // To one upstream server, in turns (weighted).
+      round_robin,
+
+      // To the upstream server with less bytes pending to be sent (relative
+      // to its weight) of two chosen at random.
+      least_pending,
+
+      // To one upstream server, by consistent hashing of the client address
+      // (weighted).
+      hash
+    };
+
+    // What to do when an upstream server cannot keep up with a session (the
+    // buffer of its client connection is full).
+    enum class backpressure_policy {
+      // Close the client connection (the session goes on with the other
+      // upstream servers).
+      drop_upstream,
+
+      // Stop reading from the client until the client connections of the
+      // session drain below the low watermark.
+      pause_downstream,
+
+      // Like pause_downstream, but the client connection is closed if it
+      // doesn't drain in time.
+      drop_after_timeout
+    };
+
+    // Format of the records of the sessions (aggregation mode).
+    enum class record_format {
+      // The records end with a delimiter.
+      delimiter,
+
+      // The records start with their length (big endian, not including the
+      // length itself).
+      length
+    };
+
+    // Configuration (shared by all the worker threads).
+    struct configuration {
+      // Default maximum amount of memory for the connections of each worker
+      // thread (bytes).
+      static constexpr const size_t default_connections_memory =
+        64 * 1024 * 1024;
+
+      // Event loop.
+      event_loop loop = event_loop::epoll;
+
+      // Forward the data with splice()/tee() (only epoll)?
+      bool splice = false;
+
+      // Pinning of the worker threads.
+      pinning pin = pinning::none;
+
+      // Steering of the new connections.
+      steering_policy steer = steering_policy::hash;
+
+      // Number of persistent connections per upstream server and worker
+      // thread over which the sessions are multiplexed (0: a new connection
+      // to each upstream server for every session).
+      size_t multiplex = 0;
+
+      // Aggregate the records of all the sessions into the persistent
+      // connections (instead of framing the data of each session)?
+      bool aggregate = false;
+
+      // Format of the records.
+      record_format records = record_format::delimiter;
+
+      // Delimiter of the records.
+      uint8_t record_delimiter = '\n';
+
+      // Size of the length of the records (1, 2 or 4 bytes).
+      size_t record_length_size = 4;
+
+      // Backpressure policy.
+      backpressure_policy backpressure = backpressure_policy::drop_upstream;
+
+      // Milliseconds a client connection can stay full before it is closed
+      // (drop_after_timeout).
+      uint64_t backpressure_timeout = 5000;
+
+      // Directory where the data which doesn't fit in the buffers of the
+      // client connections is spilled (nullptr: the data is not spilled to
+      // disk).
+      const char* spill_dir = nullptr;
+
+      // Size of the spill queue of each upstream server and worker thread
+      // (bytes).
+      size_t spill_size = spill::default_size;
+
+      // Maximum number of connections per worker thread (0: limited by the
+      // maximum number of open files).
+      size_t max_connections = 0;
+
+      // Maximum amount of memory for the connections of each worker thread
+      // (bytes).
+      size_t connections_memory = default_connections_memory;
+
+      // Maximum amount of memory for the data buffered by all the worker
+      // threads (bytes; 0: unlimited).
+      size_t memory_budget = 0;
+
+      // Milliseconds to wait for the data of the sessions to be sent when the
+      // forwarder is drained.
+      uint64_t drain_timeout = 10000;
+
+      // Number of consecutive failed connections to an upstream server which
+      // make the new sessions skip it for a while (0: never skipped).
+      size_t breaker_failures = 0;
+
+      // Milliseconds between the active probes of the upstream servers (0:
+      // the upstream servers are not probed).
+      uint64_t health_interval = 0;
+
+      // Milliseconds to wait for the connection to an upstream server to be
+      // established (0: no timeout).
+      uint64_t connect_timeout = 0;
+
+      // Milliseconds a session can go without receiving data from the client
+      // before it is closed (0: no timeout).
+      uint64_t idle_timeout = 0;
+
+      // Milliseconds an upstream connection with data pending can go without
+      // sending anything before it is closed (0: no timeout).
+      uint64_t write_timeout = 0;
+
+      // Number of bytes from the start of each session which are kept to
+      // replay the session to a new upstream connection when an upstream
+      // connection fails (0: the sessions are not replayed).
+      size_t replay_window = 0;
+
+      // Maximum number of upstream connections which are opened to replace
+      // the failed ones of a session.
+      size_t max_reconnects = 3;
+
+      // Maximum number of pending TCP Fast Open requests of each listening
+      // socket (0: TCP Fast Open is not enabled on the listeners).
+      size_t fastopen = 0;
+
+      // Connect to the upstream servers with TCP Fast Open (the connection
+      // is deferred until the first data is sent, which goes in the SYN)?
+      bool fastopen_connect = false;
+
+      // Seconds the listeners wait for the first data of a new connection
+      // before accepting it anyway (0: the connections are accepted as soon
+      // as they are established).
+      unsigned defer_accept = 0;
+    };
+  }
+}
+
+#endif // NET_TCP_CONFIGURATION_H
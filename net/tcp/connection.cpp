@@ -1,16 +1,37 @@
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <errno.h>
 #include "net/tcp/connection.h"
 #include "net/tcp/connections.h"
+#include "net/tcp/configuration.h"
+#include "net/tcp/multiplexer.h"
+#include "net/tcp/upstreams.h"
+#include "net/tcp/health.h"
+
+net::tcp::connection::connection(connections& connections)
+  : _M_connections(connections),
+    _M_queue(connections.chunks())
+{
+  _M_timer.data = this;
+}
 
 net::tcp::connection::~connection()
 {
   if (_M_fd != -1) {
     ::close(_M_fd);
   }
+
+  close_pipe();
+
+  if (_M_chunk) {
+    _M_chunk->release();
+  }
 }
 
 void net::tcp::connection::init(int fd)
@@ -27,8 +48,54 @@ void net::tcp::connection::init(int fd)
   // Socket is not connected to the upstream server.
   _M_connected = false;
 
-  // Clear buffer.
-  _M_buf.clear();
+  // The connection is not deferred.
+  _M_deferred = false;
+
+  // Socket is not registered in the io_uring file table.
+  _M_fixed = false;
+
+  // The connection is not being closed.
+  _M_closing = false;
+
+  // Message header for IORING_OP_SENDMSG.
+  memset(&_M_msg, 0, sizeof(struct msghdr));
+
+  // No chunk yet.
+  _M_chunk = nullptr;
+
+  // The pipe is empty.
+  _M_piped = 0;
+
+  // No data on disk.
+  spill::init(_M_spill);
+
+  // Start with chunks of the smallest size class.
+  _M_readsize = string::chunks::class_capacity(0);
+
+  // No upstream server yet.
+  _M_upstream = 0;
+  _M_group = 0;
+  _M_upstreams = nullptr;
+
+  // Not a channel.
+  _M_channel = false;
+
+  // The session is not multiplexed.
+  _M_multiplexed = false;
+
+  // The session cannot be replayed (until it is routed).
+  _M_replayable = false;
+  _M_reconnects = 0;
+
+  // Not paused.
+  _M_paused = false;
+
+  // Not stalled.
+  _M_stalled = false;
+
+  // Not corked.
+  _M_corked = false;
+  _M_unflushed = false;
 
   // Clear pointers.
   _M_server = nullptr;
@@ -38,8 +105,86 @@ void net::tcp::connection::init(int fd)
 
 void net::tcp::connection::close()
 {
+  // Disarm the timer (if it is armed).
+  _M_connections.timers().remove(&_M_timer);
+
+  // If the socket is registered in the io_uring file table...
+  if (_M_fixed) {
+    static const int empty = -1;
+
+    io::uring* const ring = _M_connections.ring();
+
+    // Unregister socket (the kernel holds a reference to the socket until
+    // the slot is cleared). The slot has to be cleared before the socket is
+    // closed: a new socket could get the same descriptor and be registered in
+    // the same slot.
+    struct io_uring_sqe* const sqe = ring->get_sqe();
+    if (sqe) {
+      sqe->opcode = IORING_OP_FILES_UPDATE;
+      sqe->fd = -1;
+      sqe->addr = reinterpret_cast<uint64_t>(&empty);
+      sqe->len = 1;
+      sqe->off = _M_fd;
+      sqe->user_data = op_update;
+    }
+
+    // If the update couldn't be submitted, clear the slot synchronously.
+    if ((!sqe) || (!ring->submit())) {
+      ring->update_file(static_cast<unsigned>(_M_fd), -1);
+    }
+
+    _M_fixed = false;
+  }
+
+  // If the session is multiplexed, close it on the channels.
+  if (_M_multiplexed) {
+    _M_connections.multiplexer()->close(this);
+  }
+
+  // If the connection is in the list of connections to flush...
+  if (_M_unflushed) {
+    _M_connections.remove_unflushed(this);
+  }
+
   ::close(_M_fd);
   _M_fd = -1;
+
+  // If this is a server connection, the session is over.
+  if ((!_M_server) && (!_M_channel)) {
+    _M_connections.metrics().active.sub();
+
+    // The list of upstream servers of the session can be freed once it has
+    // been replaced.
+    if (_M_upstreams) {
+      _M_upstreams->detach(_M_connections.nworker());
+      _M_upstreams = nullptr;
+    }
+  }
+
+  // Close pipe (if any).
+  close_pipe();
+
+  // Release chunk (if any).
+  if (_M_chunk) {
+    _M_chunk->release();
+    _M_chunk = nullptr;
+  }
+
+  // If this is a client connection or a channel, its data is not pending
+  // anymore.
+  if ((_M_server) || (_M_channel)) {
+    upstream_metrics().pending.sub(_M_queue.length() +
+                                   _M_piped +
+                                   _M_spill.length);
+  }
+
+  // Release the data pending to be sent.
+  _M_queue.clear();
+
+  // Release the data spilled to disk (if any).
+  if (_M_spill.length > 0) {
+    _M_connections.spill(_M_upstream)->clear(_M_spill);
+  }
 }
 
 void net::tcp::connection::process_events(uint32_t events)
@@ -51,26 +196,40 @@ void net::tcp::connection::process_events(uint32_t events)
       // Mark the connection as readable.
       _M_readable = true;
 
-      // Read.
-      if ((!read()) || (events & EPOLLRDHUP)) {
-        // Remove server and client connections.
-        remove_server();
+      // If the session is paused, the data will be read when it is resumed.
+      if (_M_paused) {
+        return;
+      }
+
+      // Read (if the session gets paused, the end of the connection will be
+      // reported again when it is resumed).
+      if ((!((_M_pipe[0] != -1) ? splice_read() : read())) ||
+          ((events & EPOLLRDHUP) && (!_M_paused))) {
+        // Remove server and client connections (unless the server connection
+        // has already been removed because its upstream servers are gone).
+        if (is_open()) {
+          remove_server();
+        }
       }
     } else if (events & EPOLLOUT) {
       // The socket is writable (only client connections)...
 
-      // If we are not connected to the upstream server yet...
-      if (!_M_connected) {
+      // If we are not connected to the upstream server yet (if the connection
+      // is deferred, the socket is writable: the SYN is sent with the first
+      // data)...
+      if ((!_M_connected) && (!_M_deferred)) {
         // Get socket error.
         int error;
         socklen_t optlen = sizeof(int);
         if ((getsockopt(_M_fd, SOL_SOCKET, SO_ERROR, &error, &optlen) == 0) &&
             (error == 0)) {
-          _M_connected = true;
+          connected(true);
         } else {
-          // Remove client connection and, if this is the last client connection
-          // of the server, also the server connection.
-          remove_client();
+          connected(false);
+
+          // Remove client connection (if this is the last client connection
+          // of the server, also the server connection) or channel.
+          remove_upstream();
 
           return;
         }
@@ -79,22 +238,37 @@ void net::tcp::connection::process_events(uint32_t events)
       // Mark the connection as writable.
       _M_writable = true;
 
-      // If the buffer is not empty => write.
-      if (((!_M_buf.empty()) && (!write())) || (events & EPOLLRDHUP)) {
-        // Remove client connection and, if this is the last client connection
-        // of the server, also the server connection.
-        remove_client();
+      // If there is data pending to be sent => write.
+      if ((((_M_piped > 0) || (!_M_queue.empty())) && (!write())) ||
+          (events & EPOLLRDHUP)) {
+        // Remove client connection (if this is the last client connection of
+        // the server, also the server connection) or channel.
+        remove_upstream();
+      } else if (_M_server) {
+        drained();
       }
     }
   } else {
     // If this is a server connection...
-    if (!_M_server) {
-      // Remove server and client connections.
-      remove_server();
+    if ((!_M_server) && (!_M_channel)) {
+      // If the connections are being drained, the session is closed once its
+      // data has been sent.
+      if (_M_connections.draining()) {
+        resume();
+      } else {
+        // Remove server and client connections.
+        remove_server();
+      }
     } else {
-      // Remove client connection and, if this is the last client connection of
-      // the server, also the server connection.
-      remove_client();
+      // If we were connecting to the upstream server, the connection has
+      // failed.
+      if (!_M_connected) {
+        connected(false);
+      }
+
+      // Remove client connection (if this is the last client connection of
+      // the server, also the server connection) or channel.
+      remove_upstream();
     }
   }
 }
@@ -117,6 +291,149 @@ void net::tcp::connection::add_client(connection* client)
   _M_client.first = client;
 }
 
+net::tcp::connection*
+net::tcp::connection::open_client(const socket::address& address,
+                                  size_t slot,
+                                  size_t group,
+                                  const tcp::tuning& tuning)
+{
+  const struct sockaddr& addr = static_cast<const struct sockaddr&>(address);
+
+  // If the worker uses io_uring, the sockets are blocking (io_uring takes
+  // care of not blocking).
+  const bool uring = (_M_connections.ring() != nullptr);
+
+  // Create socket.
+  const int fd = ::socket(addr.sa_family,
+                          uring ? SOCK_STREAM : SOCK_STREAM | SOCK_NONBLOCK,
+                          0);
+
+  // If the socket couldn't be created...
+  if (fd == -1) {
+    _M_connections.metrics().upstreams[slot].failures.add();
+    return nullptr;
+  }
+
+  // Tune the socket (before connecting: the buffer sizes determine the
+  // window scale).
+  if (!tuning.apply(fd)) {
+    _M_connections.metrics().upstreams[slot].failures.add();
+
+    // Close socket.
+    ::close(fd);
+
+    return nullptr;
+  }
+
+  // If the connection has to use TCP Fast Open, connect() only defers the
+  // connection if there is a cookie of the upstream server already (it is
+  // not an error if the option cannot be set).
+  const int optval = 1;
+  const bool fastopen = (_M_connections.config()->fastopen_connect) &&
+                        (setsockopt(fd,
+                                    IPPROTO_TCP,
+                                    TCP_FASTOPEN_CONNECT,
+                                    &optval,
+                                    sizeof(int)) == 0);
+
+  // If the worker uses io_uring...
+  if (uring) {
+    // Get new connection.
+    connection* const client = _M_connections.pop();
+
+    if (client) {
+      // Initialize client connection.
+      client->init(fd);
+      client->upstream(slot, group);
+
+      client->_M_corked = tuning.cork;
+
+      // Add client connection.
+      add_client(client);
+
+      // Arm the connect and write timeouts.
+      client->arm();
+
+      // Connect to the upstream server (the operation will be submitted
+      // together with the other ones).
+      if (client->connect(address)) {
+        return client;
+      }
+
+      // Close client connection and return it to the pool.
+      client->unlink_client();
+      client->release();
+    } else {
+      // Close socket.
+      ::close(fd);
+    }
+
+    return nullptr;
+  }
+
+  // Connect to the upstream server.
+  do {
+    const bool connected = (::connect(fd, &addr, address.length()) == 0);
+
+    if ((connected) || (errno == EINPROGRESS)) {
+      // Get new connection.
+      connection* const client = _M_connections.pop();
+
+      if (client) {
+        struct epoll_event ev;
+        ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = client;
+
+        // Add connection to the epoll file descriptor.
+        if (epoll_ctl(_M_connections.epollfd(), EPOLL_CTL_ADD, fd, &ev) == 0) {
+          // Initialize client connection.
+          client->init(fd);
+          client->upstream(slot, group);
+
+          client->_M_corked = tuning.cork;
+
+          // With TCP Fast Open, connect() returns at once if the connection
+          // has been deferred.
+          client->_M_deferred = (fastopen) && (connected);
+
+          // If the data has to be forwarded with splice()/tee(), open pipe
+          // (if the pipe cannot be opened, the data is sent with send()).
+          if (_M_connections.config()->splice) {
+            client->open_pipe();
+          }
+
+          // Add client connection.
+          add_client(client);
+
+          // Arm the connect and write timeouts.
+          client->arm();
+
+          return client;
+        }
+
+        // Return connection to the pool.
+        _M_connections.push(client);
+      }
+
+      // Close socket.
+      ::close(fd);
+
+      return nullptr;
+    } else if (errno != EINTR) {
+      _M_connections.metrics().upstreams[slot].failures.add();
+
+      if (_M_connections.health()) {
+        _M_connections.health()->failure(slot, connections::now());
+      }
+
+      // Close socket.
+      ::close(fd);
+
+      return nullptr;
+    }
+  } while (true);
+}
+
 void net::tcp::connection::remove_server()
 {
   connection* client = _M_client.first;
@@ -125,34 +442,88 @@ void net::tcp::connection::remove_server()
   while (client) {
     connection* const next = client->_M_client.next;
 
-    // Close client connection.
-    client->close();
-
-    // Return client connection to the pool.
-    _M_connections.push(client);
+    // Close client connection and return it to the pool.
+    client->release();
 
     client = next;
   }
 
-  // Close connection.
-  close();
+  // No client connections anymore.
+  _M_client.first = nullptr;
+  _M_client.last = nullptr;
 
-  // Return connection to the pool.
-  _M_connections.push(this);
+  // Close connection and return it to the pool.
+  release();
 }
 
 bool net::tcp::connection::read()
 {
-  static constexpr const size_t buffer_size = 32 * 1024;
-
   do {
-    // Receive.
-    uint8_t buf[buffer_size];
-    const ssize_t ret = ::recv(_M_fd, buf, sizeof(buf), 0);
+    // If there is no chunk or the chunk is full...
+    if ((!_M_chunk) || (_M_chunk->remaining() == 0)) {
+      // Release the full chunk (the client connections might still hold a
+      // reference to it).
+      if (_M_chunk) {
+        _M_chunk->release();
+      }
+
+      // Get new chunk (its size class depends on the size of the previous
+      // reads).
+      if ((_M_chunk = _M_connections.chunks().pop(_M_readsize)) == nullptr) {
+        // The connection should be removed.
+        return false;
+      }
+    }
+
+    // Receive directly into the chunk.
+    uint8_t* const buf = _M_chunk->end();
+    const size_t len = _M_chunk->remaining();
+    const ssize_t ret = ::recv(_M_fd, buf, len, 0);
 
     switch (ret) {
       default:
         {
+          _M_chunk->commit(ret);
+
+          _M_connections.metrics().received.add(ret);
+
+          // Data has been received from the client.
+          _M_active = _M_connections.time();
+
+          // If the whole chunk could be filled, the next chunk should be
+          // bigger; otherwise, twice the size of the read is enough.
+          _M_readsize = (static_cast<size_t>(ret) == _M_chunk->capacity()) ?
+                          _M_chunk->capacity() + 1 :
+                          static_cast<size_t>(ret) * 2;
+
+          // If the session is multiplexed...
+          if (_M_multiplexed) {
+            // Forward the data over the channels.
+            if (!_M_connections.multiplexer()->forward(this,
+                                                       _M_chunk,
+                                                       buf,
+                                                       ret)) {
+              // The session is not forwarded to any upstream server anymore.
+              return false;
+            }
+
+            // If we have exhausted the read I/O space...
+            if (static_cast<size_t>(ret) < len) {
+              _M_readable = false;
+
+              // The connection shouldn't be removed.
+              return true;
+            }
+
+            continue;
+          }
+
+          // Keep the data to replay the session (if it can still be
+          // replayed).
+          if (_M_replayable) {
+            record(_M_chunk, buf, ret);
+          }
+
           // Make `client` point to the first client.
           connection* client = _M_client.first;
 
@@ -162,7 +533,165 @@ bool net::tcp::connection::read()
             connection* const next = client->_M_client.next;
 
             // Send data to the client.
-            if (!client->write(buf, ret)) {
+            if (!client->write(_M_chunk, buf, ret)) {
+              // Remove client connection and, if this is the last client
+              // connection of the server, also the server connection.
+              client->remove_client();
+
+              // If there are no more client connections...
+              if (!_M_client.first) {
+                // The connection shouldn't be removed.
+                return true;
+              }
+            }
+
+            client = next;
+          } while (client);
+
+          // If the session has been paused...
+          if (_M_paused) {
+            // The connection shouldn't be removed.
+            return true;
+          }
+
+          // If we have exhausted the read I/O space...
+          if (static_cast<size_t>(ret) < len) {
+            _M_readable = false;
+
+            // The connection shouldn't be removed.
+            return true;
+          }
+        }
+
+        break;
+      case 0:
+        // Connection closed by peer => remove connection.
+        return false;
+      case -1:
+        if (errno == EAGAIN) {
+          _M_readable = false;
+
+          // The connection shouldn't be removed.
+          return true;
+        } else if (errno != EINTR) {
+          // The connection should be removed.
+          return false;
+        }
+
+        break;
+    }
+  } while (true);
+}
+
+bool net::tcp::connection::splice_read()
+{
+  do {
+    // Splice from the socket into the pipe.
+    const ssize_t ret = ::splice(_M_fd,
+                                 nullptr,
+                                 _M_pipe[1],
+                                 nullptr,
+                                 splice_size,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    switch (ret) {
+      default:
+        {
+          const size_t len = static_cast<size_t>(ret);
+
+          _M_connections.metrics().received.add(len);
+
+          // Data has been received from the client.
+          _M_active = _M_connections.time();
+
+          // Number of client connections which couldn't get all the data
+          // through their pipes.
+          size_t nlagging = 0;
+
+          // Duplicate the data into the pipes of the client connections.
+          for (connection* client = _M_client.first;
+               client;
+               client = client->_M_client.next) {
+            client->_M_teed = 0;
+
+            // If the client connection has a pipe and there is no data in its
+            // queue (the data in the pipe has to be older than the data in the
+            // queue)...
+            if ((client->_M_pipe[1] != -1) && (client->_M_queue.empty())) {
+              const ssize_t n = ::tee(_M_pipe[0],
+                                      client->_M_pipe[1],
+                                      len,
+                                      SPLICE_F_NONBLOCK);
+
+              if (n > 0) {
+                client->_M_piped += n;
+                client->upstream_metrics().pending.add(n);
+                client->_M_teed = static_cast<size_t>(n);
+
+                // If all the data could be duplicated...
+                if (client->_M_teed == len) {
+                  continue;
+                }
+              }
+            }
+
+            nlagging++;
+          }
+
+          const uint8_t* buf = nullptr;
+
+          // If all the client connections got all the data through their
+          // pipes...
+          if (nlagging == 0) {
+            // Discard the data of the pipe.
+            if (::splice(_M_pipe[0],
+                         nullptr,
+                         _M_connections.devnull(),
+                         nullptr,
+                         len,
+                         SPLICE_F_MOVE) != ret) {
+              return false;
+            }
+          } else {
+            // The pipe capacity of some client connections has been exhausted:
+            // fall back to reading the data into a chunk.
+            if ((!_M_chunk) || (_M_chunk->remaining() < len)) {
+              if (_M_chunk) {
+                _M_chunk->release();
+              }
+
+              // Get new chunk.
+              if ((_M_chunk = _M_connections.chunks().pop(len)) == nullptr) {
+                return false;
+              }
+            }
+
+            buf = _M_chunk->end();
+            if (::read(_M_pipe[0], _M_chunk->end(), len) != ret) {
+              return false;
+            }
+
+            _M_chunk->commit(len);
+          }
+
+          // Make `client` point to the first client.
+          connection* client = _M_client.first;
+
+          // Send data to all the clients.
+          do {
+            // Make `next` point to the next client.
+            connection* const next = client->_M_client.next;
+
+            // Send the data of the pipe (if the connection is writable) and
+            // then the data which couldn't be duplicated into the pipe (if
+            // any).
+            if (((client->_M_piped > 0) &&
+                 (client->_M_writable) &&
+                 (!client->splice_write())) ||
+                ((client->_M_teed < len) &&
+                 (!client->write(_M_chunk,
+                                 buf + client->_M_teed,
+                                 len - client->_M_teed)))) {
               // Remove client connection and, if this is the last client
               // connection of the server, also the server connection.
               client->remove_client();
@@ -177,8 +706,14 @@ bool net::tcp::connection::read()
             client = next;
           } while (client);
 
+          // If the session has been paused...
+          if (_M_paused) {
+            // The connection shouldn't be removed.
+            return true;
+          }
+
           // If we have exhausted the read I/O space...
-          if (static_cast<size_t>(ret) < sizeof(buf)) {
+          if (len < splice_size) {
             _M_readable = false;
 
             // The connection shouldn't be removed.
@@ -206,7 +741,52 @@ bool net::tcp::connection::read()
   } while (true);
 }
 
-bool net::tcp::connection::write(const void* buf, size_t len)
+bool net::tcp::connection::splice_write()
+{
+  do {
+    // Splice from the pipe into the socket.
+    const ssize_t ret = ::splice(_M_pipe[0],
+                                 nullptr,
+                                 _M_fd,
+                                 nullptr,
+                                 _M_piped,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    // If we could send some data...
+    if (ret > 0) {
+      upstream_metrics().sent.add(ret);
+      upstream_metrics().pending.sub(ret);
+
+      // Data has been sent to the upstream server.
+      _M_active = _M_connections.time();
+
+      // If the socket is corked, flush it at the end of the iteration.
+      if (_M_corked) {
+        _M_connections.add_unflushed(this);
+      }
+
+      // If the pipe is empty...
+      if ((_M_piped -= ret) == 0) {
+        return true;
+      }
+    } else if (ret < 0) {
+      if (errno == EAGAIN) {
+        upstream_metrics().eagain.add();
+
+        _M_writable = false;
+        return true;
+      } else if (errno != EINTR) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  } while (true);
+}
+
+bool net::tcp::connection::write(string::chunk* chunk,
+                                 const void* buf,
+                                 size_t len)
 {
   // If the connection is writable...
   if (_M_writable) {
@@ -229,36 +809,155 @@ bool net::tcp::connection::write(const void* buf, size_t len)
     }
   }
 
-  // If we can still append the data to the buffer...
-  if (_M_buf.length() + len <= max_buffer_size) {
-    return _M_buf.append(buf, len);
+  // Spill the data to disk (if needed).
+  switch (overflow(buf, len)) {
+    case 1:
+      return true;
+    case -1:
+      upstream_metrics().drops.add();
+      return false;
+  }
+
+  // If we can still queue the data (or the backpressure policy allows
+  // it)...
+  if ((_M_queue.length() + len <= buffer_limit()) || (backpressure())) {
+    // Keep a reference to the chunk (the data is not copied).
+    if (_M_queue.push(chunk, buf, len)) {
+      upstream_metrics().pending.add(len);
+      return true;
+    }
+
+    return false;
   } else {
+    upstream_metrics().drops.add();
     return false;
   }
 }
 
 bool net::tcp::connection::write()
 {
-  // Send.
-  const ssize_t ret = send(_M_buf.data(), _M_buf.length());
+  // If there is data in the pipe (it has to be sent before the data in the
+  // queue)...
+  if (_M_piped > 0) {
+    if (!splice_write()) {
+      return false;
+    }
 
-  // If we could send some data...
-  if (ret > 0) {
-    _M_buf.erase(0, ret);
-    return true;
-  } else {
-    return (errno == EAGAIN);
+    // If the pipe could not be emptied or there is no more data...
+    if ((_M_piped > 0) || (_M_queue.empty())) {
+      return true;
+    }
   }
-}
 
-ssize_t net::tcp::connection::send(const void* buf, size_t len)
-{
+  do {
+    // Get the data of the first segment of the queue.
+    size_t iovcnt;
+    const struct iovec* const iov = _M_queue.iov(iovcnt);
+
+    // Send (a single system call for the whole segment).
+    const ssize_t ret = send(iov, iovcnt);
+
+    // If we could send some data...
+    if (ret > 0) {
+      _M_queue.erase(ret);
+      upstream_metrics().pending.sub(ret);
+
+      // If the queue is empty, move the data spilled to disk (if any) into
+      // the queue.
+      if ((_M_queue.empty()) && (!refill())) {
+        return false;
+      }
+    } else {
+      return (errno == EAGAIN);
+    }
+  } while ((_M_writable) && (!_M_queue.empty()));
+
+  return true;
+}
+
+ssize_t net::tcp::connection::send(const void* buf, size_t len)
+{
+  // If the connection is deferred, the SYN is sent now.
+  _M_deferred = false;
+
   do {
     // Send.
     const ssize_t ret = ::send(_M_fd, buf, len, MSG_NOSIGNAL);
 
     // If we could send some data...
     if (ret > 0) {
+      upstream_metrics().sent.add(ret);
+
+      // Data has been sent to the upstream server.
+      _M_active = _M_connections.time();
+
+      // If the socket is corked, flush it at the end of the iteration.
+      if (_M_corked) {
+        _M_connections.add_unflushed(this);
+      }
+
+      // If we couldn't send all the data...
+      if (static_cast<size_t>(ret) < len) {
+        _M_writable = false;
+      }
+
+      return ret;
+    } else if (ret < 0) {
+      if (errno == EAGAIN) {
+        upstream_metrics().eagain.add();
+
+        _M_writable = false;
+        return -1;
+      } else if (errno == EINPROGRESS) {
+        // The SYN of the deferred connection has been sent without data: the
+        // data will be sent once the connection has been established.
+        _M_writable = false;
+
+        errno = EAGAIN;
+        return -1;
+      } else if (errno != EINTR) {
+        return -1;
+      }
+    }
+  } while (true);
+}
+
+ssize_t net::tcp::connection::send(const struct iovec* iov, size_t iovcnt)
+{
+  // Compute the number of bytes to send.
+  size_t len = 0;
+  for (size_t i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+
+  struct msghdr msg;
+  msg.msg_name = nullptr;
+  msg.msg_namelen = 0;
+  msg.msg_iov = const_cast<struct iovec*>(iov);
+  msg.msg_iovlen = iovcnt;
+  msg.msg_control = nullptr;
+  msg.msg_controllen = 0;
+  msg.msg_flags = 0;
+
+  // If the connection is deferred, the SYN is sent now.
+  _M_deferred = false;
+
+  do {
+    // Send.
+    const ssize_t ret = ::sendmsg(_M_fd, &msg, MSG_NOSIGNAL);
+
+    // If we could send some data...
+    if (ret > 0) {
+      upstream_metrics().sent.add(ret);
+
+      // Data has been sent to the upstream server.
+      _M_active = _M_connections.time();
+
+      // If the socket is corked, flush it at the end of the iteration.
+      if (_M_corked) {
+        _M_connections.add_unflushed(this);
+      }
+
       // If we couldn't send all the data...
       if (static_cast<size_t>(ret) < len) {
         _M_writable = false;
@@ -267,8 +966,17 @@ ssize_t net::tcp::connection::send(const void* buf, size_t len)
       return ret;
     } else if (ret < 0) {
       if (errno == EAGAIN) {
+        upstream_metrics().eagain.add();
+
         _M_writable = false;
         return -1;
+      } else if (errno == EINPROGRESS) {
+        // The SYN of the deferred connection has been sent without data: the
+        // data will be sent once the connection has been established.
+        _M_writable = false;
+
+        errno = EAGAIN;
+        return -1;
       } else if (errno != EINTR) {
         return -1;
       }
@@ -276,7 +984,149 @@ ssize_t net::tcp::connection::send(const void* buf, size_t len)
   } while (true);
 }
 
+bool net::tcp::connection::open_pipe()
+{
+  return (pipe2(_M_pipe, O_NONBLOCK | O_CLOEXEC) == 0);
+}
+
+void net::tcp::connection::close_pipe()
+{
+  if (_M_pipe[0] != -1) {
+    ::close(_M_pipe[0]);
+    ::close(_M_pipe[1]);
+
+    _M_pipe[0] = -1;
+    _M_pipe[1] = -1;
+  }
+}
+
+int net::tcp::connection::overflow(const void* buf, size_t len)
+{
+  // If the data is not spilled to disk or the buffer of the client
+  // connection is not full (and there is no data on disk)...
+  tcp::spill* const spill = _M_connections.spill(_M_upstream);
+  if ((!spill) ||
+      ((_M_spill.length == 0) &&
+       (_M_queue.length() + len <= buffer_limit()))) {
+    return 0;
+  }
+
+  // If the client connection has no data on disk and the rest of the ring
+  // is set aside for the client connections which have, the backpressure
+  // policy decides (the data can still be queued).
+  if ((_M_spill.length == 0) &&
+      (spill->available() < (spill->lists() + 1) * spill_reserve)) {
+    return 0;
+  }
+
+  // Append the data to the records of the client connection.
+  if (spill->push(_M_spill, buf, len)) {
+    upstream_metrics().spilled.add(len);
+    upstream_metrics().pending.add(len);
+
+    // If the space set aside for the client connections with data on disk
+    // is being used, apply the backpressure policy (once the session is
+    // paused, the client connection doesn't spill more data and its share of
+    // the space is left to the others, so no data has to be dropped).
+    if (spill->available() < (spill->lists() + 1) * spill_reserve) {
+      backpressure();
+    }
+
+    return 1;
+  }
+
+  // If there is no older data on disk, the backpressure policy decides.
+  return (_M_spill.length == 0) ? 0 : -1;
+}
+
+bool net::tcp::connection::refill()
+{
+  tcp::spill* const spill = _M_connections.spill(_M_upstream);
+
+  const size_t limit = buffer_limit();
+
+  // While there is data on disk and room in the queue...
+  while ((_M_spill.length > 0) && (_M_queue.length() < limit)) {
+    size_t room = limit - _M_queue.length();
+    if (room > _M_spill.length) {
+      room = _M_spill.length;
+    }
+
+    // Get new chunk.
+    string::chunk* const chunk = _M_connections.chunks().pop(room);
+    if (!chunk) {
+      return false;
+    }
+
+    const uint8_t* const data = chunk->end();
+
+    // Copy the data of the records (they are read sequentially).
+    while ((room > 0) && (chunk->remaining() > 0)) {
+      const void* buf;
+      size_t len = spill->front(_M_spill, buf);
+
+      if (len > room) {
+        len = room;
+      }
+
+      if (len > chunk->remaining()) {
+        len = chunk->remaining();
+      }
+
+      memcpy(chunk->end(), buf, len);
+      chunk->commit(len);
+
+      spill->erase(_M_spill, len);
+
+      room -= len;
+    }
+
+    // Queue the data (the queue keeps its own reference to the chunk).
+    const bool ret = _M_queue.push(chunk, data, chunk->end() - data);
+
+    chunk->release();
+
+    if (!ret) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 void net::tcp::connection::remove_client()
+{
+  // Unlink client connection.
+  unlink_client();
+
+  // If the session can be replayed, replace the client connection (unless
+  // the connections are being drained).
+  if ((_M_server->_M_replayable) && (!_M_connections.draining())) {
+    _M_server->reconnect(this);
+  }
+
+  // Close connection and return it to the pool.
+  release();
+
+  // If this was the last client connection of the server...
+  if (!_M_server->_M_client.first) {
+    _M_connections.metrics().aborted.add();
+
+    // Close server connection and return it to the pool.
+    _M_server->release();
+  } else if (!_M_server->quorum()) {
+    // The session is not forwarded to enough upstream servers of a group.
+    _M_connections.metrics().aborted.add();
+
+    // Remove server connection and its client connections.
+    _M_server->remove_server();
+  } else if (_M_server->_M_paused) {
+    // The session might not have to wait anymore.
+    _M_server->resume();
+  }
+}
+
+void net::tcp::connection::unlink_client()
 {
   // If not the first client connection...
   if (_M_client.prev) {
@@ -291,19 +1141,857 @@ void net::tcp::connection::remove_client()
   } else {
     _M_server->_M_client.last = _M_client.prev;
   }
+}
 
-  // Close connection.
-  close();
+void net::tcp::connection::upstreams(const tcp::upstreams* upstreams)
+{
+  // The list cannot be freed while the session is routed with it.
+  upstreams->attach(_M_connections.nworker());
 
-  // Return connection to the pool.
-  _M_connections.push(this);
+  _M_upstreams = upstreams;
 
-  // If this was the last client connection of the server...
-  if (!_M_server->_M_client.first) {
-    // Close server connection.
-    _M_server->close();
+  // The session can be replayed if there is a replay window and the data
+  // of the client is received into chunks (not spliced).
+  _M_replayable = (_M_connections.config()->replay_window > 0) &&
+                  (_M_pipe[0] == -1);
+}
+
+void net::tcp::connection::record(string::chunk* chunk,
+                                  const void* buf,
+                                  size_t len)
+{
+  // If the data fits in the replay window and could be kept (the data is
+  // not copied)...
+  if ((_M_queue.length() + len <= _M_connections.config()->replay_window) &&
+      (_M_queue.push(chunk, buf, len))) {
+    return;
+  }
+
+  // The session cannot be replayed anymore: release the data.
+  _M_replayable = false;
+  _M_queue.clear();
+}
+
+void net::tcp::connection::reconnect(const connection* client)
+{
+  const configuration* const config = _M_connections.config();
+
+  const tcp::router& router = _M_upstreams->router();
+
+  const size_t first = router.first(client->_M_group);
+  const size_t size = router.size(client->_M_group);
+
+  // Search the failed upstream server in its group.
+  size_t pos = 0;
+  while ((pos < size) && (router.slot(first + pos) != client->_M_upstream)) {
+    pos++;
+  }
+
+  tcp::health* const health = _M_connections.health();
+  const uint64_t now = (health) ? connections::now() : 0;
+
+  // Try the next upstream servers of the group (the failed upstream server
+  // the last one).
+  for (size_t i = 1;
+       (i <= size) && (_M_reconnects < config->max_reconnects);
+       i++) {
+    const size_t upstream = first + ((pos + i) % size);
+    const size_t slot = router.slot(upstream);
+
+    // Is the session already forwarded to the upstream server?
+    bool forwarded = false;
+    for (const connection* c = _M_client.first;
+         (c) && (!forwarded);
+         c = c->_M_client.next) {
+      forwarded = (c->_M_upstream == slot);
+    }
+
+    // Skip the upstream servers the session is already forwarded to and the
+    // ones which are known to be down.
+    if ((forwarded) || ((health) && (!health->available(slot, now)))) {
+      continue;
+    }
+
+    _M_reconnects++;
+
+    // Open new client connection.
+    connection* const
+      replacement = open_client(*_M_upstreams->addresses().address(upstream),
+                                slot,
+                                client->_M_group,
+                                _M_upstreams->tuning(upstream));
+
+    if (replacement) {
+      // Replay the session from its start (the data is not copied).
+      if (replacement->_M_queue.push(_M_queue)) {
+        replacement->upstream_metrics().pending.add(_M_queue.length());
+
+        _M_connections.metrics().reconnects.add();
+
+        return;
+      }
+
+      // Close client connection and return it to the pool.
+      replacement->unlink_client();
+      replacement->release();
+
+      return;
+    }
+  }
+}
+
+bool net::tcp::connection::quorum() const
+{
+  const tcp::router& router = _M_upstreams->router();
+
+  size_t clients[tcp::router::max_groups] = {0};
+
+  // Count the client connections of each group.
+  for (const connection* client = _M_client.first;
+       client;
+       client = client->_M_client.next) {
+    clients[client->_M_group]++;
+  }
+
+  // For each group...
+  for (size_t i = 0; i < router.number_groups(); i++) {
+    // If the group is below its quorum...
+    if (clients[i] < router.quorum(i)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::tcp::connection::backpressure()
+{
+  switch (_M_connections.config()->backpressure) {
+    case backpressure_policy::drop_upstream:
+      return false;
+    case backpressure_policy::drop_after_timeout:
+      // The client connection will be closed if it doesn't drain in time.
+      if (!_M_stalled) {
+        _M_connections.stall(this);
+      }
+
+      // Fall through.
+    case backpressure_policy::pause_downstream:
+      // Stop reading from the client.
+      if (!_M_server->_M_paused) {
+        _M_server->pause();
+      }
+
+      return true;
+  }
+
+  return false;
+}
+
+void net::tcp::connection::pause()
+{
+  _M_paused = true;
+
+  _M_connections.metrics().pauses.add();
+
+  // If the worker uses epoll...
+  const int epollfd = _M_connections.epollfd();
+  if (epollfd != -1) {
+    struct epoll_event ev;
+    ev.events = EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = this;
+
+    // Stop monitoring the socket for reading (the TCP window of the client
+    // will fill up).
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, _M_fd, &ev);
+  }
+}
+
+void net::tcp::connection::drain()
+{
+  // If the connection is being closed...
+  if (_M_closing) {
+    return;
+  }
+
+  // If the session is multiplexed, its data is already in the channels.
+  if (_M_multiplexed) {
+    remove_server();
+    return;
+  }
+
+  // Stop reading from the client.
+  _M_paused = true;
+
+  // If the worker uses epoll...
+  const int epollfd = _M_connections.epollfd();
+  if (epollfd != -1) {
+    struct epoll_event ev;
+    ev.events = EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = this;
+
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, _M_fd, &ev);
+  } else if (_M_inflight & (1u << op_recv)) {
+    // Cancel the receive operation in flight.
+    struct io_uring_sqe* const sqe = _M_connections.ring()->get_sqe();
+    if (sqe) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = reinterpret_cast<uint64_t>(this) | op_recv;
+      sqe->user_data = op_cancel;
+    }
+  }
+
+  // Close the session if there is no data pending.
+  resume();
+}
+
+void net::tcp::connection::resume()
+{
+  // If the connections are being drained, the session is not resumed: it is
+  // closed once all the data has been sent.
+  const bool draining = _M_connections.draining();
+
+  const size_t low = draining ? 0 : low_watermark();
 
-    // Return server connection to the pool.
-    _M_connections.push(_M_server);
+  // For each client connection...
+  for (const connection* client = _M_client.first;
+       client;
+       client = client->_M_client.next) {
+    // If the client connection hasn't drained yet...
+    if (client->_M_queue.length() +
+        client->_M_piped +
+        client->_M_spill.length > low) {
+      return;
+    }
+  }
+
+  if (draining) {
+    // Remove server and client connections.
+    remove_server();
+    return;
+  }
+
+  _M_paused = false;
+
+  // If the worker uses epoll...
+  const int epollfd = _M_connections.epollfd();
+  if (epollfd != -1) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = this;
+
+    // Monitor the socket for reading again (if there is data to read, an
+    // event is reported).
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, _M_fd, &ev) < 0) {
+      // Remove server and client connections.
+      remove_server();
+    }
+  } else if (!submit_recv()) {
+    // Remove server and client connections.
+    remove_server();
+  }
+}
+
+void net::tcp::connection::drained()
+{
+  // If the client connection has drained below the low watermark...
+  if (_M_queue.length() + _M_piped + _M_spill.length <= low_watermark()) {
+    // If the client connection is stalled...
+    if (_M_stalled) {
+      _M_connections.unstall(this);
+    }
+
+    // If the session is paused...
+    if (_M_server->_M_paused) {
+      _M_server->resume();
+    }
+  }
+}
+
+size_t net::tcp::connection::buffer_limit() const
+{
+  const string::budget* const budget = _M_connections.chunks().budget();
+  return (budget) ? budget->scale(max_buffer_size) : max_buffer_size;
+}
+
+size_t net::tcp::connection::low_watermark() const
+{
+  return buffer_limit() / 4;
+}
+
+void net::tcp::connection::release()
+{
+  // If the client connection is stalled...
+  if (_M_stalled) {
+    _M_connections.unstall(this);
+  }
+
+  // Disarm the timer (if it is armed).
+  _M_connections.timers().remove(&_M_timer);
+
+  // If there are no io_uring operations in flight...
+  if (_M_inflight == 0) {
+    // Close connection.
+    close();
+
+    // Return connection to the pool.
+    _M_connections.push(this);
+  } else if (!_M_closing) {
+    _M_closing = true;
+
+    io::uring* const ring = _M_connections.ring();
+
+    // Cancel the operations in flight.
+    for (unsigned op = op_recv; op <= op_poll; op++) {
+      if (_M_inflight & (1u << op)) {
+        struct io_uring_sqe* const sqe = ring->get_sqe();
+        if (sqe) {
+          sqe->opcode = IORING_OP_ASYNC_CANCEL;
+          sqe->fd = -1;
+          sqe->addr = reinterpret_cast<uint64_t>(this) | op;
+          sqe->user_data = op_cancel;
+        } else {
+          // The operations cannot be cancelled: shut the socket down, so
+          // they complete (otherwise a receive operation might wait for an
+          // idle peer forever and the connection would never return to the
+          // pool).
+          ::shutdown(_M_fd, SHUT_RDWR);
+          break;
+        }
+      }
+    }
+  }
+}
+
+bool net::tcp::connection::receive()
+{
+  // Register socket in the io_uring file table and submit receive
+  // operation.
+  return ((register_file()) && (submit_recv()));
+}
+
+bool net::tcp::connection::connect(const socket::address& addr)
+{
+  // Register socket in the io_uring file table.
+  if (register_file()) {
+    // Connect.
+    struct io_uring_sqe* const sqe = prepare(op_connect, IORING_OP_CONNECT);
+
+    if (sqe) {
+      sqe->addr = reinterpret_cast<uint64_t>(
+                    static_cast<const struct sockaddr*>(addr)
+                  );
+
+      sqe->off = addr.length();
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void net::tcp::connection::complete(unsigned op, int res)
+{
+  // The operation is not in flight anymore.
+  _M_inflight &= ~(1u << op);
+
+  // If the connection is being closed...
+  if (_M_closing) {
+    // If this was the last operation in flight...
+    if (_M_inflight == 0) {
+      // Close connection.
+      close();
+
+      // Return connection to the pool.
+      _M_connections.push(this);
+    }
+
+    return;
+  }
+
+  switch (op) {
+    case op_recv:
+      // If some data has been received...
+      if (res > 0) {
+        // Process received data.
+        received(static_cast<size_t>(res));
+      } else if (((res == -EAGAIN) || (res == -EINTR)) && (submit_recv())) {
+        // The receive operation has been resubmitted.
+      } else if (_M_connections.draining()) {
+        // The client is not read anymore (the receive operation has been
+        // cancelled or the client has closed the connection): close the
+        // session once its data has been sent.
+        resume();
+      } else {
+        // Connection closed by peer or error => remove server and client
+        // connections.
+        remove_server();
+      }
+
+      break;
+    case op_send:
+      // If the connection is deferred, it is recorded once the SYN (sent with
+      // the first data) has been acknowledged or the send has failed.
+      if (_M_deferred) {
+        if (res > 0) {
+          const int state = tcp_state();
+
+          // If the SYN has been acknowledged or refused...
+          if (state != TCP_SYN_SENT) {
+            _M_deferred = false;
+            connected(state != TCP_CLOSE);
+          }
+        } else if ((res != -EAGAIN) &&
+                   (res != -EINTR) &&
+                   (res != -EINPROGRESS)) {
+          _M_deferred = false;
+          connected(false);
+        }
+      }
+
+      // If some data has been sent...
+      if (res > 0) {
+        upstream_metrics().sent.add(res);
+
+        // Data has been sent to the upstream server.
+        _M_active = _M_connections.time();
+
+        // If the socket is corked, flush it at the end of the iteration.
+        if (_M_corked) {
+          _M_connections.add_unflushed(this);
+        }
+
+        _M_queue.erase(static_cast<size_t>(res));
+        upstream_metrics().pending.sub(res);
+
+        // If the queue is empty, move the data spilled to disk (if any) into
+        // the queue and, if there is more data to send, submit it.
+        if (((_M_queue.empty()) && (!refill())) ||
+            ((!_M_queue.empty()) && (!submit_send()))) {
+          // Remove client connection and, if this is the last client
+          // connection of the server, also the server connection.
+          remove_client();
+        } else {
+          drained();
+        }
+      } else if (((res != -EAGAIN) &&
+                  (res != -EINTR) &&
+                  (res != -EINPROGRESS)) ||
+                 (!submit_send())) {
+        // Remove client connection and, if this is the last client
+        // connection of the server, also the server connection (with TCP
+        // Fast Open, EINPROGRESS means that the SYN has been sent without
+        // data).
+        remove_client();
+      }
+
+      break;
+    case op_connect:
+      // If we are connected to the upstream server...
+      if (res == 0) {
+        // If the connection has been deferred (TCP Fast Open), the SYN is
+        // sent with the first data and the connection is recorded then.
+        if ((_M_connections.config()->fastopen_connect) &&
+            (tcp_state() == TCP_SYN_SENT)) {
+          _M_deferred = true;
+          _M_connected = true;
+        } else {
+          connected(true);
+        }
+
+        // Get notified when the upstream server closes the connection.
+        struct io_uring_sqe* const sqe = prepare(op_poll, IORING_OP_POLL_ADD);
+
+        if (sqe) {
+          sqe->poll32_events = POLLRDHUP;
+
+          // If the queue is empty or the data could be submitted...
+          if ((_M_queue.empty()) || (submit_send())) {
+            return;
+          }
+        }
+      } else {
+        connected(false);
+      }
+
+      // Remove client connection and, if this is the last client connection
+      // of the server, also the server connection.
+      remove_client();
+
+      break;
+    case op_poll:
+      // If the connection is deferred and the SYN hasn't been acknowledged
+      // yet, the connection has failed unless it has been closed after the
+      // handshake.
+      if (_M_deferred) {
+        int error;
+        socklen_t optlen = sizeof(int);
+        if ((getsockopt(_M_fd, SOL_SOCKET, SO_ERROR, &error, &optlen) != 0) ||
+            (error == ECONNRESET)) {
+          error = 0;
+        }
+
+        _M_deferred = false;
+        connected(error == 0);
+      }
+
+      // The upstream server has closed the connection (or error) => remove
+      // client connection and, if this is the last client connection of the
+      // server, also the server connection.
+      remove_client();
+      break;
+  }
+}
+
+struct io_uring_sqe* net::tcp::connection::prepare(unsigned op, uint8_t opcode)
+{
+  struct io_uring_sqe* const sqe = _M_connections.ring()->get_sqe();
+
+  if (sqe) {
+    sqe->opcode = opcode;
+
+    // If the socket is registered in the io_uring file table...
+    if (_M_fixed) {
+      // The index in the file table is the socket descriptor.
+      sqe->flags = IOSQE_FIXED_FILE;
+    }
+
+    sqe->fd = _M_fd;
+    sqe->user_data = reinterpret_cast<uint64_t>(this) | op;
+
+    // The operation is in flight.
+    _M_inflight |= (1u << op);
+  }
+
+  return sqe;
+}
+
+bool net::tcp::connection::register_file()
+{
+  // If the socket descriptor fits in the io_uring file table...
+  if (static_cast<unsigned>(_M_fd) < _M_connections.ring()->files()) {
+    struct io_uring_sqe* const sqe = prepare(op_update, IORING_OP_FILES_UPDATE);
+
+    if (sqe) {
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->fd = -1;
+      sqe->addr = reinterpret_cast<uint64_t>(&_M_fd);
+      sqe->len = 1;
+      sqe->off = _M_fd;
+
+      // The next operations already use the file table.
+      _M_fixed = true;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  // The socket is used as a normal file.
+  return true;
+}
+
+bool net::tcp::connection::submit_recv()
+{
+  // If there is no chunk or the chunk is full...
+  if ((!_M_chunk) || (_M_chunk->remaining() == 0)) {
+    // Release the full chunk (the client connections might still hold a
+    // reference to it).
+    if (_M_chunk) {
+      _M_chunk->release();
+    }
+
+    // Get new chunk.
+    if ((_M_chunk = _M_connections.chunks().pop(uring_read_size)) == nullptr) {
+      return false;
+    }
+  }
+
+  struct io_uring_sqe* sqe;
+
+  // If the chunk is part of the registered buffer...
+  if ((_M_connections.ring()->buffers() > 0) &&
+      (_M_connections.chunks().in_arena(_M_chunk))) {
+    // Read into the registered buffer.
+    if ((sqe = prepare(op_recv, IORING_OP_READ_FIXED)) == nullptr) {
+      return false;
+    }
+
+    sqe->buf_index = 0;
+  } else {
+    if ((sqe = prepare(op_recv, IORING_OP_RECV)) == nullptr) {
+      return false;
+    }
+  }
+
+  sqe->addr = reinterpret_cast<uint64_t>(_M_chunk->end());
+  sqe->len = static_cast<uint32_t>(_M_chunk->remaining());
+
+  return true;
+}
+
+bool net::tcp::connection::submit_send()
+{
+  struct io_uring_sqe* const sqe = prepare(op_send, IORING_OP_SENDMSG);
+
+  if (sqe) {
+    // Send the data of the first segment of the queue.
+    size_t iovcnt;
+    _M_msg.msg_iov = const_cast<struct iovec*>(_M_queue.iov(iovcnt));
+    _M_msg.msg_iovlen = iovcnt;
+
+    sqe->addr = reinterpret_cast<uint64_t>(&_M_msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::connection::enqueue(string::chunk* chunk,
+                                   const void* buf,
+                                   size_t len)
+{
+  // Spill the data to disk (if needed).
+  switch (overflow(buf, len)) {
+    case 1:
+      return true;
+    case -1:
+      upstream_metrics().drops.add();
+      return false;
+  }
+
+  // If we can still queue the data (or the backpressure policy allows
+  // it)...
+  if ((_M_queue.length() + len <= buffer_limit()) || (backpressure())) {
+    // If the data could be queued...
+    if (_M_queue.push(chunk, buf, len)) {
+      upstream_metrics().pending.add(len);
+
+      // If we are connected and there is no send operation in flight...
+      if ((_M_connected) && ((_M_inflight & (1u << op_send)) == 0)) {
+        // Submit send operation.
+        return submit_send();
+      }
+
+      return true;
+    }
+
+    return false;
+  }
+
+  upstream_metrics().drops.add();
+
+  return false;
+}
+
+void net::tcp::connection::received(size_t len)
+{
+  const uint8_t* const buf = _M_chunk->end();
+  _M_chunk->commit(len);
+
+  _M_connections.metrics().received.add(len);
+
+  // Data has been received from the client.
+  _M_active = _M_connections.time();
+
+  // Keep the data to replay the session (if it can still be replayed).
+  if (_M_replayable) {
+    record(_M_chunk, buf, len);
+  }
+
+  // Make `client` point to the first client.
+  connection* client = _M_client.first;
+
+  // Queue data in all the clients.
+  do {
+    // Make `next` point to the next client.
+    connection* const next = client->_M_client.next;
+
+    // Queue data in the client.
+    if (!client->enqueue(_M_chunk, buf, len)) {
+      // Remove client connection and, if this is the last client connection
+      // of the server, also the server connection.
+      client->remove_client();
+
+      // If there are no more client connections...
+      if (!_M_client.first) {
+        return;
+      }
+    }
+
+    client = next;
+  } while (client);
+
+  // If the session has been paused, the next receive operation will be
+  // submitted when it is resumed.
+  if (_M_paused) {
+    return;
+  }
+
+  // Submit next receive operation.
+  if (!submit_recv()) {
+    // Remove server and client connections.
+    remove_server();
+  }
+}
+
+void net::tcp::connection::remove_upstream()
+{
+  // If this is a channel...
+  if (_M_channel) {
+    _M_connections.multiplexer()->remove(this);
+  } else {
+    // Remove client connection and, if this is the last client connection of
+    // the server, also the server connection.
+    remove_client();
+  }
+}
+
+net::tcp::metrics::upstream& net::tcp::connection::upstream_metrics()
+{
+  return _M_connections.metrics().upstreams[_M_upstream];
+}
+
+void net::tcp::connection::arm()
+{
+  const configuration* const config = _M_connections.config();
+
+  // The idle timeout applies to the server connections, the connect timeout
+  // and then the write timeout to the client connections and channels.
+  const uint64_t timeout = ((!_M_server) && (!_M_channel)) ?
+                             config->idle_timeout :
+                             (config->connect_timeout > 0) ?
+                               config->connect_timeout :
+                               config->write_timeout;
+
+  // If there is a timeout...
+  if (timeout > 0) {
+    _M_active = _M_connections.time();
+    _M_backlogged = false;
+
+    _M_connections.timers().add(&_M_timer, _M_active + timeout);
+  }
+}
+
+void net::tcp::connection::expired()
+{
+  const configuration* const config = _M_connections.config();
+  const uint64_t now = _M_connections.time();
+
+  // If this is a server connection...
+  if ((!_M_server) && (!_M_channel)) {
+    // If the session is paused (an upstream server cannot keep up or the
+    // connections are being drained) or its data is still being sent (by its
+    // client connections or by its channels), the session is not idle.
+    bool busy = (_M_paused) ||
+                ((_M_multiplexed) &&
+                 (_M_connections.multiplexer()->pending(this)));
+
+    for (const connection* client = _M_client.first;
+         (client) && (!busy);
+         client = client->_M_client.next) {
+      busy = (client->_M_queue.length() +
+              client->_M_piped +
+              client->_M_spill.length > 0);
+    }
+
+    if (busy) {
+      _M_active = now;
+    } else if (now - _M_active >= config->idle_timeout) {
+      _M_connections.metrics().timeouts.add();
+
+      // Remove server and client connections.
+      remove_server();
+
+      return;
+    }
+
+    _M_connections.timers().add(&_M_timer, _M_active + config->idle_timeout);
+
+    return;
+  }
+
+  // If we are not connected to the upstream server yet and the connect
+  // timeout has expired...
+  if ((!_M_connected) && (config->connect_timeout > 0)) {
+    // If the connection is deferred until the first data is sent, the SYN
+    // hasn't been sent yet.
+    if (_M_deferred) {
+      _M_connections.timers().add(&_M_timer, now + config->connect_timeout);
+      return;
+    }
+
+    _M_connections.metrics().timeouts.add();
+
+    connected(false);
+
+    // Remove client connection (if this is the last client connection of the
+    // server, also the server connection) or channel.
+    remove_upstream();
+
+    return;
+  }
+
+  // If there is no write timeout...
+  if (config->write_timeout == 0) {
+    return;
+  }
+
+  const bool backlogged = (_M_queue.length() + _M_piped + _M_spill.length > 0);
+
+  // If the connection has had data pending to be sent since the last check
+  // and hasn't sent anything for `write_timeout` milliseconds...
+  if ((backlogged) &&
+      (_M_backlogged) &&
+      (now - _M_active >= config->write_timeout)) {
+    _M_connections.metrics().timeouts.add();
+
+    // Remove client connection (if this is the last client connection of the
+    // server, also the server connection) or channel.
+    remove_upstream();
+
+    return;
+  }
+
+  _M_backlogged = backlogged;
+
+  _M_connections.timers().add(&_M_timer, now + config->write_timeout);
+}
+
+int net::tcp::connection::tcp_state() const
+{
+  struct tcp_info info;
+  socklen_t optlen = sizeof(struct tcp_info);
+
+  return (getsockopt(_M_fd, IPPROTO_TCP, TCP_INFO, &info, &optlen) == 0) ?
+           info.tcpi_state :
+           TCP_CLOSE;
+}
+
+void net::tcp::connection::connected(bool established)
+{
+  tcp::health* const health = _M_connections.health();
+
+  // If the connection has been established...
+  if (established) {
+    _M_connected = true;
+
+    upstream_metrics().connects.add();
+
+    if (health) {
+      health->success(_M_upstream);
+    }
+  } else {
+    upstream_metrics().failures.add();
+
+    if (health) {
+      health->failure(_M_upstream, connections::now());
+    }
   }
 }
@@ -2,18 +2,55 @@
 #define NET_TCP_CONNECTION_H
 
 #include <stdint.h>
-#include "string/buffer.h"
+#include <sys/socket.h>
+#include "string/queue.h"
+#include "net/socket/address.h"
+#include "net/tcp/metrics.h"
+#include "net/tcp/spill.h"
+#include "net/tcp/timers.h"
+#include "io/uring.h"
 
 namespace net {
   namespace tcp {
-    // Forward declaration.
+    // Forward declarations.
     class connections;
+    class multiplexer;
+    class upstreams;
+    struct tuning;
 
-    // TCP connection.
-    class connection {
+    // TCP connection (aligned to the cache line size: the connections are
+    // allocated in slabs).
+    class alignas(64) connection {
       friend class connections;
+      friend class multiplexer;
 
       public:
+        // io_uring operations (encoded in the 3 lowest bits of the user data
+        // of the submission queue entries).
+        static constexpr const unsigned op_accept = 0;
+        static constexpr const unsigned op_recv = 1;
+        static constexpr const unsigned op_send = 2;
+        static constexpr const unsigned op_connect = 3;
+        static constexpr const unsigned op_poll = 4;
+        static constexpr const unsigned op_update = 5;
+        static constexpr const unsigned op_cancel = 6;
+        static constexpr const unsigned op_retry = 7;
+        static constexpr const unsigned op_mask = 7;
+
+        // Size of the chunks used to receive with io_uring (size of the
+        // chunks of the buffer registered with io_uring).
+        static constexpr const size_t
+          uring_read_size = string::chunks::class_capacity(1);
+
+        // Maximum buffer size (high watermark; it shrinks as the memory
+        // budget runs out).
+        static constexpr const size_t max_buffer_size = 1024 * 1024;
+
+        // Space of the spill ring set aside for each client connection with
+        // data on disk, so it can spill the data of one more read (record
+        // and padding) before its session is paused.
+        static constexpr const size_t spill_reserve = 2 * max_buffer_size;
+
         // Constructor.
         connection(connections& connections);
 
@@ -29,18 +66,78 @@ namespace net {
         // Process events.
         void process_events(uint32_t events);
 
+        // Set the slot of the upstream server and its group (only client
+        // connections).
+        void upstream(size_t idx, size_t group = 0);
+
+        // Set the list of upstream servers the session is routed with (only
+        // server connections).
+        void upstreams(const tcp::upstreams* upstreams);
+
         // Add client connection.
         void add_client(connection* client);
 
+        // Open a client connection to the upstream server `address` (slot
+        // `slot` of group `group`, socket tuned with `tuning`) and add it to
+        // the server connection.
+        // Returns the client connection or nullptr if it couldn't be opened
+        // (the server connection is left as it is).
+        connection* open_client(const socket::address& address,
+                                size_t slot,
+                                size_t group,
+                                const tcp::tuning& tuning);
+
         // Remove server connection and its client connections.
         void remove_server();
 
+        // Remove client connection.
+        // If this is the last client connection of the server or a group of
+        // upstream servers falls below its quorum, the server connection is
+        // also removed.
+        void remove_client();
+
+        // Is the session forwarded to the quorum of each group of upstream
+        // servers (only server connections)?
+        bool quorum() const;
+
+        // Stop reading from the client and close the session once the data
+        // received has been sent to the upstream servers (only server
+        // connections).
+        void drain();
+
+        // Arm the timer of the connection for the timeouts of the
+        // configuration: idle timeout (server connections), connect and write
+        // timeouts (client connections and channels). It has to be called
+        // once the connection has been initialized and, if it is a client
+        // connection, added to its server connection.
+        void arm();
+
+        // Does the server connection have client connections (false once it
+        // has been removed)?
+        bool has_clients() const;
+
         // Is the connection open?
         bool is_open() const;
 
+        // Get socket descriptor.
+        int fd() const;
+
+        // Open pipe (the data will be forwarded with splice()/tee()).
+        bool open_pipe();
+
+        // Start receiving from the server connection (io_uring).
+        bool receive();
+
+        // Connect to the upstream server (io_uring).
+        bool connect(const socket::address& addr);
+
+        // Process completion (io_uring).
+        void complete(unsigned op, int res);
+
       private:
-        // Maximum buffer size.
-        static constexpr const size_t max_buffer_size = 1024 * 1024;
+        // Maximum number of bytes to splice at once.
+        static constexpr const size_t
+          splice_size = string::chunks::class_capacity(1);
 
         // Connections.
         connections& _M_connections;
@@ -57,8 +154,58 @@ namespace net {
         // Is the socket connected to the upstream server?
         bool _M_connected;
 
-        // Buffer.
-        string::buffer _M_buf;
+        // Is the connection to the upstream server deferred until the first
+        // data is sent (TCP Fast Open: the SYN carries the data)? With
+        // io_uring, until the SYN has been acknowledged.
+        bool _M_deferred;
+
+        // io_uring operations in flight (bitmask of (1 << op_*)).
+        uint8_t _M_inflight = 0;
+
+        // Is the socket registered in the io_uring file table?
+        bool _M_fixed;
+
+        // Is the connection being closed (waiting for the io_uring operations
+        // in flight to complete)?
+        bool _M_closing;
+
+        // Message header of the send operation in flight (io_uring).
+        struct msghdr _M_msg;
+
+        // Chunk where the data received from the server connection is being
+        // stored (server connections) or where the frame headers are stored
+        // (channels).
+        string::chunk* _M_chunk = nullptr;
+
+        // Expected size of the next read (only server connections).
+        size_t _M_readsize;
+
+        // Data pending to be sent (client connections and channels), data
+        // of the current record (multiplexed server connections, aggregation
+        // mode) or data received from the client since the start of the
+        // session (server connections which can be replayed).
+        // The chunks are shared by all the client connections of the same
+        // server connection.
+        string::queue _M_queue;
+
+        // Pipe (splice()/tee() mode).
+        // For server connections, the data received from the socket is
+        // spliced into the pipe and then duplicated (tee()) into the pipes of
+        // the client connections.
+        // For client connections, the data in the pipe is older than the data
+        // in the queue.
+        int _M_pipe[2] = {-1, -1};
+
+        // Number of bytes in the pipe (only client connections).
+        size_t _M_piped;
+
+        // Records of the data spilled to disk (only client connections).
+        // The data on disk is newer than the data in the queue.
+        spill::list _M_spill;
+
+        // Number of bytes duplicated into the pipe in the current iteration
+        // of splice_read() (only client connections).
+        size_t _M_teed;
 
         // Node.
         struct node {
@@ -78,6 +225,81 @@ namespace net {
         // Pointer to the server connection.
         connection* _M_server;
 
+        // Slot of the upstream server (only client connections and
+        // channels).
+        size_t _M_upstream;
+
+        // Group of the upstream server (only client connections).
+        size_t _M_group;
+
+        // List of upstream servers the session is routed with (only server
+        // connections which are not multiplexed).
+        const tcp::upstreams* _M_upstreams;
+
+        // Is this connection a channel of the multiplexer?
+        bool _M_channel;
+
+        // Id of the first session which can use the channel (only channels).
+        uint32_t _M_first_session;
+
+        // Is the session multiplexed over the channels (only server
+        // connections)?
+        bool _M_multiplexed;
+
+        // Id of the session (only multiplexed server connections).
+        uint32_t _M_session;
+
+        // Number of upstream servers the session is forwarded to and bitmap
+        // of the upstream servers it is not forwarded to anymore (only
+        // multiplexed server connections).
+        size_t _M_nupstreams;
+        uint64_t _M_detached[metrics::max_upstreams / 64];
+
+        // Number of bytes of the length of the current record which have been
+        // received and length of the record or, once the length is complete,
+        // number of bytes left of the record (only multiplexed server
+        // connections, aggregation mode).
+        size_t _M_prefix;
+        size_t _M_record;
+
+        // Can the session still be replayed (all the data received from the
+        // client is in the replay window) and number of upstream connections
+        // opened to replace the failed ones (only server connections)?
+        bool _M_replayable;
+        size_t _M_reconnects;
+
+        // Is the session paused because an upstream server cannot keep up
+        // (only server connections)?
+        bool _M_paused;
+
+        // Is the client connection in the list of stalled connections and
+        // since when (milliseconds)?
+        bool _M_stalled;
+        uint64_t _M_stalled_since;
+
+        // Previous and next stalled client connections.
+        node _M_stall;
+
+        // Is the socket corked and is the connection in the list of
+        // connections to flush at the end of the iteration of the event loop
+        // (only client connections and channels)?
+        bool _M_corked;
+        bool _M_unflushed;
+
+        // Previous and next connections to flush.
+        node _M_flush;
+
+        // Timer of the connect, idle and write timeouts.
+        timers::timer _M_timer;
+
+        // Time of the last activity (milliseconds): data received (server
+        // connections) or sent (client connections and channels).
+        uint64_t _M_active;
+
+        // Did the client connection have data pending to be sent the last
+        // time the write timeout was checked?
+        bool _M_backlogged;
+
         // For server connections:
         //   * Pointer to the first and last client connections.
         // For client connections:
@@ -96,32 +318,143 @@ namespace net {
         //          removed.
         bool read();
 
+        // Splice from the server connection into the pipe and duplicate the
+        // data for the client connections (same return values as read()).
+        bool splice_read();
+
+        // Splice the data of the pipe into the socket.
+        bool splice_write();
+
         // Write.
-        bool write(const void* buf, size_t len);
+        bool write(string::chunk* chunk, const void* buf, size_t len);
         bool write();
 
         // Send.
         ssize_t send(const void* buf, size_t len);
+        ssize_t send(const struct iovec* iov, size_t iovcnt);
 
-        // Remove client connection.
-        // If this is the last client connection of the server, the server
-        // connection is also removed.
-        void remove_client();
+        // Close pipe.
+        void close_pipe();
+
+        // Spill the data to disk if the buffer of the client connection is
+        // full or there is older data on disk already.
+        // Returns:
+        //   1: the data has been spilled to disk.
+        //   0: the data has to be queued.
+        //   -1: the data couldn't be spilled to disk and cannot be queued
+        //       either (there is older data on disk).
+        int overflow(const void* buf, size_t len);
+
+        // Move the data spilled to disk into the queue (up to the maximum
+        // buffer size).
+        bool refill();
+
+        // The buffer of the client connection is full: apply the
+        // backpressure policy (returns false if the client connection has to
+        // be closed).
+        bool backpressure();
+
+        // Stop reading from the server connection.
+        void pause();
+
+        // Start reading again from the server connection if all its client
+        // connections have drained below the low watermark (if the
+        // connections are being drained, close the session once they have
+        // sent all their data).
+        void resume();
+
+        // Some data of the client connection has been sent.
+        void drained();
+
+        // Get the current buffer size (high watermark).
+        size_t buffer_limit() const;
+
+        // Get the low watermark: a paused session is resumed when the data
+        // pending to be sent by each of its client connections drops below
+        // it.
+        size_t low_watermark() const;
+
+        // Close the connection and return it to the pool.
+        // If there are io_uring operations in flight, they are cancelled and
+        // the connection is released when the last one completes.
+        void release();
+
+        // Prepare submission queue entry (io_uring).
+        struct io_uring_sqe* prepare(unsigned op, uint8_t opcode);
+
+        // Register the socket in the io_uring file table (the next submission
+        // queue entry is linked to the update).
+        bool register_file();
+
+        // Submit receive operation (io_uring).
+        bool submit_recv();
+
+        // Submit send operation (io_uring).
+        bool submit_send();
+
+        // Queue data and send it when possible (io_uring).
+        bool enqueue(string::chunk* chunk, const void* buf, size_t len);
+
+        // Process received data (io_uring).
+        void received(size_t len);
+
+        // Remove client connection or channel.
+        void remove_upstream();
+
+        // Unlink the client connection from its server connection.
+        void unlink_client();
+
+        // Keep the data received from the client in the replay window (if the
+        // data doesn't fit, the session cannot be replayed anymore).
+        void record(string::chunk* chunk, const void* buf, size_t len);
+
+        // Replace the failed client connection `client` (already unlinked)
+        // by a new connection to an upstream server of its group and replay
+        // the session from its start.
+        void reconnect(const connection* client);
+
+        // Get metrics of the upstream server (only client connections and
+        // channels).
+        metrics::upstream& upstream_metrics();
+
+        // Record the result of the connection to the upstream server (only
+        // client connections and channels).
+        void connected(bool established);
+
+        // Get the TCP state of the socket (TCP_SYN_SENT if the connection is
+        // deferred or its SYN hasn't been acknowledged yet; TCP_CLOSE on
+        // error).
+        int tcp_state() const;
+
+        // The timer of the connection has expired: close the connection if
+        // its timeout has expired or rearm the timer.
+        void expired();
 
         // Disable copy constructor and assignment operator.
         connection(const connection&) = delete;
         connection& operator=(const connection&) = delete;
     };
 
-    inline connection::connection(connections& connections)
-      : _M_connections(connections)
+    inline void connection::upstream(size_t idx, size_t group)
     {
+      _M_upstream = idx;
+      _M_group = group;
     }
 
     inline bool connection::is_open() const
     {
       return (_M_fd != -1);
     }
+
+    inline int connection::fd() const
+    {
+      return _M_fd;
+    }
+
+    inline bool connection::has_clients() const
+    {
+      return (_M_client.first != nullptr);
+    }
   }
 }
 
@@ -1,19 +1,56 @@
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <new>
+#include <sys/mman.h>
 #include "net/tcp/connections.h"
 #include "net/tcp/connection.h"
+#include "net/tcp/configuration.h"
+#include "net/tcp/spill.h"
+#include "net/tcp/tuning.h"
+#include "os/numa.h"
 
 net::tcp::connections::~connections()
 {
-  erase(_M_connections);
-  erase(_M_free);
-  erase(_M_firsttemp);
+  if (_M_slabs) {
+    for (size_t i = _M_used; i > 0; i--) {
+      connection* const slab = _M_slabs[i - 1];
+
+      // Destroy connections.
+      for (size_t j = 0; j < allocation; j++) {
+        slab[j].~connection();
+      }
+
+      munmap(slab, allocation * sizeof(connection));
+    }
+
+    free(_M_slabs);
+  }
+
+  if (_M_spills) {
+    delete [] _M_spills;
+  }
+
+  if (_M_devnull != -1) {
+    close(_M_devnull);
+  }
+}
+
+bool net::tcp::connections::open_devnull()
+{
+  // If /dev/null has already been opened...
+  if (_M_devnull != -1) {
+    return true;
+  }
+
+  return ((_M_devnull = open("/dev/null", O_WRONLY | O_CLOEXEC)) != -1);
 }
 
 net::tcp::connection* net::tcp::connections::pop()
 {
-  // Allocate connection (if needed).
-  if (allocate()) {
+  // Allocate slab (if needed).
+  if ((_M_nconnections < _M_max_connections) && (allocate())) {
     connection* conn = _M_free;
 
     _M_free = _M_free->_M_node.next;
@@ -59,6 +96,211 @@ void net::tcp::connections::release_temporary()
   }
 }
 
+void net::tcp::connections::stall(connection* conn)
+{
+  conn->_M_stalled = true;
+  conn->_M_stalled_since = now();
+
+  // Append connection (the list is sorted by time).
+  conn->_M_stall.prev = _M_laststalled;
+  conn->_M_stall.next = nullptr;
+
+  if (_M_laststalled) {
+    _M_laststalled->_M_stall.next = conn;
+  } else {
+    _M_firststalled = conn;
+  }
+
+  _M_laststalled = conn;
+}
+
+void net::tcp::connections::unstall(connection* conn)
+{
+  // If not the first connection...
+  if (conn->_M_stall.prev) {
+    conn->_M_stall.prev->_M_stall.next = conn->_M_stall.next;
+  } else {
+    _M_firststalled = conn->_M_stall.next;
+  }
+
+  // If not the last connection...
+  if (conn->_M_stall.next) {
+    conn->_M_stall.next->_M_stall.prev = conn->_M_stall.prev;
+  } else {
+    _M_laststalled = conn->_M_stall.prev;
+  }
+
+  conn->_M_stalled = false;
+}
+
+void net::tcp::connections::expire(uint64_t timeout)
+{
+  // If there are stalled connections...
+  if (_M_firststalled) {
+    const uint64_t t = now();
+
+    // While the oldest stalled connection has expired...
+    while ((_M_firststalled) &&
+           (t - _M_firststalled->_M_stalled_since >= timeout)) {
+      connection* const conn = _M_firststalled;
+
+      conn->upstream_metrics().drops.add();
+
+      // Remove client connection (it is removed from the list of stalled
+      // connections) and, if needed, also the server connection.
+      conn->remove_client();
+    }
+  }
+}
+
+void net::tcp::connections::add_unflushed(connection* conn)
+{
+  // If the connection is already in the list...
+  if (conn->_M_unflushed) {
+    return;
+  }
+
+  conn->_M_unflushed = true;
+
+  // Prepend connection.
+  conn->_M_flush.prev = nullptr;
+  conn->_M_flush.next = _M_unflushed;
+
+  if (_M_unflushed) {
+    _M_unflushed->_M_flush.prev = conn;
+  }
+
+  _M_unflushed = conn;
+}
+
+void net::tcp::connections::remove_unflushed(connection* conn)
+{
+  // If not the first connection...
+  if (conn->_M_flush.prev) {
+    conn->_M_flush.prev->_M_flush.next = conn->_M_flush.next;
+  } else {
+    _M_unflushed = conn->_M_flush.next;
+  }
+
+  // If not the last connection...
+  if (conn->_M_flush.next) {
+    conn->_M_flush.next->_M_flush.prev = conn->_M_flush.prev;
+  }
+
+  conn->_M_unflushed = false;
+}
+
+void net::tcp::connections::flush()
+{
+  // For each corked connection which has sent data...
+  while (_M_unflushed) {
+    connection* const conn = _M_unflushed;
+
+    _M_unflushed = conn->_M_flush.next;
+    conn->_M_unflushed = false;
+
+    // Send the partial segments (if the socket cannot be uncorked, the
+    // kernel sends them after 200 ms anyway).
+    tuning::flush(conn->_M_fd);
+  }
+}
+
+bool net::tcp::connections::spill(const char* dir,
+                                  size_t size,
+                                  size_t nupstreams)
+{
+  // If the spill queues haven't been allocated yet...
+  if (!_M_spills) {
+    // Allocate a spill queue per slot (the files are created on demand).
+    if ((_M_spills = new (std::nothrow)
+                       tcp::spill[metrics::max_upstreams]) == nullptr) {
+      return false;
+    }
+  }
+
+  // Create the files of the spill queues which haven't been created yet.
+  for (size_t i = 0; i < nupstreams; i++) {
+    if ((!_M_spills[i].is_open()) && (!_M_spills[i].open(dir, size))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void net::tcp::connections::reset(size_t upstream)
+{
+  _M_metrics.upstreams[upstream].reset();
+
+  // Discard the records of the spill queue (if it has been allocated).
+  if (_M_spills) {
+    _M_spills[upstream].reset();
+  }
+}
+
+uint64_t net::tcp::connections::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000) +
+         (static_cast<uint64_t>(ts.tv_nsec) / 1000000);
+}
+
+void net::tcp::connections::timeouts()
+{
+  _M_timers.expire(now(), expired);
+}
+
+int net::tcp::connections::timeout(int max) const
+{
+  int timeout = _M_timers.timeout(max);
+
+  // If the client connections which stay stalled have to be closed and there
+  // are stalled client connections...
+  if ((_M_config->backpressure == backpressure_policy::drop_after_timeout) &&
+      (_M_firststalled)) {
+    const uint64_t expires = _M_firststalled->_M_stalled_since +
+                             _M_config->backpressure_timeout;
+
+    if (expires < _M_timers.now() + static_cast<uint64_t>(timeout)) {
+      timeout = (expires > _M_timers.now()) ?
+                  static_cast<int>(expires - _M_timers.now()) :
+                  0;
+    }
+  }
+
+  // Take into account the time elapsed since the timers were processed.
+  const uint64_t elapsed = now() - _M_timers.now();
+
+  return (static_cast<uint64_t>(timeout) > elapsed) ?
+           timeout - static_cast<int>(elapsed) :
+           0;
+}
+
+void net::tcp::connections::expired(tcp::timers::timer* t)
+{
+  static_cast<connection*>(t->data)->expired();
+}
+
+void net::tcp::connections::drain()
+{
+  _M_draining = true;
+
+  // For each slab...
+  for (size_t i = 0; i < _M_used; i++) {
+    // For each connection of the slab...
+    for (size_t j = 0; j < allocation; j++) {
+      connection* const conn = &_M_slabs[i][j];
+
+      // If the connection is the server connection of a session...
+      if ((conn->is_open()) && (!conn->_M_server) && (!conn->_M_channel)) {
+        conn->drain();
+      }
+    }
+  }
+}
+
 void net::tcp::connections::unlink(connection* conn)
 {
   // If not the first connection...
@@ -85,39 +327,66 @@ void net::tcp::connections::add_temporary(connection* conn)
   }
 }
 
-void net::tcp::connections::erase(const connection* conn)
-{
-  while (conn) {
-    const connection* const next = conn->_M_node.next;
-
-    delete conn;
-
-    conn = next;
-  }
-}
-
 bool net::tcp::connections::allocate()
 {
   // If there are free connections...
   if (_M_free) {
+    _M_hits++;
     return true;
   } else {
-    // Compute the maximum number of connections which could be allocated.
-    const size_t max = max_connections - _M_nconnections;
+    _M_misses++;
+
+    // If the new slab would exceed the memory budget...
+    if ((_M_used + 1) * allocation * sizeof(connection) > _M_max_memory) {
+      return false;
+    }
+
+    // Make room for the new slab.
+    if (_M_used == _M_size) {
+      const size_t size = (_M_size > 0) ? _M_size * 2 : 8;
+
+      connection** slabs = static_cast<connection**>(
+                             realloc(_M_slabs, size * sizeof(connection*))
+                           );
+
+      if (!slabs) {
+        return false;
+      }
+
+      _M_slabs = slabs;
+      _M_size = size;
+    }
+
+    // Allocate slab (page-aligned, so every connection is aligned to the
+    // cache line size).
+    void* const mem = mmap(nullptr,
+                           allocation * sizeof(connection),
+                           PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS,
+                           -1,
+                           0);
 
-    for (size_t i = (allocation <= max) ?  allocation : max; i > 0; i--) {
-      // Create new connection.
-      connection* conn = new (std::nothrow) connection(*this);
+    // If the slab could be allocated...
+    if (mem != MAP_FAILED) {
+      // Allocate the pages on the NUMA node of the worker (before they are
+      // touched).
+      os::numa::bind(mem, allocation * sizeof(connection), _M_node);
+
+      connection* const slab = static_cast<connection*>(mem);
+
+      // Construct connections and add them to the free list.
+      for (size_t i = allocation; i > 0; i--) {
+        connection* const conn = new (slab + (i - 1)) connection(*this);
 
-      // If the connection could be created...
-      if (conn) {
         conn->_M_node.next = _M_free;
         _M_free = conn;
-      } else {
-        break;
       }
+
+      _M_slabs[_M_used++] = slab;
+
+      return true;
     }
 
-    return (_M_free != nullptr);
+    return false;
   }
 }
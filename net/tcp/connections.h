@@ -1,16 +1,43 @@
 #ifndef NET_TCP_CONNECTIONS_H
 #define NET_TCP_CONNECTIONS_H
 
+#include <stdint.h>
+#include "string/chunks.h"
+#include "net/tcp/metrics.h"
+#include "net/tcp/spill.h"
+#include "net/tcp/timers.h"
+#include "net/tcp/configuration.h"
+#include "io/uring.h"
+
 namespace net {
   namespace tcp {
-    // Forward declaration.
+    // Forward declarations.
     class connection;
+    class multiplexer;
+    class upstreams;
+    class health;
 
     // TCP connections.
+    // The connections are allocated in slabs (contiguous memory, each
+    // connection aligned to the cache line size) and recycled; the pool grows
+    // on demand, up to a maximum number of connections and a maximum amount of
+    // memory.
     class connections {
       public:
-        // Maximum number of connections.
-        static constexpr const size_t max_connections = 4 * 1024;
+        // Statistics.
+        struct statistics {
+          // Connections taken from the free list.
+          uint64_t hits;
+
+          // Connections which required a new slab.
+          uint64_t misses;
+
+          // Number of slabs of connections.
+          uint64_t slabs;
+
+          // Statistics of the pool of chunks.
+          string::chunks::statistics chunks;
+        };
 
         // Constructor.
         connections() = default;
@@ -18,7 +45,11 @@ namespace net {
         // Destructor.
         ~connections();
 
-        // Get new connection.
+        // Set the maximum number of connections and the maximum amount of
+        // memory for the connections.
+        void limits(size_t max_connections, size_t max_memory);
+
+        // Get new connection (nullptr if the limits have been reached).
         connection* pop();
 
         // Return connection.
@@ -27,8 +58,132 @@ namespace net {
         // Release temporary connections.
         void release_temporary();
 
+        // Get pool of chunks.
+        string::chunks& chunks();
+
+        // Get io_uring instance (nullptr if the worker uses epoll).
+        io::uring* ring();
+
+        // Set io_uring instance.
+        void ring(io::uring* ring);
+
+        // Get multiplexer (nullptr if the sessions are not multiplexed).
+        tcp::multiplexer* multiplexer();
+
+        // Set multiplexer.
+        void multiplexer(tcp::multiplexer* multiplexer);
+
+        // Get configuration.
+        const configuration* config() const;
+
+        // Set configuration.
+        void config(const configuration* config);
+
+        // Get epoll file descriptor (-1 if the worker uses io_uring).
+        int epollfd() const;
+
+        // Set epoll file descriptor.
+        void epollfd(int epollfd);
+
+        // Open /dev/null (where the data of the pipes which has been
+        // duplicated into the pipes of all the client connections is
+        // discarded).
+        bool open_devnull();
+
+        // Get file descriptor of /dev/null (-1 if it hasn't been opened).
+        int devnull() const;
+
+        // Add client connection to the list of stalled connections (its
+        // buffer is full).
+        void stall(connection* conn);
+
+        // Remove client connection from the list of stalled connections.
+        void unstall(connection* conn);
+
+        // Close the client connections which have been stalled for `timeout`
+        // milliseconds or more.
+        void expire(uint64_t timeout);
+
+        // Add corked connection to the list of connections to flush at the
+        // end of the iteration of the event loop (if it is not there yet).
+        void add_unflushed(connection* conn);
+
+        // Remove connection from the list of connections to flush.
+        void remove_unflushed(connection* conn);
+
+        // Send the partial segments held by the corked connections which have
+        // sent data in this iteration of the event loop.
+        void flush();
+
+        // Get monotonic time (milliseconds).
+        static uint64_t now();
+
+        // Get the timers of the connections.
+        tcp::timers& timers();
+
+        // Get the time of the timers (the time when the expired timers were
+        // last processed, milliseconds).
+        uint64_t time() const;
+
+        // Process the timers of the connections which have expired.
+        void timeouts();
+
+        // Get the number of milliseconds until the next timer of a
+        // connection or a stalled client connection expires (at most `max`).
+        int timeout(int max) const;
+
+        // Drain: stop reading from the clients and close each session once
+        // the data received has been sent to its upstream servers.
+        void drain();
+
+        // Are the connections being drained?
+        bool draining() const;
+
+        // Create the spill queues of the first `nupstreams` slots of
+        // upstream servers which haven't been created yet (files of `size`
+        // bytes in the directory `dir`).
+        bool spill(const char* dir, size_t size, size_t nupstreams);
+
+        // Get the spill queue of the upstream server of a slot (nullptr if
+        // the data is not spilled to disk).
+        tcp::spill* spill(size_t upstream);
+
+        // Reset the counters and the spill queue of a slot of upstream server
+        // (the slot has been freed and no connection uses it).
+        void reset(size_t upstream);
+
+        // Get the list of upstream servers the new sessions are routed with.
+        const tcp::upstreams* upstreams() const;
+
+        // Set the list of upstream servers.
+        void upstreams(const tcp::upstreams* upstreams);
+
+        // Get the health of the upstream servers (nullptr if the upstream
+        // servers are never skipped).
+        tcp::health* health();
+
+        // Set the health of the upstream servers.
+        void health(tcp::health* health);
+
+        // Get worker number.
+        size_t nworker() const;
+
+        // Set worker number.
+        void nworker(size_t nworker);
+
+        // Get metrics.
+        tcp::metrics& metrics();
+        const tcp::metrics& metrics() const;
+
+        // Get statistics.
+        void stats(statistics& stats) const;
+
+        // Set the NUMA node where the connections and the chunks have to be
+        // allocated (-1: any).
+        void node(int node);
+
       private:
-        // Allocation.
+        // Number of connections per slab.
         static constexpr const size_t allocation = 256;
 
         // Connections.
@@ -46,22 +201,221 @@ namespace net {
         // Number of connections in use.
         size_t _M_nconnections = 0;
 
+        // Maximum number of connections.
+        size_t _M_max_connections = SIZE_MAX;
+
+        // Maximum amount of memory for the connections.
+        size_t _M_max_memory = configuration::default_connections_memory;
+
+        // Slabs.
+        connection** _M_slabs = nullptr;
+        size_t _M_size = 0;
+        size_t _M_used = 0;
+
+        // Connections taken from the free list.
+        uint64_t _M_hits = 0;
+
+        // Connections which required a new slab.
+        uint64_t _M_misses = 0;
+
+        // Pool of chunks (shared by all the connections of the worker).
+        string::chunks _M_chunks;
+
+        // io_uring instance.
+        io::uring* _M_ring = nullptr;
+
+        // Multiplexer.
+        tcp::multiplexer* _M_multiplexer = nullptr;
+
+        // List of upstream servers the new sessions are routed with.
+        const tcp::upstreams* _M_upstreams = nullptr;
+
+        // Health of the upstream servers (shared by all the worker threads).
+        tcp::health* _M_health = nullptr;
+
+        // Worker number.
+        size_t _M_nworker = 0;
+
+        // Spill queues (one per slot of upstream server).
+        tcp::spill* _M_spills = nullptr;
+
+        // Configuration.
+        const configuration* _M_config = nullptr;
+
+        // epoll file descriptor.
+        int _M_epollfd = -1;
+
+        // File descriptor of /dev/null (splice()/tee() mode).
+        int _M_devnull = -1;
+
+        // Timers of the connect, idle and write timeouts.
+        tcp::timers _M_timers;
+
+        // Stalled client connections (the oldest first).
+        connection* _M_firststalled = nullptr;
+        connection* _M_laststalled = nullptr;
+
+        // Corked connections which have sent data in this iteration of the
+        // event loop.
+        connection* _M_unflushed = nullptr;
+
+        // Are the connections being drained?
+        bool _M_draining = false;
+
+        // NUMA node where the memory has to be allocated (-1: any).
+        int _M_node = -1;
+
+        // Metrics of the worker.
+        tcp::metrics _M_metrics;
+
         // Unlink connection.
         void unlink(connection* conn);
 
+        // The timer of a connection has expired.
+        static void expired(tcp::timers::timer* t);
+
         // Add temporary connection.
         void add_temporary(connection* conn);
 
-        // Erase connection list.
-        static void erase(const connection* conn);
-
-        // Allocate.
+        // Allocate slab.
         bool allocate();
 
         // Disable copy constructor and assignment operator.
         connections(const connections&) = delete;
         connections& operator=(const connections&) = delete;
     };
+
+    inline void connections::limits(size_t max_connections, size_t max_memory)
+    {
+      _M_max_connections = max_connections;
+      _M_max_memory = max_memory;
+    }
+
+    inline string::chunks& connections::chunks()
+    {
+      return _M_chunks;
+    }
+
+    inline void connections::stats(statistics& stats) const
+    {
+      stats.hits = _M_hits;
+      stats.misses = _M_misses;
+      stats.slabs = _M_used;
+      stats.chunks = _M_chunks.stats();
+    }
+
+    inline io::uring* connections::ring()
+    {
+      return _M_ring;
+    }
+
+    inline void connections::ring(io::uring* ring)
+    {
+      _M_ring = ring;
+    }
+
+    inline tcp::multiplexer* connections::multiplexer()
+    {
+      return _M_multiplexer;
+    }
+
+    inline void connections::multiplexer(tcp::multiplexer* multiplexer)
+    {
+      _M_multiplexer = multiplexer;
+    }
+
+    inline const configuration* connections::config() const
+    {
+      return _M_config;
+    }
+
+    inline void connections::config(const configuration* config)
+    {
+      _M_config = config;
+    }
+
+    inline int connections::epollfd() const
+    {
+      return _M_epollfd;
+    }
+
+    inline void connections::epollfd(int epollfd)
+    {
+      _M_epollfd = epollfd;
+    }
+
+    inline int connections::devnull() const
+    {
+      return _M_devnull;
+    }
+
+    inline tcp::spill* connections::spill(size_t upstream)
+    {
+      return ((_M_spills) && (_M_spills[upstream].is_open())) ?
+               &_M_spills[upstream] :
+               nullptr;
+    }
+
+    inline const tcp::upstreams* connections::upstreams() const
+    {
+      return _M_upstreams;
+    }
+
+    inline void connections::upstreams(const tcp::upstreams* upstreams)
+    {
+      _M_upstreams = upstreams;
+    }
+
+    inline tcp::health* connections::health()
+    {
+      return _M_health;
+    }
+
+    inline void connections::health(tcp::health* health)
+    {
+      _M_health = health;
+    }
+
+    inline size_t connections::nworker() const
+    {
+      return _M_nworker;
+    }
+
+    inline void connections::nworker(size_t nworker)
+    {
+      _M_nworker = nworker;
+    }
+
+    inline tcp::timers& connections::timers()
+    {
+      return _M_timers;
+    }
+
+    inline uint64_t connections::time() const
+    {
+      return _M_timers.now();
+    }
+
+    inline bool connections::draining() const
+    {
+      return _M_draining;
+    }
+
+    inline void connections::node(int node)
+    {
+      _M_node = node;
+      _M_chunks.node(node);
+    }
+
+    inline tcp::metrics& connections::metrics()
+    {
+      return _M_metrics;
+    }
+
+    inline const tcp::metrics& connections::metrics() const
+    {
+      return _M_metrics;
+    }
   }
 }
 
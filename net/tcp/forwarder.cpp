@@ -1,13 +1,32 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <new>
 #include "net/tcp/forwarder.h"
+#include "net/tcp/upgrade.h"
 
 net::tcp::forwarder::forwarder(size_t nworkers)
 {
+  // Load the CPUs the process can run on.
+  _M_cpus.load();
+
   if (nworkers == 0) {
-    _M_nworkers = 1;
+    // One worker thread per available CPU (taking into account the affinity
+    // mask and the CPU quota).
+    nworkers = (_M_cpus.available() > 0) ? _M_cpus.available() : 1;
   } else if (nworkers > max_workers) {
-    _M_nworkers = max_workers;
-  } else {
-    _M_nworkers = nworkers;
+    nworkers = max_workers;
+  }
+
+  // Allocate worker threads (aligned to the cache line size).
+  void* workers;
+  if (posix_memalign(&workers,
+                     alignof(worker),
+                     nworkers * sizeof(worker)) == 0) {
+    _M_workers = static_cast<worker*>(workers);
+
+    for (; _M_nworkers < nworkers; _M_nworkers++) {
+      new (&_M_workers[_M_nworkers]) worker();
+    }
   }
 }
 
@@ -15,6 +34,39 @@ net::tcp::forwarder::~forwarder()
 {
   // Stop threads (if running).
   stop();
+
+  if (_M_workers) {
+    for (size_t i = _M_nworkers; i > 0; i--) {
+      _M_workers[i - 1].~worker();
+    }
+
+    free(_M_workers);
+  }
+
+  // Free the listening addresses (the sockets are closed by the workers).
+  if (_M_listeners) {
+    for (size_t i = 0; i < _M_nlisteners; i++) {
+      free(_M_listeners[i].fds);
+    }
+
+    free(_M_listeners);
+  }
+
+  // Close the listening sockets received from the old process which haven't
+  // been listened on.
+  close_inherited();
+
+  // Free the lists of upstream servers which have been loaded.
+  const tcp::upstreams* const current = _M_current.load();
+  if (current != &_M_upstreams) {
+    delete current;
+  }
+
+  while (_M_retired) {
+    tcp::upstreams* const next = _M_retired->next();
+    delete _M_retired;
+    _M_retired = next;
+  }
 }
 
 bool net::tcp::forwarder::listen(const char* address)
@@ -33,10 +85,17 @@ bool net::tcp::forwarder::listen(const char* address,
                                  in_port_t minport,
                                  in_port_t maxport)
 {
-  // For each worker thread...
-  for (size_t i = 0; i < _M_nworkers; i++) {
+  // If the port range is not valid...
+  if (minport > maxport) {
+    return false;
+  }
+
+  // For each port in the range...
+  for (unsigned port = minport; port <= maxport; port++) {
     // Listen.
-    if (!_M_workers[i].listen(address, minport, maxport)) {
+    socket::address addr;
+    if ((!addr.build(address, static_cast<in_port_t>(port))) ||
+        (!listen(addr))) {
       return false;
     }
   }
@@ -46,14 +105,110 @@ bool net::tcp::forwarder::listen(const char* address,
 
 bool net::tcp::forwarder::listen(const struct sockaddr& addr, socklen_t addrlen)
 {
-  // For each worker thread...
-  for (size_t i = 0; i < _M_nworkers; i++) {
-    // Listen.
-    if (!_M_workers[i].listen(addr, addrlen)) {
+  // If the worker threads couldn't be allocated or the address is too
+  // long...
+  if ((_M_nworkers == 0) || (addrlen > sizeof(struct sockaddr_storage))) {
+    return false;
+  }
+
+  const socket::address address(addr, addrlen);
+
+  // If the forwarder is already listening on the address...
+  for (size_t i = 0; i < _M_nlisteners; i++) {
+    if (_M_listeners[i].address == address) {
+      return true;
+    }
+  }
+
+  // Make room for the new listener.
+  if (_M_nlisteners == _M_listeners_size) {
+    const size_t size = (_M_listeners_size > 0) ? _M_listeners_size * 2 : 8;
+
+    listener* const
+      listeners = static_cast<listener*>(
+                    realloc(_M_listeners, size * sizeof(listener))
+                  );
+
+    if (!listeners) {
       return false;
     }
+
+    _M_listeners = listeners;
+    _M_listeners_size = size;
+  }
+
+  int* const fds = static_cast<int*>(malloc(_M_nworkers * sizeof(int)));
+  if (!fds) {
+    return false;
   }
 
+  // If the old process wasn't listening on the address...
+  if (!adopt(address, fds)) {
+    // Create a listening socket for each worker thread.
+    for (size_t i = 0; i < _M_nworkers; i++) {
+      if ((fds[i] = listeners::open(addr, addrlen)) == -1) {
+        while (i > 0) {
+          close(fds[--i]);
+        }
+
+        free(fds);
+        return false;
+      }
+    }
+  }
+
+  // If the worker threads are running...
+  if (_M_running) {
+    // Tune the sockets and steer the new connections (before the worker
+    // threads start accepting them).
+    if ((!tune(fds, _M_tuning)) ||
+        ((_M_config.steer != steering_policy::hash) && (!steer(fds)))) {
+      for (size_t i = 0; i < _M_nworkers; i++) {
+        close(fds[i]);
+      }
+
+      free(fds);
+      return false;
+    }
+
+    // Send the listening sockets to the worker threads.
+    for (size_t i = 0; i < _M_nworkers; i++) {
+      worker::command cmd;
+      cmd.type = worker::command::kind::add;
+      cmd.fd = fds[i];
+      cmd.routing = _M_routing;
+
+      // If the command couldn't be posted...
+      if (!post(i, cmd)) {
+        close(fds[i]);
+        fds[i] = -1;
+      }
+    }
+  } else {
+    // Add the listening sockets to the worker threads.
+    for (size_t i = 0; i < _M_nworkers; i++) {
+      if (!_M_workers[i].listen(fds[i])) {
+        // Remove the sockets which have already been added.
+        for (size_t j = 0; j < i; j++) {
+          _M_workers[j].unlisten(fds[j]);
+        }
+
+        for (size_t j = i; j < _M_nworkers; j++) {
+          close(fds[j]);
+        }
+
+        free(fds);
+        return false;
+      }
+    }
+  }
+
+  listener& l = _M_listeners[_M_nlisteners++];
+  l.address = address;
+  l.routing = _M_routing;
+  l.tuning = _M_tuning;
+  l.fds = fds;
+
   return true;
 }
 
@@ -62,51 +217,665 @@ bool net::tcp::forwarder::listen(const socket::address& addr)
   return listen(static_cast<const struct sockaddr&>(addr), addr.length());
 }
 
+bool net::tcp::forwarder::unlisten(const socket::address& addr)
+{
+  // Search the listening address.
+  for (size_t i = 0; i < _M_nlisteners; i++) {
+    if (_M_listeners[i].address == addr) {
+      return remove_listener(i);
+    }
+  }
+
+  return false;
+}
+
 bool net::tcp::forwarder::add_upstream_server(const char* address)
 {
-  return _M_upstream_addresses.add(address);
+  return _M_upstreams.addresses().add(address);
 }
 
 bool net::tcp::forwarder::add_upstream_server(const char* address,
                                               in_port_t port)
 {
-  return _M_upstream_addresses.add(address, port);
+  return _M_upstreams.addresses().add(address, port);
 }
 
 bool net::tcp::forwarder::add_upstream_server(const struct sockaddr& addr,
                                               socklen_t addrlen)
 {
-  return _M_upstream_addresses.add(addr, addrlen);
+  return _M_upstreams.addresses().add(addr, addrlen);
 }
 
 bool net::tcp::forwarder::add_upstream_server(const socket::address& addr)
 {
-  return _M_upstream_addresses.add(addr);
+  return _M_upstreams.addresses().add(addr);
+}
+
+bool net::tcp::forwarder::cpu_affinity(const char* cpus)
+{
+  cpu_set_t set;
+  if ((os::cpus::parse_list(cpus, set)) && (_M_cpus.intersect(set))) {
+    _M_affinity = true;
+    return true;
+  }
+
+  return false;
 }
 
 bool net::tcp::forwarder::start(idle_t idle, void* user)
 {
-  // If upstream addresses have been defined...
-  if (_M_upstream_addresses.count() > 0) {
+  // If upstream addresses have been defined (and each one can have its own
+  // metrics)...
+  if ((_M_nworkers > 0) &&
+      (_M_upstreams.addresses().count() > 0) &&
+      (_M_upstreams.addresses().count() <= metrics::max_upstreams)) {
+    // If the CPU affinity has been set, the worker threads are pinned to the
+    // CPUs by default.
+    _M_pin = ((_M_config.pin == pinning::none) && (_M_affinity)) ?
+               pinning::core :
+               _M_config.pin;
+
+    // Close the listening sockets received from the old process which are
+    // not listened on anymore.
+    close_inherited();
+
+    // Assign the slots of the upstream servers and build the round-robin
+    // schedule and the hash ring.
+    if ((!assign_slots(_M_upstreams)) || (!_M_upstreams.build(_M_nworkers))) {
+      return false;
+    }
+
+    // Set the limit of the memory budget shared by the worker threads.
+    _M_budget.limit(_M_config.memory_budget);
+
+    // Set the number of failed connections which open the circuit breaker of
+    // an upstream server.
+    _M_health.threshold(_M_config.breaker_failures);
+
+    // Tune the listening sockets.
+    for (size_t i = 0; i < _M_nlisteners; i++) {
+      if (!tune(_M_listeners[i].fds, _M_listeners[i].tuning)) {
+        return false;
+      }
+    }
+
+    // Steer the new connections (before the worker threads start accepting
+    // them).
+    if ((_M_config.steer != steering_policy::hash) && (!steer())) {
+      return false;
+    }
+
     // For each worker thread...
     for (size_t i = 0; i < _M_nworkers; i++) {
+      cpu_set_t set;
+
       // Start.
-      if (!_M_workers[i].start(i, &_M_upstream_addresses, idle, user)) {
+      if (!_M_workers[i].start(i,
+                               &_M_config,
+                               this,
+                               &_M_budget,
+                               &_M_health,
+                               worker_cpus(i, _M_pin, set) ? &set : nullptr,
+                               idle,
+                               user)) {
+        return false;
+      }
+    }
+
+    // From now on, the listeners are added and removed through the mailboxes
+    // of the worker threads.
+    _M_running = true;
+
+    // Start probing the upstream servers (if they have to be probed and the
+    // circuit breakers can open).
+    if ((_M_config.health_interval > 0) &&
+        (_M_config.breaker_failures > 0) &&
+        (!_M_health.start(this, _M_config.health_interval))) {
+      return false;
+    }
+
+    // Start admin server (if it has to listen).
+    return ((!_M_admin.listening()) || (_M_admin.start(this)));
+  }
+
+  return false;
+}
+
+bool net::tcp::forwarder::reload(tcp::upstreams* upstreams)
+{
+  // The channels of the multiplexer are opened when the worker threads start,
+  // so the list of upstream servers cannot be replaced.
+  if ((_M_config.multiplex > 0) ||
+      (upstreams->addresses().count() == 0) ||
+      (upstreams->addresses().count() > metrics::max_upstreams)) {
+    return false;
+  }
+
+  // Free the replaced lists which are not in use anymore (and their slots).
+  reclaim();
+
+  // Assign the slots of the upstream servers and build the round-robin
+  // schedule and the hash ring.
+  if ((!assign_slots(*upstreams)) || (!upstreams->build(_M_nworkers))) {
+    return false;
+  }
+
+  // Publish the new list (the worker threads load the epoch and then the
+  // list, so a worker thread which has seen the new epoch uses the new list).
+  tcp::upstreams* const
+    old = const_cast<tcp::upstreams*>(_M_current.load());
+
+  _M_current.store(upstreams, std::memory_order_release);
+
+  const uint64_t epoch = _M_epoch.load(std::memory_order_relaxed) + 1;
+  _M_epoch.store(epoch, std::memory_order_release);
+
+  // Retire the old list (the list given before starting is retired too, so
+  // its slots are not freed while it is in use, but it is not freed).
+  old->retired(epoch);
+  old->next(_M_retired);
+  _M_retired = old;
+
+  // Free the replaced lists which are not in use anymore.
+  reclaim();
+
+  return true;
+}
+
+bool net::tcp::forwarder::assign_slots(tcp::upstreams& upstreams)
+{
+  size_t nslots = _M_nslots.load(std::memory_order_relaxed);
+
+  // For each upstream server...
+  const socket::address* address;
+  for (size_t i = 0;
+       (address = upstreams.addresses().address(i)) != nullptr;
+       i++) {
+    // Search the upstream server in the slots in use.
+    size_t slot = 0;
+    while ((slot < nslots) &&
+           (((_M_slots[slot].version.load(std::memory_order_relaxed) & 1) !=
+             0) ||
+            (!(_M_slots[slot].address == *address)))) {
+      slot++;
+    }
+
+    // If the upstream server doesn't have a slot yet...
+    if (slot == nslots) {
+      // Search a free slot.
+      slot = 0;
+      while ((slot < nslots) &&
+             ((_M_slots[slot].version.load(std::memory_order_relaxed) & 1) ==
+              0)) {
+        slot++;
+      }
+
+      if (slot < nslots) {
+        // Give the free slot to the upstream server.
+        _M_slots[slot].address = *address;
+
+        _M_slots[slot].version.store(
+          _M_slots[slot].version.load(std::memory_order_relaxed) + 1,
+          std::memory_order_release
+        );
+      } else if (nslots < metrics::max_upstreams) {
+        // Append a new slot.
+        _M_slots[nslots++].address = *address;
+      } else {
+        // There are no free slots.
         return false;
       }
     }
 
+    upstreams.router().slot(i, slot);
+  }
+
+  // Publish the new slots (the admin server might be reading them).
+  _M_nslots.store(nslots, std::memory_order_release);
+
+  return true;
+}
+
+void net::tcp::forwarder::reclaim()
+{
+  tcp::upstreams* prev = nullptr;
+  tcp::upstreams* upstreams = _M_retired;
+
+  // For each replaced list...
+  while (upstreams) {
+    tcp::upstreams* const next = upstreams->next();
+
+    // If all the worker threads have switched to a newer list...
+    bool unused = true;
+    for (size_t i = 0; i < _M_nworkers; i++) {
+      if (_M_workers[i].metrics().epoch.get() < upstreams->retired()) {
+        unused = false;
+        break;
+      }
+    }
+
+    // If there are no sessions routed with the list...
+    if (unused) {
+      // The worker threads attach the sessions to the list before they
+      // publish their epoch (the sessions have to be counted after the epochs
+      // are read).
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      unused = (upstreams->sessions() == 0);
+    }
+
+    // If the list is not in use anymore...
+    if (unused) {
+      // The worker threads detach the sessions from the list after their last
+      // access to it.
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // Unlink and free the list (unless it is the list given before
+      // starting).
+      if (prev) {
+        prev->next(next);
+      } else {
+        _M_retired = next;
+      }
+
+      if (upstreams != &_M_upstreams) {
+        delete upstreams;
+      }
+    } else {
+      prev = upstreams;
+    }
+
+    upstreams = next;
+  }
+
+  // Mark the slots the current list and the remaining replaced lists refer
+  // to.
+  bool used[metrics::max_upstreams] = {false};
+
+  const tcp::upstreams* list = _M_current.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < list->addresses().count(); i++) {
+    used[list->router().slot(i)] = true;
+  }
+
+  for (list = _M_retired; list; list = list->next()) {
+    for (size_t i = 0; i < list->addresses().count(); i++) {
+      used[list->router().slot(i)] = true;
+    }
+  }
+
+  // Free the slots in use which no list refers to anymore (no session can be
+  // using them: the worker threads reset their counters and their spill
+  // queues once they see the new version).
+  const size_t nslots = _M_nslots.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < nslots; i++) {
+    const uint64_t version =
+      _M_slots[i].version.load(std::memory_order_relaxed);
+
+    if ((!used[i]) && ((version & 1) == 0)) {
+      _M_slots[i].version.store(version + 1, std::memory_order_relaxed);
+
+      // The address might be replaced from now on.
+      std::atomic_thread_fence(std::memory_order_release);
+
+      _M_health.reset(i);
+    }
+  }
+}
+
+bool net::tcp::forwarder::worker_cpus(size_t nworker,
+                                      pinning pin,
+                                      cpu_set_t& set) const
+{
+  // If the worker threads have to be pinned...
+  if ((pin != pinning::none) && (_M_cpus.count() > 0)) {
+    // Assign the CPUs of the affinity mask in order.
+    const int cpu = _M_cpus.cpu(nworker % _M_cpus.count());
+
+    if (pin == pinning::core) {
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+    } else {
+      _M_cpus.node_cpus(cpu, set);
+    }
+
     return true;
   }
 
   return false;
 }
 
+bool net::tcp::forwarder::steer()
+{
+  // Steering by load?
+  if (_M_config.steer == steering_policy::load) {
+    // Create the map where the workers publish their load.
+    if (!_M_steering.create_loads(_M_nworkers)) {
+      return false;
+    }
+
+    for (size_t i = 0; i < _M_nworkers; i++) {
+      _M_workers[i].load(_M_steering.load(i));
+    }
+  }
+
+  // For each listening address...
+  for (size_t i = 0; i < _M_nlisteners; i++) {
+    // Attach steering program.
+    if (!steer(_M_listeners[i].fds)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::tcp::forwarder::steer(const int* fds)
+{
+  // Steering by load?
+  if (_M_config.steer == steering_policy::load) {
+    return _M_steering.by_load(fds, _M_nworkers);
+  }
+
+  // Get the CPU of each worker (-1 if the worker is not pinned to a single
+  // CPU).
+  int cpus[max_workers];
+  for (size_t i = 0; i < _M_nworkers; i++) {
+    cpu_set_t set;
+    if ((worker_cpus(i, _M_pin, set)) && (CPU_COUNT(&set) == 1)) {
+      cpus[i] = 0;
+      while (!CPU_ISSET(cpus[i], &set)) {
+        cpus[i]++;
+      }
+    } else {
+      cpus[i] = -1;
+    }
+  }
+
+  // The index of each listener in the reuseport group is the worker number.
+  return steering::by_cpu(fds, cpus, _M_nworkers);
+}
+
+bool net::tcp::forwarder::tune(const int* fds,
+                               const tcp::tuning& tuning) const
+{
+  // For each listening socket of the listener...
+  for (size_t i = 0; i < _M_nworkers; i++) {
+    // Apply the tuning profile (the accepted connections inherit it).
+    if (!tuning.apply(fds[i])) {
+      return false;
+    }
+
+    // Enable TCP Fast Open (if it has to be enabled).
+    if ((_M_config.fastopen > 0) &&
+        (!listeners::fastopen(fds[i], static_cast<int>(_M_config.fastopen)))) {
+      return false;
+    }
+
+    // Defer the accept until the first data arrives (if it has to be
+    // deferred).
+    if ((_M_config.defer_accept > 0) &&
+        (!listeners::defer_accept(fds[i],
+                                  static_cast<int>(_M_config.defer_accept)))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::tcp::forwarder::adopt(const socket::address& addr, int* fds)
+{
+  // Search the address in the sockets received from the old process.
+  for (size_t i = 0; i < _M_ninherited; i++) {
+    if (_M_inherited[i].address == addr) {
+      memcpy(fds, _M_inherited[i].fds, _M_nworkers * sizeof(int));
+
+      // Remove the address from the sockets received.
+      free(_M_inherited[i].fds);
+      _M_inherited[i] = _M_inherited[--_M_ninherited];
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void net::tcp::forwarder::close_inherited()
+{
+  if (_M_inherited) {
+    for (size_t i = 0; i < _M_ninherited; i++) {
+      for (size_t j = 0; j < _M_nworkers; j++) {
+        close(_M_inherited[i].fds[j]);
+      }
+
+      free(_M_inherited[i].fds);
+    }
+
+    free(_M_inherited);
+
+    _M_inherited = nullptr;
+    _M_ninherited = 0;
+  }
+}
+
+bool net::tcp::forwarder::remove_listener(size_t idx)
+{
+  bool ret = true;
+
+  int* const fds = _M_listeners[idx].fds;
+
+  // For each worker thread...
+  for (size_t i = 0; i < _M_nworkers; i++) {
+    // If the worker thread has the listening socket...
+    if (fds[i] != -1) {
+      if (_M_running) {
+        worker::command cmd;
+        cmd.type = worker::command::kind::remove;
+        cmd.fd = fds[i];
+
+        // The worker thread closes the socket.
+        if (!post(i, cmd)) {
+          ret = false;
+        }
+      } else {
+        _M_workers[i].unlisten(fds[i]);
+      }
+    }
+  }
+
+  free(fds);
+
+  // Move the last listener to its position.
+  _M_listeners[idx] = _M_listeners[--_M_nlisteners];
+
+  return ret;
+}
+
+bool net::tcp::forwarder::post(size_t nworker, const worker::command& cmd)
+{
+  static constexpr const unsigned max_attempts = 1000;
+
+  // The worker thread processes its mailbox at least every 250 ms.
+  for (unsigned i = 0; i < max_attempts; i++) {
+    if (_M_workers[nworker].post(cmd)) {
+      return true;
+    }
+
+    usleep(1000);
+  }
+
+  return false;
+}
+
+bool net::tcp::forwarder::handover(int sock)
+{
+  // If the worker threads are not running...
+  if (!_M_running) {
+    return false;
+  }
+
+  // Send the header.
+  upgrade::header hdr;
+  hdr.magic = upgrade::magic;
+  hdr.nworkers = static_cast<uint32_t>(_M_nworkers);
+  hdr.nlisteners = static_cast<uint32_t>(_M_nlisteners);
+  hdr.loop = static_cast<uint32_t>(_M_config.loop);
+
+  if (!upgrade::send(sock, hdr)) {
+    return false;
+  }
+
+  // Send the listening sockets of each address.
+  for (size_t i = 0; i < _M_nlisteners; i++) {
+    if (!upgrade::send(sock, _M_listeners[i].fds, _M_nworkers)) {
+      return false;
+    }
+  }
+
+  // Wait for the new process to start.
+  if (!upgrade::acknowledged(sock)) {
+    return false;
+  }
+
+  // Stop listening (the new process accepts the new connections).
+  bool ret = true;
+  while (_M_nlisteners > 0) {
+    if (!remove_listener(_M_nlisteners - 1)) {
+      ret = false;
+    }
+  }
+
+  return ret;
+}
+
+bool net::tcp::forwarder::inherit(int sock, size_t& nworkers, event_loop& loop)
+{
+  // Receive the header.
+  upgrade::header hdr;
+  if (!upgrade::receive(sock, hdr)) {
+    return false;
+  }
+
+  nworkers = hdr.nworkers;
+  loop = static_cast<event_loop>(hdr.loop);
+
+  // The sockets of the old process are distributed among the same number of
+  // worker threads.
+  if ((_M_nworkers == 0) ||
+      (nworkers != _M_nworkers) ||
+      (_M_inherited) ||
+      (_M_running)) {
+    return false;
+  }
+
+  if (hdr.nlisteners > 0) {
+    _M_inherited = static_cast<listener*>(
+                     malloc(hdr.nlisteners * sizeof(listener))
+                   );
+
+    if (!_M_inherited) {
+      return false;
+    }
+  }
+
+  // For each listening address...
+  for (uint32_t i = 0; i < hdr.nlisteners; i++) {
+    int* const fds = static_cast<int*>(malloc(_M_nworkers * sizeof(int)));
+    if (!fds) {
+      return false;
+    }
+
+    // Receive the listening sockets.
+    if (!upgrade::receive(sock, fds, _M_nworkers)) {
+      free(fds);
+      return false;
+    }
+
+    listener& l = _M_inherited[_M_ninherited++];
+    l.fds = fds;
+
+    // Get the address the sockets are bound to.
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(struct sockaddr_storage);
+    if (getsockname(fds[0],
+                    reinterpret_cast<struct sockaddr*>(&addr),
+                    &addrlen) < 0) {
+      return false;
+    }
+
+    l.address = socket::address(reinterpret_cast<const struct sockaddr&>(addr),
+                                addrlen);
+  }
+
+  return true;
+}
+
+bool net::tcp::forwarder::drain()
+{
+  // If the worker threads are not running...
+  if (!_M_running) {
+    return false;
+  }
+
+  // Stop listening.
+  bool ret = true;
+  while (_M_nlisteners > 0) {
+    if (!remove_listener(_M_nlisteners - 1)) {
+      ret = false;
+    }
+  }
+
+  // Drain the sessions of each worker thread.
+  for (size_t i = 0; i < _M_nworkers; i++) {
+    worker::command cmd;
+    cmd.type = worker::command::kind::drain;
+
+    if (!post(i, cmd)) {
+      ret = false;
+    }
+  }
+
+  return ret;
+}
+
+uint64_t net::tcp::forwarder::active_sessions() const
+{
+  uint64_t active = 0;
+  for (size_t i = 0; i < _M_nworkers; i++) {
+    active += _M_workers[i].metrics().active.get();
+  }
+
+  return active;
+}
+
+uint64_t net::tcp::forwarder::pending() const
+{
+  const size_t nslots = number_slots();
+
+  uint64_t pending = 0;
+  for (size_t i = 0; i < _M_nworkers; i++) {
+    for (size_t j = 0; j < nslots; j++) {
+      pending += _M_workers[i].metrics().upstreams[j].pending.get();
+    }
+  }
+
+  return pending;
+}
+
 void net::tcp::forwarder::stop()
 {
+  // Stop admin server (if running).
+  _M_admin.stop();
+
+  // Stop probing the upstream servers (if running).
+  _M_health.stop();
+
   // For each worker thread...
   for (size_t i = 0; i < _M_nworkers; i++) {
     // Stop.
     _M_workers[i].stop();
   }
+
+  _M_running = false;
 }
@@ -3,10 +3,21 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/epoll.h>
+#include <atomic>
+#include "net/tcp/configuration.h"
 #include "net/tcp/listeners.h"
 #include "net/tcp/connections.h"
+#include "net/tcp/multiplexer.h"
+#include "net/tcp/admin.h"
+#include "net/tcp/steering.h"
+#include "net/tcp/upstreams.h"
+#include "net/tcp/health.h"
 #include "net/socket/addresses.h"
+#include "string/budget.h"
+#include "io/uring.h"
+#include "os/cpus.h"
 
 namespace net {
   namespace tcp {
@@ -14,27 +25,39 @@ namespace net {
     class forwarder {
       public:
         // Maximum number of worker threads.
-        static constexpr const size_t max_workers = 32;
-
-        // Default number of worker threads.
-        static constexpr const size_t default_workers = 2;
+        static constexpr const size_t max_workers = CPU_SETSIZE;
 
         // Idle callback.
         typedef void (*idle_t)(size_t, void*);
 
-        // Constructor.
-        forwarder(size_t nworkers = default_workers);
+        // Constructor (if `nworkers` is 0, one worker thread per available
+        // CPU).
+        forwarder(size_t nworkers = 0);
 
         // Destructor.
         ~forwarder();
 
-        // Listen.
+        // Listen (it can also be called while the worker threads are running;
+        // if the forwarder is already listening on the address, it does
+        // nothing).
         bool listen(const char* address);
         bool listen(const char* address, in_port_t port);
         bool listen(const char* address, in_port_t minport, in_port_t maxport);
         bool listen(const struct sockaddr& addr, socklen_t addrlen);
         bool listen(const socket::address& addr);
 
+        // Stop listening on an address (it can be called while the worker
+        // threads are running; the sessions already established are not
+        // closed).
+        bool unlisten(const socket::address& addr);
+
+        // Get number of listening addresses.
+        size_t number_listeners() const;
+
+        // Get the socket address of a listener (nullptr if `idx` is out of
+        // range).
+        const socket::address* listener_address(size_t idx) const;
+
         // Add upstream server.
         bool add_upstream_server(const char* address);
         bool add_upstream_server(const char* address, in_port_t port);
@@ -43,12 +66,111 @@ namespace net {
 
         bool add_upstream_server(const socket::address& addr);
 
+        // Set the weight of an upstream server (round-robin and consistent
+        // hashing; 1 by default).
+        bool upstream_weight(size_t idx, unsigned weight);
+
+        // Set the routing policy of the listeners added from now on
+        // (broadcast by default).
+        void routing(routing_policy policy);
+
+        // Set the tuning profile of the listeners added from now on
+        // (including the listeners added while running).
+        void tuning(const tcp::tuning& tuning);
+
+        // Start a group with the upstream servers added from now on, where
+        // the sessions are routed with `policy` (the upstream servers added
+        // before the first group are routed with the routing policy of the
+        // listener).
+        bool upstream_group(routing_policy policy);
+
+        // Set the quorum of the last group (only broadcast groups): the
+        // sessions are closed when they are forwarded to less upstream servers
+        // of the group.
+        bool quorum(size_t quorum);
+
+        // Get the list of upstream servers (it has to be filled before
+        // calling start()).
+        tcp::upstreams& upstreams();
+
+        // Replace the list of upstream servers while the worker threads are
+        // running: the new sessions are routed with `upstreams` and the
+        // sessions already established keep their upstream servers (the
+        // forwarder takes ownership of the list if it returns true; not
+        // supported if the sessions are multiplexed).
+        bool reload(tcp::upstreams* upstreams);
+
+        // Get the number of slots of upstream servers (each upstream server
+        // has its own slot while a list of upstream servers which might still
+        // be in use refers to it; the free slots are reused).
+        size_t number_slots() const;
+
+        // Get the socket address of the upstream server of a slot (it can be
+        // called while the workers are running; returns false if the slot is
+        // free).
+        bool upstream_address(size_t slot, socket::address& address) const;
+
+        // Serve the metrics on the admin address.
+        bool listen_admin(const char* address);
+
+        // Run the worker threads only on the CPUs of the list (e.g. "0-3,8");
+        // each worker thread is pinned to a CPU of the list, unless another
+        // pinning has been configured.
+        bool cpu_affinity(const char* cpus);
+
+        // Get configuration (it has to be set before calling start()).
+        configuration& config();
+
         // Start.
         bool start(idle_t idle = nullptr, void* user = nullptr);
 
         // Stop.
         void stop();
 
+        // Hand the listening sockets over to a new process through the UNIX
+        // socket `sock` and, once the new process has acknowledged them, stop
+        // listening (the sessions already established are not closed).
+        bool handover(int sock);
+
+        // Receive the listening sockets of the old process through the UNIX
+        // socket `sock` (before listening): the addresses of the old process
+        // which are listened on again reuse its sockets. `nworkers` and
+        // `loop` are set to the number of workers and to the event loop of
+        // the old process, which have to be the same.
+        bool inherit(int sock, size_t& nworkers, event_loop& loop);
+
+        // Drain: stop listening, stop reading from the clients and close
+        // each session once the data received has been sent to its upstream
+        // servers (the worker threads keep running until stop() is called).
+        bool drain();
+
+        // Get the number of active sessions (it can be called while the
+        // workers are running).
+        uint64_t active_sessions() const;
+
+        // Get the number of bytes pending to be sent to the upstream servers
+        // (it can be called while the workers are running).
+        uint64_t pending() const;
+
+        // Get number of workers.
+        size_t number_workers() const;
+
+        // Get statistics of the pools of a worker (it should be called when
+        // the workers are not running).
+        bool stats(size_t nworker, connections::statistics& stats) const;
+
+        // Get metrics of a worker (they can be read while the workers are
+        // running).
+        const tcp::metrics* metrics(size_t nworker) const;
+
+        // Get the memory budget shared by the workers (it can be read while
+        // the workers are running).
+        const string::budget& budget() const;
+
+        // Get the health of the upstream servers (it can be read while the
+        // workers are running).
+        const tcp::health& health() const;
+
       private:
         // Worker thread.
         class worker {
@@ -59,28 +181,128 @@ namespace net {
             // Destructor.
             ~worker();
 
-            // Listen.
-            bool listen(const char* address);
-            bool listen(const char* address, in_port_t port);
-            bool listen(const char* address, in_port_t minport, in_port_t maxport);
-            bool listen(const struct sockaddr& addr, socklen_t addrlen);
-            bool listen(const socket::address& addr);
+            // Command sent to the worker thread while it is running.
+            struct command {
+              // Type of command.
+              enum class kind {
+                // Add listener.
+                add,
+
+                // Remove listener.
+                remove,
+
+                // Drain the sessions.
+                drain
+              };
+
+              kind type;
+
+              // Listening socket.
+              int fd;
+
+              // Routing policy of the listener (only when it is added).
+              routing_policy routing;
+            };
 
-            // Start.
+            // Add listening socket (before starting).
+            bool listen(int fd);
+
+            // Remove listening socket and close it (before starting).
+            bool unlisten(int fd);
+
+            // Start (if `cpus` is not nullptr, the thread runs only on those
+            // CPUs).
             bool start(size_t nworker,
-                       const socket::addresses* upstream_addresses,
+                       const configuration* config,
+                       const forwarder* forwarder,
+                       string::budget* budget,
+                       tcp::health* health,
+                       const cpu_set_t* cpus,
                        idle_t idle,
                        void* user);
 
             // Stop.
             void stop();
 
+            // Get statistics of the pools.
+            void stats(connections::statistics& stats) const;
+
+            // Get metrics.
+            const tcp::metrics& metrics() const;
+
+            // Post a command to the worker thread (returns false if its
+            // mailbox is full).
+            bool post(const command& cmd);
+
+            // Set where the worker has to publish its load (number of active
+            // sessions) for the steering of the new connections.
+            void load(uint64_t* load);
+
           private:
+            // Number of entries of the io_uring submission queue.
+            static constexpr const unsigned uring_entries = 4 * 1024;
+
+            // Number of entries of the io_uring completion queue (if it
+            // overflows, the kernel keeps the completions until there is room
+            // for them).
+            static constexpr const unsigned uring_cq_entries = 16 * 1024;
+
+            // Maximum number of events returned by epoll_wait().
+            static constexpr const int max_events = 1024;
+
+            // Number of chunks in the buffer registered with io_uring.
+            static constexpr const size_t uring_chunks = 128;
+
+            // Maximum number of entries of the io_uring file table.
+            static constexpr const unsigned uring_files = 32 * 1024;
+
+            // Milliseconds to wait before accepting again after an error
+            // (io_uring).
+            static constexpr const long uring_accept_retry = 100;
+
+            // Size of the mailbox of commands.
+            static constexpr const size_t max_commands = 64;
+
+            // File descriptors of the process which are not connections
+            // (standard streams, signalfd, admin server, upgrade socket...),
+            // set aside from the maximum number of open files.
+            static constexpr const size_t reserved_files = 64;
+
+            // File descriptors of each worker which are not connections
+            // (epoll or io_uring, /dev/null...).
+            static constexpr const size_t worker_files = 8;
+
+            // Maximum number of milliseconds to wait for events (the mailbox
+            // and the list of upstream servers are checked at least this
+            // often).
+            static constexpr const int max_wait = 250;
+
             // Worker number.
             size_t _M_nworker;
 
-            // Socket addresses of the upstream servers.
-            const socket::addresses* _M_upstream_addresses;
+            // Configuration.
+            const configuration* _M_config;
+
+            // Forwarder (where the list of upstream servers is published).
+            const forwarder* _M_forwarder;
+
+            // Epoch of the list of upstream servers used by the worker.
+            uint64_t _M_epoch = 0;
+
+            // Routing policies of the listeners (indexed by the file
+            // descriptor of the listener).
+            routing_policy* _M_routes = nullptr;
+            size_t _M_nroutes = 0;
+
+            // Position in the round-robin schedule of each group.
+            size_t _M_cursors[router::max_groups] = {0};
+
+            // Versions of the slots of upstream servers the counters and the
+            // spill queues of the worker belong to.
+            uint64_t _M_versions[metrics::max_upstreams] = {0};
+
+            // State of the random number generator.
+            uint64_t _M_random;
 
             // Epoll file descriptor.
             int _M_epollfd = -1;
@@ -91,9 +313,27 @@ namespace net {
             // Highest file descriptor of the listeners.
             uint64_t _M_maxlistener = 0;
 
+            // Listeners whose accept operation couldn't be queued because the
+            // submission queue was full (io_uring; room for all the listeners
+            // is reserved in advance).
+            int* _M_deferred = nullptr;
+            size_t _M_ndeferred = 0;
+            size_t _M_deferredsize = 0;
+
             // Connections.
             connections _M_connections;
 
+            // Multiplexer (only if the sessions are multiplexed).
+            multiplexer _M_multiplexer{_M_connections};
+
+            // io_uring instance (it has to be destroyed before the
+            // connections).
+            io::uring _M_ring;
+
+            // Where the load of the worker is published (shared with the
+            // kernel).
+            uint64_t* _M_load = nullptr;
+
             // Idle callback.
             idle_t _M_idle;
 
@@ -106,6 +346,12 @@ namespace net {
             // Running?
             bool _M_running = false;
 
+            // Mailbox of commands (single producer: the thread which controls
+            // the forwarder, single consumer: the worker thread).
+            command _M_commands[max_commands];
+            std::atomic<size_t> _M_head{0};
+            std::atomic<size_t> _M_tail{0};
+
             // Run.
             static void* run(void* arg);
             void run();
@@ -116,28 +362,389 @@ namespace net {
             // Accept connection(s).
             void accept(int listener);
 
+            // Publish the load of the worker.
+            void publish_load();
+
+            // Switch to the current list of upstream servers if it has been
+            // replaced.
+            void refresh();
+
+            // Set the positions of the worker in the round-robin schedules of
+            // the current list of upstream servers.
+            void seed_cursors();
+
+            // Process the commands of the mailbox.
+            void process_commands();
+
+            // Add listener while running.
+            void add_listener(int fd, routing_policy routing);
+
+            // Remove listener while running.
+            void remove_listener(int fd);
+
+            // Set the routing policy of a listener.
+            bool route(int listener, routing_policy routing);
+
             // Process connection.
             void process(uint32_t events, connection* conn);
 
+            // Choose the upstream servers of a new session (`fd` is the
+            // socket of the client, accepted by `listener`).
+            void route(int listener, int fd, upstream_set& upstreams);
+
+            // Add the upstream server `idx` of the group `group` to the set
+            // or, if it is known to be down, the next one of the group which
+            // is not (if all of them are down, none).
+            void route(size_t group,
+                       size_t idx,
+                       uint64_t now,
+                       upstream_set& upstreams);
+
+            // Add the upstream server of the group `group` the client address
+            // `addr` hashes to or, if it is known to be down, the upstream
+            // server of the next point of the hash ring which is not (if all
+            // of them are down, none).
+            void route(size_t group,
+                       const struct sockaddr& addr,
+                       uint64_t now,
+                       upstream_set& upstreams);
+
+            // Get random number (xorshift64*).
+            uint64_t random();
+
             // Connect to the upstream servers.
-            bool connect_upstream_servers(connection* conn);
+            bool connect_upstream_servers(connection* conn, int listener);
+
+            // Set up io_uring.
+            bool setup_uring();
+
+            // Run io_uring event loop.
+            void run_uring();
+
+            // Submit accept operation (io_uring).
+            bool submit_accept(int listener);
+
+            // Submit accept operation or, if the submission queue is full,
+            // defer it until the next submission (io_uring).
+            void accept_next(int listener);
+
+            // Submit the deferred accept operations (io_uring).
+            void submit_deferred();
+
+            // Make room for deferring the accept operations of all the
+            // listeners (io_uring).
+            bool reserve_deferred();
+
+            // Process completion (io_uring).
+            void complete(uint64_t user_data, int res);
+
+            // Process accepted connection (io_uring).
+            void accepted(int fd, int listener);
 
             // Disable copy constructor and assignment operator.
             worker(const worker&) = delete;
             worker& operator=(const worker&) = delete;
         };
 
-        // Socket addresses of the upstream servers.
-        socket::addresses _M_upstream_addresses;
+        // Configuration.
+        configuration _M_config;
+
+        // List of upstream servers given before starting (it is not freed
+        // when it is replaced).
+        tcp::upstreams _M_upstreams;
+
+        // Current list of upstream servers (read by the worker threads).
+        std::atomic<const tcp::upstreams*> _M_current{&_M_upstreams};
+
+        // Epoch of the current list of upstream servers (incremented after
+        // each list is published).
+        std::atomic<uint64_t> _M_epoch{0};
+
+        // Lists which have been replaced and might still be in use (the most
+        // recent first).
+        tcp::upstreams* _M_retired = nullptr;
+
+        // Slot of upstream server.
+        struct slot {
+          // Socket address of the upstream server.
+          socket::address address;
+
+          // Version: odd while the slot is free (the address is only replaced
+          // then) and incremented again when the slot is given to another
+          // upstream server.
+          std::atomic<uint64_t> version{0};
+        };
+
+        // Slots of upstream servers (a slot is freed once no list of upstream
+        // servers which might still be in use refers to it).
+        slot _M_slots[metrics::max_upstreams];
+        std::atomic<size_t> _M_nslots{0};
+
+        // Memory budget of the chunks of the worker threads.
+        string::budget _M_budget;
+
+        // Health of the upstream servers.
+        tcp::health _M_health;
+
+        // Routing policy of the listeners added from now on.
+        routing_policy _M_routing = routing_policy::broadcast;
+
+        // Tuning profile of the listeners added from now on.
+        tcp::tuning _M_tuning;
+
+        // Listening address (each worker thread has its own listening socket
+        // for each address; the sockets of the same address form a reuseport
+        // group).
+        struct listener {
+          // Socket address.
+          socket::address address;
+
+          // Routing policy.
+          routing_policy routing;
+
+          // Tuning profile.
+          tcp::tuning tuning;
+
+          // Listening sockets (one per worker thread; -1 if the worker thread
+          // doesn't have it).
+          int* fds;
+        };
+
+        // Listening addresses.
+        listener* _M_listeners = nullptr;
+        size_t _M_nlisteners = 0;
+        size_t _M_listeners_size = 0;
+
+        // Listening sockets received from the old process which haven't
+        // been listened on yet (they are closed when the forwarder starts).
+        listener* _M_inherited = nullptr;
+        size_t _M_ninherited = 0;
+
+        // Are the worker threads running?
+        bool _M_running = false;
+
+        // Pinning of the worker threads.
+        pinning _M_pin = pinning::none;
+
+        // CPUs the process can run on.
+        os::cpus _M_cpus;
+
+        // Has the CPU affinity been set?
+        bool _M_affinity = false;
 
         // Worker threads.
-        worker _M_workers[max_workers];
+        worker* _M_workers = nullptr;
         size_t _M_nworkers = 0;
 
+        // Admin server.
+        admin _M_admin;
+
+        // Steering of the new connections.
+        steering _M_steering;
+
+        // Get the CPUs where a worker thread has to run (returns false if the
+        // worker thread is not pinned).
+        bool worker_cpus(size_t nworker, pinning pin, cpu_set_t& set) const;
+
+        // Attach the steering programs to the reuseport groups of listeners.
+        bool steer();
+
+        // Attach the steering program to a reuseport group of listeners.
+        bool steer(const int* fds);
+
+        // Apply the tuning profile and enable TCP Fast Open and
+        // TCP_DEFER_ACCEPT (if they have to be enabled) on the listening
+        // sockets of a listener.
+        bool tune(const int* fds, const tcp::tuning& tuning) const;
+
+        // Take the listening sockets of an address from the sockets received
+        // from the old process (returns false if they were not received).
+        bool adopt(const socket::address& addr, int* fds);
+
+        // Close the listening sockets received from the old process which
+        // haven't been listened on.
+        void close_inherited();
+
+        // Remove listener.
+        bool remove_listener(size_t idx);
+
+        // Post a command to a worker thread (waiting if its mailbox is full).
+        bool post(size_t nworker, const worker::command& cmd);
+
+        // Assign a slot to each upstream server of the list (the upstream
+        // servers which are already known keep their slot).
+        bool assign_slots(tcp::upstreams& upstreams);
+
+        // Free the replaced lists which are not in use anymore and the slots
+        // of upstream servers which no remaining list refers to.
+        void reclaim();
+
+        // Get the epoch of the current list of upstream servers.
+        uint64_t epoch() const;
+
+        // Get the current list of upstream servers.
+        const tcp::upstreams* current() const;
+
         // Disable copy constructor and assignment operator.
         forwarder(const forwarder&) = delete;
         forwarder& operator=(const forwarder&) = delete;
     };
+
+    inline size_t forwarder::number_listeners() const
+    {
+      return _M_nlisteners;
+    }
+
+    inline const socket::address* forwarder::listener_address(size_t idx) const
+    {
+      return (idx < _M_nlisteners) ? &_M_listeners[idx].address : nullptr;
+    }
+
+    inline tcp::upstreams& forwarder::upstreams()
+    {
+      return _M_upstreams;
+    }
+
+    inline size_t forwarder::number_slots() const
+    {
+      return _M_nslots.load(std::memory_order_acquire);
+    }
+
+    inline bool forwarder::upstream_address(size_t slot,
+                                            socket::address& address) const
+    {
+      // If the slot hasn't been assigned yet...
+      if (slot >= number_slots()) {
+        return false;
+      }
+
+      const uint64_t version =
+        _M_slots[slot].version.load(std::memory_order_acquire);
+
+      // If the slot is free...
+      if ((version & 1) != 0) {
+        return false;
+      }
+
+      address = _M_slots[slot].address;
+
+      // The address is valid if the slot hasn't been freed while it was being
+      // copied.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return (_M_slots[slot].version.load(std::memory_order_relaxed) ==
+              version);
+    }
+
+    inline bool forwarder::upstream_weight(size_t idx, unsigned weight)
+    {
+      return _M_upstreams.router().weight(idx, weight);
+    }
+
+    inline void forwarder::routing(routing_policy policy)
+    {
+      _M_routing = policy;
+    }
+
+    inline void forwarder::tuning(const tcp::tuning& tuning)
+    {
+      _M_tuning = tuning;
+    }
+
+    inline bool forwarder::upstream_group(routing_policy policy)
+    {
+      return _M_upstreams.group(policy);
+    }
+
+    inline bool forwarder::quorum(size_t quorum)
+    {
+      return _M_upstreams.quorum(quorum);
+    }
+
+    inline bool forwarder::listen_admin(const char* address)
+    {
+      return _M_admin.listen(address);
+    }
+
+    inline configuration& forwarder::config()
+    {
+      return _M_config;
+    }
+
+    inline size_t forwarder::number_workers() const
+    {
+      return _M_nworkers;
+    }
+
+    inline bool forwarder::stats(size_t nworker,
+                                 connections::statistics& stats) const
+    {
+      if (nworker < _M_nworkers) {
+        _M_workers[nworker].stats(stats);
+        return true;
+      }
+
+      return false;
+    }
+
+    inline const tcp::metrics* forwarder::metrics(size_t nworker) const
+    {
+      return (nworker < _M_nworkers) ? &_M_workers[nworker].metrics() :
+                                       nullptr;
+    }
+
+    inline const string::budget& forwarder::budget() const
+    {
+      return _M_budget;
+    }
+
+    inline const tcp::health& forwarder::health() const
+    {
+      return _M_health;
+    }
+
+    inline uint64_t forwarder::epoch() const
+    {
+      return _M_epoch.load(std::memory_order_acquire);
+    }
+
+    inline const tcp::upstreams* forwarder::current() const
+    {
+      return _M_current.load(std::memory_order_acquire);
+    }
+
+    inline void forwarder::worker::stats(connections::statistics& stats) const
+    {
+      _M_connections.stats(stats);
+    }
+
+    inline const tcp::metrics& forwarder::worker::metrics() const
+    {
+      return _M_connections.metrics();
+    }
+
+    inline bool forwarder::worker::listen(int fd)
+    {
+      return _M_listeners.add(fd);
+    }
+
+    inline bool forwarder::worker::unlisten(int fd)
+    {
+      return _M_listeners.remove(fd);
+    }
+
+    inline void forwarder::worker::load(uint64_t* load)
+    {
+      _M_load = load;
+    }
+
+    inline void forwarder::worker::publish_load()
+    {
+      if (_M_load) {
+        __atomic_store_n(_M_load,
+                         _M_connections.metrics().active.get(),
+                         __ATOMIC_RELAXED);
+      }
+    }
   }
 }
 
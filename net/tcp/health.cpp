@@ -0,0 +1,282 @@
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "net/tcp/health.h"
+#include "net/tcp/forwarder.h"
+
+net::tcp::health::~health()
+{
+  // Stop thread (if running).
+  stop();
+}
+
+bool net::tcp::health::available(size_t slot, uint64_t now)
+{
+  // If the breaker never opens...
+  if (_M_threshold == 0) {
+    return true;
+  }
+
+  state& st = _M_states[slot];
+
+  uint64_t until = st.open_until.load(std::memory_order_relaxed);
+
+  // If the breaker is closed...
+  if (until == 0) {
+    return true;
+  }
+
+  // If the breaker is open...
+  if (until > now) {
+    return false;
+  }
+
+  // The breaker has expired: let only this session through and keep the
+  // breaker open meanwhile (longer, in case the connection fails).
+  const unsigned backoff = st.backoff.load(std::memory_order_relaxed) + 1;
+
+  if (st.open_until.compare_exchange_strong(until,
+                                            now + duration(backoff),
+                                            std::memory_order_relaxed)) {
+    st.backoff.store(backoff, std::memory_order_relaxed);
+    return true;
+  }
+
+  return false;
+}
+
+void net::tcp::health::success(size_t slot)
+{
+  state& st = _M_states[slot];
+
+  // Don't touch the cache line of the slot if the breaker is already closed.
+  if (st.failures.load(std::memory_order_relaxed) != 0) {
+    st.failures.store(0, std::memory_order_relaxed);
+  }
+
+  // If the breaker is open...
+  if (st.open_until.load(std::memory_order_relaxed) != 0) {
+    // Close the breaker.
+    st.open_until.store(0, std::memory_order_relaxed);
+    st.backoff.store(0, std::memory_order_relaxed);
+  }
+}
+
+void net::tcp::health::failure(size_t slot, uint64_t now)
+{
+  // If the breaker never opens...
+  if (_M_threshold == 0) {
+    return;
+  }
+
+  state& st = _M_states[slot];
+
+  // If the threshold hasn't been reached yet...
+  if (st.failures.fetch_add(1, std::memory_order_relaxed) + 1 < _M_threshold) {
+    return;
+  }
+
+  uint64_t until = st.open_until.load(std::memory_order_relaxed);
+
+  // If the breaker is already open (e.g. the failed connection is the one let
+  // through when the breaker expired)...
+  if (until > now) {
+    return;
+  }
+
+  // If the breaker is closed, it opens for `min_backoff` milliseconds,
+  // otherwise (it has expired without letting any session through) for
+  // twice as long as the last time.
+  const unsigned backoff = (until == 0) ?
+                             0 :
+                             st.backoff.load(std::memory_order_relaxed) + 1;
+
+  if (st.open_until.compare_exchange_strong(until,
+                                            now + duration(backoff),
+                                            std::memory_order_relaxed)) {
+    st.backoff.store(backoff, std::memory_order_relaxed);
+
+    // If the breaker was closed...
+    if (until == 0) {
+      st.trips.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+void net::tcp::health::reset(size_t slot)
+{
+  state& st = _M_states[slot];
+
+  st.failures.store(0, std::memory_order_relaxed);
+  st.open_until.store(0, std::memory_order_relaxed);
+  st.backoff.store(0, std::memory_order_relaxed);
+  st.trips.store(0, std::memory_order_relaxed);
+}
+
+bool net::tcp::health::start(const forwarder* forwarder, uint64_t interval)
+{
+  // Save forwarder and interval.
+  _M_forwarder = forwarder;
+  _M_interval = interval;
+
+  // Start thread.
+  _M_running = true;
+
+  if (pthread_create(&_M_thread, nullptr, run, this) == 0) {
+    return true;
+  }
+
+  _M_running = false;
+
+  return false;
+}
+
+void net::tcp::health::stop()
+{
+  // If the thread is running...
+  if (_M_running) {
+    _M_running = false;
+    pthread_join(_M_thread, nullptr);
+  }
+}
+
+void* net::tcp::health::run(void* arg)
+{
+  static_cast<health*>(arg)->run();
+  return nullptr;
+}
+
+void net::tcp::health::run()
+{
+  do {
+    // Probe the upstream servers (including the upstream servers which have
+    // been removed from the list).
+    probe(_M_forwarder->number_slots());
+
+    // Wait for the next round.
+    const uint64_t start = connections::now();
+    uint64_t elapsed;
+
+    while ((_M_running) &&
+           ((elapsed = connections::now() - start) < _M_interval)) {
+      poll(nullptr,
+           0,
+           (_M_interval - elapsed < static_cast<uint64_t>(timeout)) ?
+             static_cast<int>(_M_interval - elapsed) :
+             timeout);
+    }
+  } while (_M_running);
+}
+
+void net::tcp::health::probe(size_t nslots)
+{
+  struct pollfd fds[metrics::max_upstreams];
+  size_t slots[metrics::max_upstreams];
+  socket::address addresses[metrics::max_upstreams];
+  size_t nfds = 0;
+
+  // For each slot...
+  for (size_t i = 0; i < nslots; i++) {
+    // If the slot is free...
+    socket::address address;
+    if (!_M_forwarder->upstream_address(i, address)) {
+      continue;
+    }
+
+    const struct sockaddr& addr = static_cast<const struct sockaddr&>(address);
+
+    // Create socket.
+    const int fd = ::socket(addr.sa_family,
+                            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            0);
+
+    // If the socket could not be created (it is not a failure of the
+    // upstream server)...
+    if (fd == -1) {
+      continue;
+    }
+
+    // Connect to the upstream server.
+    if (connect(fd, &addr, address.length()) == 0) {
+      report(i, address, true);
+    } else if ((errno == EINPROGRESS) || (errno == EINTR)) {
+      // Wait for the connection to be established.
+      fds[nfds].fd = fd;
+      fds[nfds].events = POLLOUT;
+      fds[nfds].revents = 0;
+
+      slots[nfds] = i;
+      addresses[nfds++] = address;
+
+      continue;
+    } else {
+      report(i, address, false);
+    }
+
+    // Close socket.
+    close(fd);
+  }
+
+  const uint64_t start = connections::now();
+  size_t pending = nfds;
+
+  // While there are connections in progress and the timeout hasn't
+  // expired...
+  uint64_t elapsed;
+  while ((pending > 0) &&
+         ((elapsed = connections::now() - start) <
+          static_cast<uint64_t>(probe_timeout))) {
+    if (poll(fds, nfds, probe_timeout - static_cast<int>(elapsed)) > 0) {
+      // For each connection in progress...
+      for (size_t i = 0; i < nfds; i++) {
+        // If the connection has finished...
+        if ((fds[i].fd != -1) && (fds[i].revents != 0)) {
+          // Get socket error.
+          int error;
+          socklen_t optlen = sizeof(int);
+          if ((getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &optlen) ==
+               0) &&
+              (error == 0)) {
+            report(slots[i], addresses[i], true);
+          } else {
+            report(slots[i], addresses[i], false);
+          }
+
+          // Close socket (poll() ignores the negative file descriptors).
+          close(fds[i].fd);
+          fds[i].fd = -1;
+
+          pending--;
+        }
+      }
+    }
+  }
+
+  // The connections which are still in progress have failed.
+  for (size_t i = 0; i < nfds; i++) {
+    if (fds[i].fd != -1) {
+      report(slots[i], addresses[i], false);
+      close(fds[i].fd);
+    }
+  }
+}
+
+void net::tcp::health::report(size_t slot,
+                              const socket::address& address,
+                              bool connected)
+{
+  // If the slot has been freed (or given to another upstream server) while
+  // the upstream server was being probed...
+  socket::address current;
+  if ((!_M_forwarder->upstream_address(slot, current)) ||
+      (!(current == address))) {
+    return;
+  }
+
+  if (connected) {
+    success(slot);
+  } else {
+    failure(slot, connections::now());
+  }
+}
@@ -0,0 +1,166 @@
+#ifndef NET_TCP_HEALTH_H
+#define NET_TCP_HEALTH_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "net/tcp/metrics.h"
+#include "net/socket/address.h"
+
+namespace net {
+  namespace tcp {
+    // Forward declaration.
+    class forwarder;
+
+    // Health of the upstream servers (one circuit breaker per slot of
+    // upstream server, shared by all the worker threads).
+    // The breaker of an upstream server opens after `threshold` consecutive
+    // failed connections (reported by the worker threads and by the active
+    // probes) and the new sessions skip the upstream server while it is open.
+    // When it expires, the breaker lets a single session through (half-open):
+    // if the connection succeeds the breaker closes, otherwise it stays open
+    // twice as long (up to `max_backoff`).
+    class health {
+      public:
+        // Milliseconds the breaker stays open the first time.
+        static constexpr const uint64_t min_backoff = 1000;
+
+        // Maximum number of milliseconds the breaker stays open.
+        static constexpr const uint64_t max_backoff = 60 * 1000;
+
+        // Milliseconds to wait for the connection of an active probe.
+        static constexpr const int probe_timeout = 2000;
+
+        // Constructor.
+        health() = default;
+
+        // Destructor.
+        ~health();
+
+        // Set the number of consecutive failed connections which open the
+        // breaker (0: the breaker never opens).
+        void threshold(size_t threshold);
+
+        // Get the threshold.
+        size_t threshold() const;
+
+        // Can a new session be routed to the upstream server of the slot? If
+        // the breaker has just expired, only the first caller gets true.
+        bool available(size_t slot, uint64_t now);
+
+        // Is the breaker of the slot open?
+        bool open(size_t slot, uint64_t now) const;
+
+        // Get the number of times the breaker of the slot has opened.
+        uint64_t trips(size_t slot) const;
+
+        // Report a successful connection.
+        void success(size_t slot);
+
+        // Report a failed connection.
+        void failure(size_t slot, uint64_t now);
+
+        // Close the breaker of a slot and forget its history (the slot has
+        // been freed).
+        void reset(size_t slot);
+
+        // Start probing the upstream servers of the forwarder every
+        // `interval` milliseconds from its own thread.
+        bool start(const forwarder* forwarder, uint64_t interval);
+
+        // Stop.
+        void stop();
+
+      private:
+        // Milliseconds to sleep before checking whether the probes have been
+        // stopped.
+        static constexpr const int timeout = 250;
+
+        // State of the breaker of a slot.
+        struct alignas(64) state {
+          // Consecutive failed connections.
+          std::atomic<size_t> failures{0};
+
+          // Monotonic time (milliseconds) until the breaker is open (0: the
+          // breaker is closed).
+          std::atomic<uint64_t> open_until{0};
+
+          // Times the breaker has opened since it was closed (exponent of the
+          // backoff).
+          std::atomic<unsigned> backoff{0};
+
+          // Times the breaker has opened.
+          std::atomic<uint64_t> trips{0};
+        };
+
+        // Breakers.
+        state _M_states[metrics::max_upstreams];
+
+        // Threshold.
+        size_t _M_threshold = 0;
+
+        // Forwarder.
+        const forwarder* _M_forwarder;
+
+        // Milliseconds between probes.
+        uint64_t _M_interval;
+
+        // Thread id.
+        pthread_t _M_thread;
+
+        // Running?
+        bool _M_running = false;
+
+        // Get the number of milliseconds the breaker stays open.
+        static uint64_t duration(unsigned backoff);
+
+        // Run.
+        static void* run(void* arg);
+        void run();
+
+        // Probe the upstream servers of the slots [0, nslots).
+        void probe(size_t nslots);
+
+        // Report the result of the probe of the upstream server `address`
+        // (unless its slot has been freed meanwhile).
+        void report(size_t slot,
+                    const socket::address& address,
+                    bool connected);
+
+        // Disable copy constructor and assignment operator.
+        health(const health&) = delete;
+        health& operator=(const health&) = delete;
+    };
+
+    inline void health::threshold(size_t threshold)
+    {
+      _M_threshold = threshold;
+    }
+
+    inline size_t health::threshold() const
+    {
+      return _M_threshold;
+    }
+
+    inline bool health::open(size_t slot, uint64_t now) const
+    {
+      return (_M_states[slot].open_until.load(std::memory_order_relaxed) >
+              now);
+    }
+
+    inline uint64_t health::trips(size_t slot) const
+    {
+      return _M_states[slot].trips.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t health::duration(unsigned backoff)
+    {
+      // Double the duration each time, up to `max_backoff`.
+      return ((backoff < 16) && ((min_backoff << backoff) < max_backoff)) ?
+               min_backoff << backoff :
+               max_backoff;
+    }
+  }
+}
+
+#endif // NET_TCP_HEALTH_H
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <unistd.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include "net/tcp/listeners.h"
 
@@ -87,36 +88,125 @@ bool net::tcp::listeners::listen(const struct sockaddr& addr, socklen_t addrlen)
 {
   if (allocate()) {
     // Create socket.
-    const int fd = ::socket(addr.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    const int fd = open(addr, addrlen);
 
     // If the socket could be created...
     if (fd != -1) {
-      // Reuse address and port, bind and listen.
-      const int optval = 1;
-      if ((setsockopt(fd,
-                      SOL_SOCKET,
-                      SO_REUSEADDR,
-                      &optval,
-                      sizeof(int)) == 0) &&
-          (setsockopt(fd,
-                      SOL_SOCKET,
-                      SO_REUSEPORT,
-                      &optval,
-                      sizeof(int)) == 0) &&
-          (bind(fd, &addr, addrlen) == 0) &&
-          (::listen(fd, SOMAXCONN) == 0)) {
-        _M_fds[_M_used++] = fd;
+      _M_fds[_M_used++] = fd;
+      return true;
+    }
+  }
 
-        return true;
-      }
+  return false;
+}
+
+int net::tcp::listeners::open(const struct sockaddr& addr, socklen_t addrlen)
+{
+  // Create socket.
+  const int fd = ::socket(addr.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+  // If the socket could be created...
+  if (fd != -1) {
+    // Reuse address and port, bind and listen.
+    const int optval = 1;
+    if ((setsockopt(fd,
+                    SOL_SOCKET,
+                    SO_REUSEADDR,
+                    &optval,
+                    sizeof(int)) == 0) &&
+        (setsockopt(fd,
+                    SOL_SOCKET,
+                    SO_REUSEPORT,
+                    &optval,
+                    sizeof(int)) == 0) &&
+        (bind(fd, &addr, addrlen) == 0) &&
+        (::listen(fd, SOMAXCONN) == 0)) {
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+bool net::tcp::listeners::fastopen(int fd, int qlen)
+{
+  return (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(int)) == 0);
+}
+
+bool net::tcp::listeners::defer_accept(int fd, int seconds)
+{
+  return (setsockopt(fd,
+                     IPPROTO_TCP,
+                     TCP_DEFER_ACCEPT,
+                     &seconds,
+                     sizeof(int)) == 0);
+}
+
+bool net::tcp::listeners::add(int fd)
+{
+  if (allocate()) {
+    // If the connections have to be steered to a CPU, it is not an error if
+    // it cannot be set.
+    if (_M_cpu != -1) {
+      setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &_M_cpu, sizeof(int));
+    }
+
+    _M_fds[_M_used++] = fd;
 
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::listeners::remove(int fd)
+{
+  // Search the listener.
+  for (size_t i = 0; i < _M_used; i++) {
+    if (_M_fds[i] == fd) {
       close(fd);
+
+      // Move the last listener to its position.
+      _M_fds[i] = _M_fds[--_M_used];
+
+      return true;
     }
   }
 
   return false;
 }
 
+bool net::tcp::listeners::contains(int fd) const
+{
+  for (size_t i = 0; i < _M_used; i++) {
+    if (_M_fds[i] == fd) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool net::tcp::listeners::incoming_cpu(int cpu)
+{
+  _M_cpu = cpu;
+
+  // For each listener...
+  for (size_t i = 0; i < _M_used; i++) {
+    if (setsockopt(_M_fds[i],
+                   SOL_SOCKET,
+                   SO_INCOMING_CPU,
+                   &cpu,
+                   sizeof(int)) < 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool net::tcp::listeners::allocate()
 {
   if (_M_used < _M_size) {
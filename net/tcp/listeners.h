@@ -21,6 +21,33 @@ namespace net {
         bool listen(const struct sockaddr& addr, socklen_t addrlen);
         bool listen(const socket::address& addr);
 
+        // Create a listening socket (SO_REUSEPORT, non-blocking; returns -1 on
+        // error).
+        static int open(const struct sockaddr& addr, socklen_t addrlen);
+
+        // Enable TCP Fast Open on a listening socket (`qlen`: maximum number
+        // of pending requests).
+        static bool fastopen(int fd, int qlen);
+
+        // Accept the connections only once their first data has arrived (or
+        // after `seconds`).
+        static bool defer_accept(int fd, int seconds);
+
+        // Add a listening socket which has already been created.
+        bool add(int fd);
+
+        // Remove a listening socket and close it (the order of the rest of
+        // listeners might change).
+        bool remove(int fd);
+
+        // Is the socket one of the listeners?
+        bool contains(int fd) const;
+
+        // Ask the kernel to steer the connections received on the CPU `cpu`
+        // to these listeners (SO_INCOMING_CPU; also the listeners added
+        // later).
+        bool incoming_cpu(int cpu);
+
         // Get fd.
         int fd(size_t idx) const;
 
@@ -36,6 +63,9 @@ namespace net {
         size_t _M_size = 0;
         size_t _M_used = 0;
 
+        // CPU of the incoming connections (-1: any).
+        int _M_cpu = -1;
+
         // Allocate.
         bool allocate();
 
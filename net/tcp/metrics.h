@@ -0,0 +1,158 @@
+#ifndef NET_TCP_METRICS_H
+#define NET_TCP_METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+
+namespace net {
+  namespace tcp {
+    // Metrics of a worker.
+    // The counters are only modified by the worker thread and read by the
+    // admin thread, so they are updated with relaxed loads and stores (no
+    // locked instructions). The counters of the worker and the counters of
+    // each upstream server are in their own cache lines.
+    class alignas(64) metrics {
+      public:
+        // Maximum number of upstream servers.
+        static constexpr const size_t max_upstreams = 128;
+
+        // Counter.
+        class counter {
+          public:
+            // Constructor.
+            counter() = default;
+
+            // Add.
+            void add(uint64_t n = 1);
+
+            // Subtract.
+            void sub(uint64_t n = 1);
+
+            // Set value.
+            void set(uint64_t n);
+
+            // Get value.
+            uint64_t get() const;
+
+          private:
+            std::atomic<uint64_t> _M_value{0};
+
+            // Disable copy constructor and assignment operator.
+            counter(const counter&) = delete;
+            counter& operator=(const counter&) = delete;
+        };
+
+        // Counters of an upstream server.
+        struct alignas(64) upstream {
+          // Successful connections.
+          counter connects;
+
+          // Failed connections.
+          counter failures;
+
+          // Bytes sent.
+          counter sent;
+
+          // Connections dropped because their buffer was full.
+          counter drops;
+
+          // Sends which returned EAGAIN.
+          counter eagain;
+
+          // Bytes pending to be sent (gauge).
+          counter pending;
+
+          // Bytes spilled to disk.
+          counter spilled;
+
+          // Reset the counters (the slot of the upstream server has been
+          // freed).
+          void reset();
+        };
+
+        // Constructor.
+        metrics() = default;
+
+        // Destructor.
+        ~metrics() = default;
+
+        // Accepted connections.
+        counter accepted;
+
+        // Accepted connections which were closed because the limits of the
+        // pool of connections had been reached.
+        counter rejected;
+
+        // Active sessions (server connections).
+        counter active;
+
+        // Sessions closed because they were not forwarded to the quorum of a
+        // group of upstream servers anymore.
+        counter aborted;
+
+        // Bytes received from the clients.
+        counter received;
+
+        // Times the sessions stopped reading from the clients because an
+        // upstream server couldn't keep up.
+        counter pauses;
+
+        // Connections closed because their connect, idle or write timeout
+        // expired.
+        counter timeouts;
+
+        // Upstream connections opened to replace a failed one (the session
+        // is replayed from its start).
+        counter reconnects;
+
+        // Epoch of the list of upstream servers used by the worker (gauge).
+        counter epoch;
+
+        // Counters of the upstream servers (indexed by the slot of the
+        // upstream server).
+        upstream upstreams[max_upstreams];
+
+      private:
+        // Disable copy constructor and assignment operator.
+        metrics(const metrics&) = delete;
+        metrics& operator=(const metrics&) = delete;
+    };
+
+    inline void metrics::counter::add(uint64_t n)
+    {
+      // Only the worker thread modifies the counter.
+      _M_value.store(_M_value.load(std::memory_order_relaxed) + n,
+                     std::memory_order_relaxed);
+    }
+
+    inline void metrics::counter::sub(uint64_t n)
+    {
+      // Only the worker thread modifies the counter.
+      _M_value.store(_M_value.load(std::memory_order_relaxed) - n,
+                     std::memory_order_relaxed);
+    }
+
+    inline void metrics::counter::set(uint64_t n)
+    {
+      _M_value.store(n, std::memory_order_relaxed);
+    }
+
+    inline uint64_t metrics::counter::get() const
+    {
+      return _M_value.load(std::memory_order_relaxed);
+    }
+
+    inline void metrics::upstream::reset()
+    {
+      connects.set(0);
+      failures.set(0);
+      sent.set(0);
+      drops.set(0);
+      eagain.set(0);
+      pending.set(0);
+      spilled.set(0);
+    }
+  }
+}
+
+#endif // NET_TCP_METRICS_H
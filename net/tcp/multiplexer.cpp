@@ -0,0 +1,593 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include "net/tcp/multiplexer.h"
+#include "net/tcp/connection.h"
+#include "net/tcp/connections.h"
+#include "net/tcp/upstreams.h"
+#include "net/tcp/health.h"
+
+net::tcp::multiplexer::~multiplexer()
+{
+  if (_M_channels) {
+    free(_M_channels);
+  }
+}
+
+bool net::tcp::multiplexer::init(int epollfd,
+                                 const tcp::upstreams* upstreams,
+                                 const configuration* config)
+{
+  const size_t nupstreams = upstreams->addresses().count();
+  const size_t nchannels = config->multiplex;
+
+  // Allocate channels (none of them is connected yet).
+  _M_channels = static_cast<connection**>(
+                  calloc(nupstreams * nchannels, sizeof(connection*))
+                );
+
+  if (_M_channels) {
+    _M_epollfd = epollfd;
+    _M_upstreams = upstreams;
+    _M_config = config;
+    _M_nupstreams = nupstreams;
+    _M_nchannels = nchannels;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::multiplexer::open(connection* server,
+                                 const upstream_set& upstreams)
+{
+  // Assign session id.
+  server->_M_multiplexed = true;
+  server->_M_session = _M_next_session++;
+
+  // The session is forwarded to all the upstream servers.
+  server->_M_nupstreams = _M_nupstreams;
+
+  memset(server->_M_detached, 0, sizeof(server->_M_detached));
+
+  // No data of the current record yet.
+  server->_M_prefix = 0;
+  server->_M_record = 0;
+
+  // For each upstream server...
+  for (size_t i = 0; i < _M_nupstreams; i++) {
+    // If the session is not routed to this upstream server...
+    if (!upstreams.contains(i)) {
+      unroute(server, i);
+      continue;
+    }
+
+    connection** const slot = &_M_channels[(i * _M_nchannels) +
+                                           (server->_M_session %
+                                            _M_nchannels)];
+
+    // If the channel is not connected, connect it.
+    if ((!*slot) && ((*slot = connect(i, server->_M_session)) == nullptr)) {
+      unroute(server, i);
+      continue;
+    }
+
+    // Send open frame (the data is not framed in aggregation mode).
+    if ((!_M_config->aggregate) &&
+        (!write(*slot, server->_M_session, frame_open, nullptr, nullptr, 0))) {
+      remove(*slot);
+      unroute(server, i);
+    }
+  }
+
+  // If no upstream server could be opened...
+  if (server->_M_nupstreams == 0) {
+    return false;
+  }
+
+  // For each group of upstream servers...
+  const router& r = _M_connections.upstreams()->router();
+  for (size_t i = 0; i < r.number_groups(); i++) {
+    // If the group is below its quorum...
+    if (!quorum(server, i)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool net::tcp::multiplexer::forward(connection* server,
+                                    string::chunk* chunk,
+                                    const void* buf,
+                                    size_t len)
+{
+  // Aggregation mode?
+  if (_M_config->aggregate) {
+    return aggregate(server, chunk, static_cast<const uint8_t*>(buf), len);
+  }
+
+  // For each upstream server...
+  for (size_t i = 0; i < _M_nupstreams; i++) {
+    connection* const ch = channel(server, i);
+
+    // If the session doesn't use the upstream server...
+    if (!ch) {
+      // If the session was still using the upstream server (its channel has
+      // been closed)...
+      if ((server->_M_detached[i / 64] & (1ull << (i % 64))) == 0) {
+        if (!detach(server, i)) {
+          return false;
+        }
+      }
+
+      continue;
+    }
+
+    // If the data cannot be queued...
+    if (ch->_M_queue.length() + header_size + len > buffer_limit()) {
+      ch->upstream_metrics().drops.add();
+
+      // Close the session on this upstream server (the open and close
+      // frames are always queued).
+      if (!write(ch, server->_M_session, frame_close, nullptr, nullptr, 0)) {
+        remove(ch);
+      }
+
+      if (!detach(server, i)) {
+        return false;
+      }
+
+      continue;
+    }
+
+    // Send data frame (the data of a read always fits in a frame).
+    if (!write(ch, server->_M_session, frame_data, chunk, buf, len)) {
+      remove(ch);
+
+      if (!detach(server, i)) {
+        return false;
+      }
+    }
+  }
+
+  return (server->_M_nupstreams > 0);
+}
+
+void net::tcp::multiplexer::close(connection* server)
+{
+  // For each upstream server (no close frames in aggregation mode)...
+  for (size_t i = 0; (!_M_config->aggregate) && (i < _M_nupstreams); i++) {
+    connection* const ch = channel(server, i);
+
+    // If the session uses the upstream server...
+    if (ch) {
+      // Send close frame.
+      if (!write(ch, server->_M_session, frame_close, nullptr, nullptr, 0)) {
+        remove(ch);
+      }
+    }
+  }
+
+  server->_M_multiplexed = false;
+}
+
+bool net::tcp::multiplexer::pending(const connection* server) const
+{
+  // For each upstream server...
+  for (size_t i = 0; i < _M_nupstreams; i++) {
+    const connection* const ch = channel(server, i);
+
+    // If the session uses the upstream server and its channel has data
+    // pending to be sent...
+    if ((ch) && (!ch->_M_queue.empty())) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void net::tcp::multiplexer::remove(connection* channel)
+{
+  // The channel was connected for the session `_M_first_session`.
+  connection** const slot = &_M_channels[(channel->_M_upstream *
+                                          _M_nchannels) +
+                                         (channel->_M_first_session %
+                                          _M_nchannels)];
+
+  // If the channel is still in use...
+  if (*slot == channel) {
+    *slot = nullptr;
+
+    // Close connection and return it to the pool.
+    channel->release();
+  }
+}
+
+void net::tcp::multiplexer::flush()
+{
+  // For each channel...
+  for (size_t i = 0; i < _M_nupstreams * _M_nchannels; i++) {
+    connection* const ch = _M_channels[i];
+
+    // If there is data to send and the channel is writable...
+    if ((ch) && (ch->_M_writable) && (!ch->_M_queue.empty())) {
+      // Send as much data as possible.
+      if (!ch->write()) {
+        remove(ch);
+      }
+    }
+  }
+}
+
+net::tcp::connection*
+net::tcp::multiplexer::channel(const connection* server, size_t upstream) const
+{
+  // If the session is not forwarded to the upstream server anymore...
+  if (server->_M_detached[upstream / 64] & (1ull << (upstream % 64))) {
+    return nullptr;
+  }
+
+  connection* const ch = _M_channels[(upstream * _M_nchannels) +
+                                     (server->_M_session % _M_nchannels)];
+
+  // If the channel is not connected or it has been connected after the
+  // session was opened (the upstream server doesn't know the session)...
+  if ((!ch) ||
+      (static_cast<int32_t>(server->_M_session - ch->_M_first_session) < 0)) {
+    return nullptr;
+  }
+
+  return ch;
+}
+
+net::tcp::connection* net::tcp::multiplexer::connect(size_t upstream,
+                                                     uint32_t session)
+{
+  const socket::address* const address =
+    _M_upstreams->addresses().address(upstream);
+
+  const tcp::tuning& tuning = _M_upstreams->tuning(upstream);
+
+  const struct sockaddr& addr = static_cast<const struct sockaddr&>(*address);
+
+  metrics::upstream& metrics = _M_connections.metrics().upstreams[upstream];
+
+  // Create socket.
+  const int fd = ::socket(addr.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+  // If the socket could be created...
+  if (fd != -1) {
+    // If the socket could be tuned...
+    if (tuning.apply(fd)) {
+      // Connect to the upstream server.
+      do {
+        if ((::connect(fd, &addr, address->length()) == 0) ||
+            (errno == EINPROGRESS)) {
+          // Get new connection.
+          connection* const ch = _M_connections.pop();
+
+          if (ch) {
+            struct epoll_event ev;
+            ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = ch;
+
+            // Add connection to the epoll file descriptor.
+            if (epoll_ctl(_M_epollfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+              // Initialize channel.
+              ch->init(fd);
+              ch->upstream(upstream);
+
+              ch->_M_channel = true;
+
+              ch->_M_corked = tuning.cork;
+
+              // Only the sessions opened from now on use the channel.
+              ch->_M_first_session = session;
+
+              // Arm the connect and write timeouts.
+              ch->arm();
+
+              return ch;
+            }
+
+            // Return connection to the pool.
+            _M_connections.push(ch);
+          }
+
+          break;
+        } else if (errno != EINTR) {
+          metrics.failures.add();
+
+          if (_M_connections.health()) {
+            _M_connections.health()->failure(upstream, connections::now());
+          }
+
+          break;
+        }
+      } while (true);
+    } else {
+      metrics.failures.add();
+    }
+
+    // Close socket.
+    ::close(fd);
+  } else {
+    metrics.failures.add();
+  }
+
+  return nullptr;
+}
+
+bool net::tcp::multiplexer::aggregate(connection* server,
+                                      string::chunk* chunk,
+                                      const uint8_t* buf,
+                                      size_t len)
+{
+  // Get the length of the complete records.
+  size_t complete;
+  if (!records(server, buf, len, complete)) {
+    return false;
+  }
+
+  // If the data completes some records...
+  if (complete > 0) {
+    // The data pending from previous reads is the beginning of the first
+    // record.
+    const size_t length = server->_M_queue.length() + complete;
+
+    // For each upstream server...
+    for (size_t i = 0; i < _M_nupstreams; i++) {
+      // If the session is not forwarded to the upstream server anymore...
+      if (server->_M_detached[i / 64] & (1ull << (i % 64))) {
+        continue;
+      }
+
+      connection** const slot = &_M_channels[(i * _M_nchannels) +
+                                             (server->_M_session %
+                                              _M_nchannels)];
+
+      // If the channel is not connected, connect it (the records don't
+      // depend on the channel).
+      if ((!*slot) && ((*slot = connect(i, server->_M_session)) == nullptr)) {
+        if (!detach(server, i)) {
+          return false;
+        }
+
+        continue;
+      }
+
+      connection* const ch = *slot;
+
+      // If the records cannot be queued...
+      if (ch->_M_queue.length() + length > buffer_limit()) {
+        ch->upstream_metrics().drops.add();
+
+        if (!detach(server, i)) {
+          return false;
+        }
+
+        continue;
+      }
+
+      const size_t queued = ch->_M_queue.length();
+
+      // Append the records (the data is not copied, it will be sent when
+      // the channel is flushed).
+      const bool ret = ((ch->_M_queue.push(server->_M_queue)) &&
+                        (ch->_M_queue.push(chunk, buf, complete)));
+
+      ch->upstream_metrics().pending.add(ch->_M_queue.length() - queued);
+
+      if (!ret) {
+        remove(ch);
+
+        if (!detach(server, i)) {
+          return false;
+        }
+      }
+    }
+
+    server->_M_queue.clear();
+
+    buf += complete;
+    len -= complete;
+  }
+
+  // Keep the beginning of the next record until it is complete.
+  return ((len == 0) || (server->_M_queue.push(chunk, buf, len)));
+}
+
+bool net::tcp::multiplexer::records(connection* server,
+                                    const uint8_t* buf,
+                                    size_t len,
+                                    size_t& complete) const
+{
+  complete = 0;
+
+  // Delimited records?
+  if (_M_config->records == record_format::delimiter) {
+    // Search the last delimiter.
+    const void* const last = memrchr(buf, _M_config->record_delimiter, len);
+
+    if (last) {
+      complete = static_cast<const uint8_t*>(last) - buf + 1;
+
+      return (len - complete <= max_record_size);
+    }
+
+    return (server->_M_queue.length() + len <= max_record_size);
+  }
+
+  // Length-prefixed records.
+  size_t pos = 0;
+  while (pos < len) {
+    // If the length is not complete yet...
+    if (server->_M_prefix < _M_config->record_length_size) {
+      // `_M_record` is the length of the record.
+      server->_M_record = (server->_M_record << 8) | buf[pos++];
+
+      // If the length is complete now...
+      if (++server->_M_prefix == _M_config->record_length_size) {
+        if (server->_M_record > max_record_size) {
+          return false;
+        }
+      } else {
+        continue;
+      }
+    } else {
+      // `_M_record` is the number of bytes left of the record.
+      const size_t n = (server->_M_record < len - pos) ?
+                         server->_M_record :
+                         len - pos;
+
+      pos += n;
+      server->_M_record -= n;
+    }
+
+    // If the record is complete...
+    if (server->_M_record == 0) {
+      complete = pos;
+
+      server->_M_prefix = 0;
+    }
+  }
+
+  return true;
+}
+
+bool net::tcp::multiplexer::detach(connection* server, size_t upstream)
+{
+  unroute(server, upstream);
+
+  // If the session is still forwarded to some upstream server and to the
+  // quorum of the group...
+  if ((server->_M_nupstreams > 0) &&
+      (quorum(server, _M_connections.upstreams()->router().group(upstream)))) {
+    return true;
+  }
+
+  _M_connections.metrics().aborted.add();
+
+  return false;
+}
+
+bool net::tcp::multiplexer::quorum(const connection* server,
+                                   size_t group) const
+{
+  const router& r = _M_connections.upstreams()->router();
+
+  size_t count = 0;
+
+  // Count the upstream servers of the group the session is forwarded to.
+  for (size_t i = r.first(group); i < r.first(group) + r.size(group); i++) {
+    if ((server->_M_detached[i / 64] & (1ull << (i % 64))) == 0) {
+      count++;
+    }
+  }
+
+  return (count >= r.quorum(group));
+}
+
+void net::tcp::multiplexer::unroute(connection* server, size_t upstream)
+{
+  server->_M_detached[upstream / 64] |= (1ull << (upstream % 64));
+  server->_M_nupstreams--;
+}
+
+size_t net::tcp::multiplexer::buffer_limit() const
+{
+  const string::budget* const budget = _M_connections.chunks().budget();
+  return (budget) ? budget->scale(max_buffer_size) : max_buffer_size;
+}
+
+bool net::tcp::multiplexer::write(connection* channel,
+                                  uint32_t session,
+                                  uint8_t type,
+                                  string::chunk* chunk,
+                                  const void* buf,
+                                  size_t len)
+{
+  string::chunk*& headers = channel->_M_chunk;
+
+  // The frame headers are stored in a chunk of the channel: if there is no
+  // chunk or the chunk is full...
+  if ((!headers) || (headers->remaining() < header_size)) {
+    // Release the full chunk (the queue might still hold a reference to
+    // it).
+    if (headers) {
+      headers->release();
+    }
+
+    // Get new chunk.
+    if ((headers = _M_connections.chunks().pop(header_size)) == nullptr) {
+      return false;
+    }
+  }
+
+  // Build frame header.
+  uint8_t* const header = headers->end();
+
+  header[0] = static_cast<uint8_t>(session >> 24);
+  header[1] = static_cast<uint8_t>(session >> 16);
+  header[2] = static_cast<uint8_t>(session >> 8);
+  header[3] = static_cast<uint8_t>(session);
+  header[4] = type;
+  header[5] = static_cast<uint8_t>(len >> 16);
+  header[6] = static_cast<uint8_t>(len >> 8);
+  header[7] = static_cast<uint8_t>(len);
+
+  headers->commit(header_size);
+
+  size_t sent = 0;
+
+  // If the channel is writable and there is no data pending to be sent...
+  if ((channel->_M_writable) && (channel->_M_queue.empty())) {
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = const_cast<void*>(buf);
+    iov[1].iov_len = len;
+
+    // Send header and payload with a single system call.
+    const ssize_t ret = channel->send(iov, (len > 0) ? 2 : 1);
+
+    // If we could send some data...
+    if (ret > 0) {
+      // If we could send the whole frame...
+      if ((sent = static_cast<size_t>(ret)) == header_size + len) {
+        return true;
+      }
+    } else if (errno != EAGAIN) {
+      return false;
+    }
+  }
+
+  const size_t queued = channel->_M_queue.length();
+  bool ret = true;
+
+  // Queue the part of the header which couldn't be sent.
+  if (sent < header_size) {
+    ret = channel->_M_queue.push(headers, header + sent, header_size - sent);
+    sent = 0;
+  } else {
+    sent -= header_size;
+  }
+
+  // Queue the part of the payload which couldn't be sent (the data is not
+  // copied).
+  if ((ret) && (sent < len)) {
+    ret = channel->_M_queue.push(chunk,
+                                 static_cast<const uint8_t*>(buf) + sent,
+                                 len - sent);
+  }
+
+  channel->upstream_metrics().pending.add(channel->_M_queue.length() - queued);
+
+  return ret;
+}
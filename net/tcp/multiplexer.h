@@ -0,0 +1,171 @@
+#ifndef NET_TCP_MULTIPLEXER_H
+#define NET_TCP_MULTIPLEXER_H
+
+#include <stdint.h>
+#include "string/chunks.h"
+#include "net/socket/addresses.h"
+#include "net/tcp/configuration.h"
+#include "net/tcp/router.h"
+
+namespace net {
+  namespace tcp {
+    // Forward declarations.
+    class connection;
+    class connections;
+    class upstreams;
+
+    // Multiplexer: the sessions of a worker are forwarded over a pool of
+    // persistent connections (channels) to each upstream server, instead of
+    // opening new connections for every session.
+    // The data of the sessions is sent in frames:
+    //   * Session id (32 bits, big endian).
+    //   * Frame type (8 bits): open, data or close.
+    //   * Length of the payload (24 bits, big endian).
+    //   * Payload (only data frames).
+    // The channels are connected when a session needs them and, if they are
+    // closed, they are connected again for the next sessions (the sessions
+    // which were using the closed channel are not forwarded to that upstream
+    // server anymore).
+    // In aggregation mode, the data is not framed: the complete records of
+    // the sessions (delimited or length-prefixed) are appended to the
+    // channels, which are flushed once per iteration of the event loop.
+    class multiplexer {
+      public:
+        // Size of the frame header.
+        static constexpr const size_t header_size = 8;
+
+        // Frame types.
+        static constexpr const uint8_t frame_open = 1;
+        static constexpr const uint8_t frame_data = 2;
+        static constexpr const uint8_t frame_close = 3;
+
+        // Constructor.
+        multiplexer(connections& connections);
+
+        // Destructor.
+        ~multiplexer();
+
+        // Initialize (the channels are connected to the upstream servers of
+        // `upstreams`).
+        bool init(int epollfd,
+                  const tcp::upstreams* upstreams,
+                  const configuration* config);
+
+        // Open session for the server connection on the upstream servers of
+        // the set.
+        // Returns false if the session couldn't be opened on any upstream
+        // server.
+        bool open(connection* server, const upstream_set& upstreams);
+
+        // Forward data received from the server connection.
+        // Returns false if the session is not forwarded to any upstream server
+        // anymore.
+        bool forward(connection* server,
+                     string::chunk* chunk,
+                     const void* buf,
+                     size_t len);
+
+        // Close session of the server connection.
+        void close(connection* server);
+
+        // Is data still queued in the channels of the session (possibly data
+        // of other sessions sharing the channels)?
+        bool pending(const connection* server) const;
+
+        // Remove channel (closed by the upstream server or error).
+        void remove(connection* channel);
+
+        // Send the data queued in the channels (aggregation mode).
+        void flush();
+
+      private:
+        // Maximum number of bytes queued in a channel (data frames are not
+        // queued beyond this limit, open and close frames are; it shrinks as
+        // the memory budget runs out).
+        static constexpr const size_t max_buffer_size = 8 * 1024 * 1024;
+
+        // Maximum size of a record (aggregation mode).
+        static constexpr const size_t max_record_size = 1024 * 1024;
+
+        // Connections.
+        connections& _M_connections;
+
+        // epoll file descriptor.
+        int _M_epollfd = -1;
+
+        // Upstream servers.
+        const tcp::upstreams* _M_upstreams = nullptr;
+
+        // Configuration.
+        const configuration* _M_config = nullptr;
+
+        // Number of upstream servers.
+        size_t _M_nupstreams = 0;
+
+        // Number of channels per upstream server.
+        size_t _M_nchannels = 0;
+
+        // Channels (`_M_nchannels` per upstream server, nullptr if not
+        // connected).
+        connection** _M_channels = nullptr;
+
+        // Id of the next session.
+        uint32_t _M_next_session = 0;
+
+        // Get the channel of the session to the upstream server `upstream`
+        // (nullptr if the session cannot use it anymore).
+        connection* channel(const connection* server, size_t upstream) const;
+
+        // Connect channel.
+        connection* connect(size_t upstream, uint32_t session);
+
+        // Append the complete records of the data received from the server
+        // connection to the channels (aggregation mode).
+        bool aggregate(connection* server,
+                       string::chunk* chunk,
+                       const uint8_t* buf,
+                       size_t len);
+
+        // Get the length of the complete records at the beginning of `buf`
+        // (together with the data pending from previous reads).
+        // Returns false if a record is too big.
+        bool records(connection* server,
+                     const uint8_t* buf,
+                     size_t len,
+                     size_t& complete) const;
+
+        // Stop forwarding the session to the upstream server.
+        // Returns false if the session is not forwarded to any upstream server
+        // or to the quorum of the group of the upstream server anymore.
+        bool detach(connection* server, size_t upstream);
+
+        // Is the session forwarded to the quorum of the group?
+        bool quorum(const connection* server, size_t group) const;
+
+        // Mark the upstream server as not used by the session.
+        static void unroute(connection* server, size_t upstream);
+
+        // Get the current maximum number of bytes queued in a channel.
+        size_t buffer_limit() const;
+
+        // Write frame.
+        bool write(connection* channel,
+                   uint32_t session,
+                   uint8_t type,
+                   string::chunk* chunk,
+                   const void* buf,
+                   size_t len);
+
+        // Disable copy constructor and assignment operator.
+        multiplexer(const multiplexer&) = delete;
+        multiplexer& operator=(const multiplexer&) = delete;
+    };
+
+    inline multiplexer::multiplexer(connections& connections)
+      : _M_connections(connections)
+    {
+    }
+  }
+}
+
+#endif // NET_TCP_MULTIPLEXER_H
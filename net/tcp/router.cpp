@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "net/tcp/router.h"
+
+net::tcp::router::router()
+{
+  for (size_t i = 0; i < metrics::max_upstreams; i++) {
+    _M_weights[i] = 1;
+    _M_slot[i] = static_cast<uint8_t>(i);
+  }
+
+  // The upstream servers before the first group form a group routed with the
+  // routing policy of the listener.
+  memset(_M_groups, 0, sizeof(_M_groups));
+
+  _M_groups[0].listener = true;
+  _M_groups[0].quorum = 1;
+}
+
+net::tcp::router::~router()
+{
+  for (size_t i = 0; i < _M_ngroups; i++) {
+    if (_M_groups[i].schedule) {
+      free(_M_groups[i].schedule);
+    }
+
+    if (_M_groups[i].ring) {
+      free(_M_groups[i].ring);
+    }
+  }
+}
+
+bool net::tcp::router::weight(size_t idx, unsigned weight)
+{
+  if ((idx < metrics::max_upstreams) &&
+      (weight > 0) &&
+      (weight <= max_weight)) {
+    _M_weights[idx] = weight;
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::router::slot(size_t idx, size_t slot)
+{
+  if ((idx < metrics::max_upstreams) && (slot < metrics::max_upstreams)) {
+    _M_slot[idx] = static_cast<uint8_t>(slot);
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::router::add_group(size_t first, routing_policy policy)
+{
+  if (_M_ngroups < max_groups) {
+    upstream_group& g = _M_groups[_M_ngroups++];
+
+    g.first = first;
+    g.policy = policy;
+    g.listener = false;
+    g.quorum = 1;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::router::quorum(size_t group, size_t quorum)
+{
+  if ((group > 0) &&
+      (group < _M_ngroups) &&
+      (quorum > 0) &&
+      ((quorum == 1) ||
+       (_M_groups[group].policy == routing_policy::broadcast))) {
+    _M_groups[group].quorum = quorum;
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::router::build(size_t n)
+{
+  if ((n == 0) || (n > metrics::max_upstreams)) {
+    return false;
+  }
+
+  size_t ngroups = 0;
+
+  // For each group...
+  for (size_t i = 0; i < _M_ngroups; i++) {
+    upstream_group& g = _M_groups[i];
+
+    // The group ends where the next group starts.
+    const size_t last = (i + 1 < _M_ngroups) ? _M_groups[i + 1].first : n;
+
+    // Skip empty groups.
+    if (last <= g.first) {
+      continue;
+    }
+
+    g.size = last - g.first;
+
+    // If the quorum cannot be reached...
+    if (g.quorum > g.size) {
+      return false;
+    }
+
+    // Build the round-robin schedule and the hash ring.
+    if (!build(g)) {
+      return false;
+    }
+
+    for (size_t j = g.first; j < last; j++) {
+      _M_group[j] = static_cast<uint8_t>(ngroups);
+    }
+
+    _M_groups[ngroups++] = g;
+  }
+
+  // Clear the groups which have been moved or skipped.
+  for (size_t i = ngroups; i < _M_ngroups; i++) {
+    _M_groups[i].schedule = nullptr;
+    _M_groups[i].ring = nullptr;
+  }
+
+  _M_ngroups = ngroups;
+
+  return true;
+}
+
+size_t net::tcp::router::least_pending(size_t group,
+                                       const metrics& metrics,
+                                       uint64_t random) const
+{
+  const upstream_group& g = _M_groups[group];
+
+  // Choose two upstream servers of the group at random.
+  const size_t a = g.first + (static_cast<size_t>(random & 0xffffffff) %
+                              g.size);
+
+  const size_t b = g.first + (static_cast<size_t>(random >> 32) % g.size);
+
+  // pending(b) / weight(b) < pending(a) / weight(a)?
+  return (metrics.upstreams[_M_slot[b]].pending.get() * _M_weights[a] <
+          metrics.upstreams[_M_slot[a]].pending.get() * _M_weights[b]) ? b : a;
+}
+
+size_t net::tcp::router::hash(size_t group,
+                              const struct sockaddr& addr,
+                              size_t& point) const
+{
+  const upstream_group& g = _M_groups[group];
+
+  uint32_t h;
+
+  // Hash the IP address (not the port).
+  switch (addr.sa_family) {
+    case AF_INET:
+      h = hash(&reinterpret_cast<const struct sockaddr_in&>(addr).sin_addr,
+               sizeof(struct in_addr),
+               1);
+
+      break;
+    case AF_INET6:
+      h = hash(&reinterpret_cast<const struct sockaddr_in6&>(addr).sin6_addr,
+               sizeof(struct in6_addr),
+               1);
+
+      break;
+    default:
+      h = 0;
+  }
+
+  // Binary search of the first point whose hash is not lower than `h`.
+  size_t low = 0;
+  size_t high = g.npoints;
+
+  while (low < high) {
+    const size_t mid = low + ((high - low) / 2);
+
+    if (g.ring[mid].hash < h) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  // Wrap around the ring.
+  point = (low < g.npoints) ? low : 0;
+
+  return g.ring[point].upstream;
+}
+
+bool net::tcp::router::build(upstream_group& group)
+{
+  size_t total = 0;
+  for (size_t i = group.first; i < group.first + group.size; i++) {
+    total += _M_weights[i];
+  }
+
+  // Allocate schedule and ring.
+  uint8_t* const schedule = static_cast<uint8_t*>(malloc(total));
+  if (!schedule) {
+    return false;
+  }
+
+  point* const ring = static_cast<point*>(
+                        malloc(total * points_per_weight * sizeof(point))
+                      );
+
+  if (!ring) {
+    free(schedule);
+    return false;
+  }
+
+  // Build the schedule with the smooth weighted round-robin algorithm (the
+  // upstream servers with higher weights are not chosen in bursts).
+  int current[metrics::max_upstreams];
+  for (size_t i = 0; i < group.size; i++) {
+    current[i] = 0;
+  }
+
+  for (size_t pos = 0; pos < total; pos++) {
+    size_t best = 0;
+
+    for (size_t i = 0; i < group.size; i++) {
+      current[i] += static_cast<int>(_M_weights[group.first + i]);
+
+      if (current[i] > current[best]) {
+        best = i;
+      }
+    }
+
+    current[best] -= static_cast<int>(total);
+
+    schedule[pos] = static_cast<uint8_t>(group.first + best);
+  }
+
+  // Build the ring: each upstream server gets a number of points proportional
+  // to its weight.
+  size_t npoints = 0;
+  for (size_t i = group.first; i < group.first + group.size; i++) {
+    for (size_t j = 0; j < _M_weights[i] * points_per_weight; j++) {
+      const uint32_t key[2] = {
+        static_cast<uint32_t>(i),
+        static_cast<uint32_t>(j)
+      };
+
+      ring[npoints].hash = hash(key, sizeof(key), 0);
+      ring[npoints].upstream = static_cast<uint32_t>(i);
+
+      npoints++;
+    }
+  }
+
+  qsort(ring, npoints, sizeof(point), compare);
+
+  if (group.schedule) {
+    free(group.schedule);
+  }
+
+  if (group.ring) {
+    free(group.ring);
+  }
+
+  group.schedule = schedule;
+  group.schedule_length = total;
+
+  group.ring = ring;
+  group.npoints = npoints;
+
+  return true;
+}
+
+uint32_t net::tcp::router::hash(const void* buf, size_t len, uint32_t seed)
+{
+  // FNV-1a.
+  uint32_t h = 2166136261u ^ seed;
+
+  for (size_t i = 0; i < len; i++) {
+    h ^= static_cast<const uint8_t*>(buf)[i];
+    h *= 16777619u;
+  }
+
+  // Final mix (MurmurHash3), so that close keys are spread over the ring.
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+
+  return h;
+}
+
+int net::tcp::router::compare(const void* p1, const void* p2)
+{
+  const uint32_t h1 = static_cast<const point*>(p1)->hash;
+  const uint32_t h2 = static_cast<const point*>(p2)->hash;
+
+  return (h1 < h2) ? -1 : (h1 > h2);
+}
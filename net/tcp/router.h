@@ -0,0 +1,284 @@
+#ifndef NET_TCP_ROUTER_H
+#define NET_TCP_ROUTER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "net/tcp/configuration.h"
+#include "net/tcp/metrics.h"
+
+namespace net {
+  namespace tcp {
+    // Set of upstream servers.
+    class upstream_set {
+      public:
+        // Constructor.
+        upstream_set() = default;
+
+        // Clear set.
+        void clear();
+
+        // Add upstream server.
+        void add(size_t idx);
+
+        // Add `n` upstream servers, starting from `first`.
+        void add(size_t first, size_t n);
+
+        // Does the set contain the upstream server?
+        bool contains(size_t idx) const;
+
+      private:
+        static constexpr const size_t nwords = metrics::max_upstreams / 64;
+
+        uint64_t _M_bits[nwords];
+    };
+
+    // Router: it chooses the upstream servers of a session.
+    // The upstream servers are divided in groups (consecutive upstream
+    // servers) and the session is routed in each group independently: to all
+    // the upstream servers of the group (broadcast) or to one of them. The
+    // session is closed when the upstream servers of a group it is still
+    // forwarded to are less than the quorum of the group.
+    // It is built before it is published to the worker threads and then only
+    // read, so it is shared by all the worker threads.
+    // Each upstream server has a slot: the index of its metrics (and of its
+    // spill queue), which is kept when the list of upstream servers is
+    // reloaded.
+    class router {
+      public:
+        // Maximum weight of an upstream server.
+        static constexpr const unsigned max_weight = 100;
+
+        // Maximum number of groups.
+        static constexpr const size_t max_groups = 16;
+
+        // Constructor.
+        router();
+
+        // Destructor.
+        ~router();
+
+        // Set the weight of an upstream server (1 by default).
+        bool weight(size_t idx, unsigned weight);
+
+        // Set the slot of an upstream server (its index by default).
+        bool slot(size_t idx, size_t slot);
+
+        // Get the slot of an upstream server.
+        size_t slot(size_t idx) const;
+
+        // Add group starting at the upstream server `first` and routed with
+        // `policy` (the upstream servers before the first group form a group
+        // routed with the routing policy of the listener).
+        bool add_group(size_t first, routing_policy policy);
+
+        // Set the quorum of a group (only groups added with add_group() and
+        // routed with the broadcast policy; 1 by default).
+        bool quorum(size_t group, size_t quorum);
+
+        // Build the groups, their round-robin schedules and their hash rings
+        // for `n` upstream servers (the empty groups are removed).
+        bool build(size_t n);
+
+        // Get number of groups.
+        size_t number_groups() const;
+
+        // Get the group of an upstream server.
+        size_t group(size_t upstream) const;
+
+        // Get the first upstream server of a group.
+        size_t first(size_t group) const;
+
+        // Get the number of upstream servers of a group.
+        size_t size(size_t group) const;
+
+        // Get the routing policy of a group (returns false if the group is
+        // routed with the routing policy of the listener).
+        bool policy(size_t group, routing_policy& policy) const;
+
+        // Get the minimum number of upstream servers of a group a session has
+        // to be forwarded to (always 1 if the session is routed to only one
+        // upstream server of the group).
+        size_t quorum(size_t group) const;
+
+        // Get the length of the round-robin schedule of a group.
+        size_t schedule_length(size_t group) const;
+
+        // Round-robin (weighted): `cursor` is the position of the caller in
+        // the schedule of the group (O(1)).
+        size_t round_robin(size_t group, size_t& cursor) const;
+
+        // Least pending bytes: the upstream server of the group with less
+        // bytes pending to be sent (relative to its weight) of two chosen at
+        // random (O(1)).
+        size_t least_pending(size_t group,
+                             const metrics& metrics,
+                             uint64_t random) const;
+
+        // Consistent hashing of the client address (O(log n)): `point` is
+        // set to the point of the hash ring the upstream server was taken
+        // from.
+        size_t hash(size_t group,
+                    const struct sockaddr& addr,
+                    size_t& point) const;
+
+        // Get the upstream server of the point of the hash ring which follows
+        // `point` (wrapping around) and advance `point` (O(1)).
+        size_t next_point(size_t group, size_t& point) const;
+
+      private:
+        // Points of the hash ring per unit of weight.
+        static constexpr const size_t points_per_weight = 64;
+
+        // Point of the hash ring.
+        struct point {
+          uint32_t hash;
+          uint32_t upstream;
+        };
+
+        // Group of upstream servers.
+        struct upstream_group {
+          // First upstream server and number of upstream servers.
+          size_t first;
+          size_t size;
+
+          // Routing policy (unless the routing policy of the listener is
+          // used).
+          routing_policy policy;
+          bool listener;
+
+          // Quorum.
+          size_t quorum;
+
+          // Round-robin schedule (each upstream server appears as many times
+          // as its weight, interleaved).
+          uint8_t* schedule;
+          size_t schedule_length;
+
+          // Hash ring (sorted by hash).
+          point* ring;
+          size_t npoints;
+        };
+
+        // Weights of the upstream servers.
+        unsigned _M_weights[metrics::max_upstreams];
+
+        // Groups.
+        upstream_group _M_groups[max_groups];
+        size_t _M_ngroups = 1;
+
+        // Group of each upstream server.
+        uint8_t _M_group[metrics::max_upstreams];
+
+        // Slot of each upstream server.
+        uint8_t _M_slot[metrics::max_upstreams];
+
+        // Build the round-robin schedule and the hash ring of a group.
+        bool build(upstream_group& group);
+
+        // Hash function.
+        static uint32_t hash(const void* buf, size_t len, uint32_t seed);
+
+        // Compare points (qsort()).
+        static int compare(const void* p1, const void* p2);
+
+        // Disable copy constructor and assignment operator.
+        router(const router&) = delete;
+        router& operator=(const router&) = delete;
+    };
+
+    inline void upstream_set::clear()
+    {
+      for (size_t i = 0; i < nwords; i++) {
+        _M_bits[i] = 0;
+      }
+    }
+
+    inline void upstream_set::add(size_t idx)
+    {
+      _M_bits[idx / 64] |= (1ull << (idx % 64));
+    }
+
+    inline void upstream_set::add(size_t first, size_t n)
+    {
+      for (size_t i = first; i < first + n; i++) {
+        add(i);
+      }
+    }
+
+    inline bool upstream_set::contains(size_t idx) const
+    {
+      return ((_M_bits[idx / 64] & (1ull << (idx % 64))) != 0);
+    }
+
+    inline size_t router::number_groups() const
+    {
+      return _M_ngroups;
+    }
+
+    inline size_t router::group(size_t upstream) const
+    {
+      return _M_group[upstream];
+    }
+
+    inline size_t router::slot(size_t idx) const
+    {
+      return _M_slot[idx];
+    }
+
+    inline size_t router::first(size_t group) const
+    {
+      return _M_groups[group].first;
+    }
+
+    inline size_t router::size(size_t group) const
+    {
+      return _M_groups[group].size;
+    }
+
+    inline bool router::policy(size_t group, routing_policy& policy) const
+    {
+      if (!_M_groups[group].listener) {
+        policy = _M_groups[group].policy;
+        return true;
+      }
+
+      return false;
+    }
+
+    inline size_t router::quorum(size_t group) const
+    {
+      return _M_groups[group].quorum;
+    }
+
+    inline size_t router::schedule_length(size_t group) const
+    {
+      return _M_groups[group].schedule_length;
+    }
+
+    inline size_t router::round_robin(size_t group, size_t& cursor) const
+    {
+      const upstream_group& g = _M_groups[group];
+
+      const size_t idx = g.schedule[cursor];
+
+      if (++cursor == g.schedule_length) {
+        cursor = 0;
+      }
+
+      return idx;
+    }
+
+    inline size_t router::next_point(size_t group, size_t& point) const
+    {
+      const upstream_group& g = _M_groups[group];
+
+      if (++point == g.npoints) {
+        point = 0;
+      }
+
+      return g.ring[point].upstream;
+    }
+  }
+}
+
+#endif // NET_TCP_ROUTER_H
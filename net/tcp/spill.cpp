@@ -0,0 +1,177 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "net/tcp/spill.h"
+
+net::tcp::spill::~spill()
+{
+  if (_M_data) {
+    munmap(_M_data, _M_size);
+  }
+}
+
+bool net::tcp::spill::open(const char* dir, size_t size)
+{
+  // Round the size down to the alignment of the records.
+  size &= ~(alignment - 1);
+
+  if (size == 0) {
+    return false;
+  }
+
+  // Create unnamed file (it is removed when it is closed and unmapped).
+  const int fd = ::open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    return false;
+  }
+
+  // Set the size of the file and map it.
+  void* mem = MAP_FAILED;
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  // The mapping keeps a reference to the file.
+  ::close(fd);
+
+  if (mem != MAP_FAILED) {
+    // The ring is written and read sequentially.
+    madvise(mem, size, MADV_SEQUENTIAL);
+
+    _M_data = static_cast<uint8_t*>(mem);
+    _M_size = size;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool net::tcp::spill::push(list& l, const void* buf, size_t len)
+{
+  // Size of the record.
+  const size_t size = (sizeof(header) + len + alignment - 1) &
+                      ~(alignment - 1);
+
+  // If the record cannot fit in the ring...
+  if ((!_M_data) || (size > _M_size)) {
+    return false;
+  }
+
+  // If the ring is empty, start from the beginning.
+  if (_M_used == 0) {
+    _M_tail = 0;
+    _M_head = 0;
+  }
+
+  // If the record doesn't fit before the end of the ring, the rest of the
+  // ring is skipped (padding).
+  const size_t padding = (_M_head + size > _M_size) ? _M_size - _M_head : 0;
+
+  // If there is no space left...
+  if (_M_used + padding + size > _M_size) {
+    return false;
+  }
+
+  if (padding > 0) {
+    header* const pad = at(_M_head);
+    pad->size = static_cast<uint32_t>(padding);
+    pad->length = 0;
+    pad->consumed = 0;
+    pad->free = 1;
+    pad->next = none;
+
+    _M_head = 0;
+    _M_used += padding;
+  }
+
+  // Write record.
+  header* const h = at(_M_head);
+  h->size = static_cast<uint32_t>(size);
+  h->length = static_cast<uint32_t>(len);
+  h->consumed = 0;
+  h->free = 0;
+  h->next = none;
+
+  memcpy(h + 1, buf, len);
+
+  // Append record to the list.
+  if (l.first == none) {
+    l.first = _M_head;
+
+    _M_nlists++;
+  } else {
+    at(l.last)->next = _M_head;
+  }
+
+  l.last = _M_head;
+  l.length += len;
+
+  if ((_M_head += size) == _M_size) {
+    _M_head = 0;
+  }
+
+  _M_used += size;
+
+  return true;
+}
+
+void net::tcp::spill::erase(list& l, size_t n)
+{
+  while (n > 0) {
+    header* const h = at(l.first);
+
+    const size_t count = (n < h->length - h->consumed) ?
+                           n :
+                           h->length - h->consumed;
+
+    h->consumed += static_cast<uint32_t>(count);
+    l.length -= count;
+    n -= count;
+
+    // If the record has been consumed...
+    if (h->consumed == h->length) {
+      h->free = 1;
+
+      if ((l.first = h->next) == none) {
+        l.last = none;
+
+        _M_nlists--;
+      }
+    }
+  }
+
+  reclaim();
+}
+
+void net::tcp::spill::clear(list& l)
+{
+  // If the list has records...
+  if (l.first != none) {
+    // Mark all the records of the list as consumed.
+    for (uint64_t off = l.first; off != none; off = at(off)->next) {
+      at(off)->free = 1;
+    }
+
+    _M_nlists--;
+  }
+
+  init(l);
+
+  reclaim();
+}
+
+void net::tcp::spill::reclaim()
+{
+  // While the oldest record has been consumed...
+  while ((_M_used > 0) && (at(_M_tail)->free)) {
+    const size_t size = at(_M_tail)->size;
+
+    if ((_M_tail += size) == _M_size) {
+      _M_tail = 0;
+    }
+
+    _M_used -= size;
+  }
+}
@@ -0,0 +1,166 @@
+#ifndef NET_TCP_SPILL_H
+#define NET_TCP_SPILL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace net {
+  namespace tcp {
+    // Spill queue of an upstream server: a ring of records in a memory-mapped
+    // file on local disk, where the client connections to the upstream server
+    // store the data which doesn't fit in their buffers.
+    // The records of each client connection are linked through their headers,
+    // so the data of a client connection is drained in order. The space of the
+    // ring is reclaimed in the order the records were written (a consumed
+    // record holds its space until the older records are consumed too).
+    // The records are written and read sequentially and the file is mapped
+    // with MADV_SEQUENTIAL, so the kernel writes back and reads ahead in large
+    // blocks.
+    class spill {
+      public:
+        // Default size of the ring (bytes).
+        static constexpr const size_t default_size = 256 * 1024 * 1024;
+
+        // Records of a client connection.
+        struct list {
+          // Offsets of the first and the last records.
+          uint64_t first;
+          uint64_t last;
+
+          // Number of bytes not consumed yet.
+          size_t length;
+        };
+
+        // Constructor.
+        spill() = default;
+
+        // Destructor.
+        ~spill();
+
+        // Create the file in the directory `dir` (it is removed when the
+        // process exits) and map it.
+        bool open(const char* dir, size_t size);
+
+        // Has the file been created?
+        bool is_open() const;
+
+        // Initialize list.
+        static void init(list& l);
+
+        // Append record to the list.
+        // Returns false if there is no space left in the ring.
+        bool push(list& l, const void* buf, size_t len);
+
+        // Get the data not consumed yet of the first record of the list.
+        size_t front(const list& l, const void*& data) const;
+
+        // Consume `n` bytes of the list.
+        void erase(list& l, size_t n);
+
+        // Consume all the records of the list.
+        void clear(list& l);
+
+        // Discard all the records (no list may refer to them anymore).
+        void reset();
+
+        // Get the number of bytes not used.
+        size_t available() const;
+
+        // Get the number of lists which have records.
+        size_t lists() const;
+
+      private:
+        // Alignment of the records.
+        static constexpr const size_t alignment = 64;
+
+        // Invalid offset.
+        static constexpr const uint64_t none = UINT64_MAX;
+
+        // Header of a record.
+        struct header {
+          // Size of the record, including the header and the padding.
+          uint32_t size;
+
+          // Number of bytes of data and number of bytes consumed.
+          uint32_t length;
+          uint32_t consumed;
+
+          // Has the record been consumed (or is it padding)?
+          uint32_t free;
+
+          // Offset of the next record of the list.
+          uint64_t next;
+        };
+
+        // Mapped file.
+        uint8_t* _M_data = nullptr;
+        size_t _M_size = 0;
+
+        // Offset of the oldest record and where the next record is written.
+        size_t _M_tail = 0;
+        size_t _M_head = 0;
+
+        // Number of bytes used (including padding).
+        size_t _M_used = 0;
+
+        // Number of lists which have records.
+        size_t _M_nlists = 0;
+
+        // Get the header of the record at the offset `off`.
+        header* at(uint64_t off) const;
+
+        // Reclaim the space of the consumed records at the tail of the ring.
+        void reclaim();
+
+        // Disable copy constructor and assignment operator.
+        spill(const spill&) = delete;
+        spill& operator=(const spill&) = delete;
+    };
+
+    inline bool spill::is_open() const
+    {
+      return (_M_data != nullptr);
+    }
+
+    inline void spill::init(list& l)
+    {
+      l.first = none;
+      l.last = none;
+      l.length = 0;
+    }
+
+    inline size_t spill::front(const list& l, const void*& data) const
+    {
+      const header* const h = at(l.first);
+
+      data = reinterpret_cast<const uint8_t*>(h + 1) + h->consumed;
+
+      return h->length - h->consumed;
+    }
+
+    inline void spill::reset()
+    {
+      _M_tail = 0;
+      _M_head = 0;
+      _M_used = 0;
+      _M_nlists = 0;
+    }
+
+    inline size_t spill::available() const
+    {
+      return _M_size - _M_used;
+    }
+
+    inline size_t spill::lists() const
+    {
+      return _M_nlists;
+    }
+
+    inline spill::header* spill::at(uint64_t off) const
+    {
+      return reinterpret_cast<header*>(_M_data + off);
+    }
+  }
+}
+
+#endif // NET_TCP_SPILL_H
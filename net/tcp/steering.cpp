@@ -0,0 +1,286 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include "net/tcp/steering.h"
+
+static struct bpf_insn insn(uint8_t code,
+                            uint8_t dst,
+                            uint8_t src,
+                            int16_t off,
+                            int32_t imm);
+
+net::tcp::steering::~steering()
+{
+  if (_M_loadsmem) {
+    munmap(_M_loadsmem, _M_loadslen);
+  }
+
+  if (_M_loads != -1) {
+    close(_M_loads);
+  }
+}
+
+bool net::tcp::steering::by_cpu(const int* fds, const int* cpus, size_t n)
+{
+  // Maximum number of instructions of a classic BPF program.
+  static constexpr const size_t max_instructions = BPF_MAXINSNS;
+
+  struct sock_filter code[max_instructions];
+  size_t ncode = 0;
+
+  // A = CPU which is processing the packet.
+  code[ncode++] = BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                           static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU));
+
+  // For each worker pinned to a single CPU...
+  for (size_t i = 0; i < n; i++) {
+    if (cpus[i] != -1) {
+      // Leave room for the last two instructions.
+      if (ncode + 2 + 2 > max_instructions) {
+        return false;
+      }
+
+      // if (A == cpus[i]) return i;
+      code[ncode++] = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                               static_cast<uint32_t>(cpus[i]),
+                               0,
+                               1);
+      code[ncode++] = BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(i));
+    }
+  }
+
+  // return A % n;
+  code[ncode++] = BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,
+                           static_cast<uint32_t>(n));
+  code[ncode++] = BPF_STMT(BPF_RET | BPF_A, 0);
+
+  struct sock_fprog prog;
+  prog.len = static_cast<unsigned short>(ncode);
+  prog.filter = code;
+
+  // The program is attached to the whole reuseport group.
+  return (setsockopt(fds[0],
+                     SOL_SOCKET,
+                     SO_ATTACH_REUSEPORT_CBPF,
+                     &prog,
+                     sizeof(struct sock_fprog)) == 0);
+}
+
+bool net::tcp::steering::create_loads(size_t nworkers)
+{
+  // Create array which can be mmap()ed (the values are 64-bit because the
+  // elements of the arrays are 8-byte aligned anyway).
+  if ((_M_loads = create_map(BPF_MAP_TYPE_ARRAY,
+                             sizeof(uint32_t),
+                             sizeof(uint64_t),
+                             static_cast<uint32_t>(nworkers),
+                             BPF_F_MMAPABLE)) != -1) {
+    const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    const size_t len = ((nworkers * sizeof(uint64_t)) + pagesize - 1) &
+                       ~(pagesize - 1);
+
+    void* const mem = mmap(nullptr,
+                           len,
+                           PROT_READ | PROT_WRITE,
+                           MAP_SHARED,
+                           _M_loads,
+                           0);
+
+    if (mem != MAP_FAILED) {
+      _M_loadsmem = static_cast<uint64_t*>(mem);
+      _M_loadslen = len;
+      _M_nworkers = nworkers;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool net::tcp::steering::by_load(const int* fds, size_t n)
+{
+  // If the map of loads doesn't exist or the workers don't match...
+  if ((_M_loads == -1) || (n != _M_nworkers)) {
+    return false;
+  }
+
+  // Create array of sockets of the reuseport group.
+  const int socks = create_map(BPF_MAP_TYPE_REUSEPORT_SOCKARRAY,
+                               sizeof(uint32_t),
+                               sizeof(uint64_t),
+                               static_cast<uint32_t>(n),
+                               0);
+
+  if (socks == -1) {
+    return false;
+  }
+
+  // Add the listeners to the array (the index is the worker number).
+  for (size_t i = 0; i < n; i++) {
+    const uint32_t key = static_cast<uint32_t>(i);
+    const uint64_t value = static_cast<uint64_t>(fds[i]);
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(union bpf_attr));
+
+    attr.map_fd = static_cast<uint32_t>(socks);
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    attr.value = reinterpret_cast<uint64_t>(&value);
+    attr.flags = BPF_ANY;
+
+    if (syscall(SYS_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr)) < 0) {
+      close(socks);
+      return false;
+    }
+  }
+
+  const int32_t nworkers = static_cast<int32_t>(n);
+
+  // Power of two choices:
+  //   r = random();
+  //   a = (r & 0xffff) % n;
+  //   b = ((r >> 16) & 0xffff) % n;
+  //   key = (loads[b] < loads[a]) ? b : a;
+  //   select_reuseport(socks[key]);
+  //   return SK_PASS;
+  // If the selection fails, the kernel falls back to the hash.
+  const struct bpf_insn code[] = {
+    // r6 = ctx;
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+
+    // r0 = random();
+    insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_prandom_u32),
+
+    // r7 = (r0 & 0xffff) % n;
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0),
+    insn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_7, 0, 0, 0xffff),
+    insn(BPF_ALU64 | BPF_MOD | BPF_K, BPF_REG_7, 0, 0, nworkers),
+
+    // r8 = ((r0 >> 16) & 0xffff) % n;
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_8, BPF_REG_0, 0, 0),
+    insn(BPF_ALU64 | BPF_RSH | BPF_K, BPF_REG_8, 0, 0, 16),
+    insn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_8, 0, 0, 0xffff),
+    insn(BPF_ALU64 | BPF_MOD | BPF_K, BPF_REG_8, 0, 0, nworkers),
+
+    // r0 = &loads[r7];
+    insn(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_7, -4, 0),
+    insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, _M_loads),
+    insn(0, 0, 0, 0, 0),
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+    insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4),
+    insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+
+    // if (!r0) goto pass;
+    insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 19, 0),
+
+    // r9 = *r0;
+    insn(BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_9, BPF_REG_0, 0, 0),
+
+    // r0 = &loads[r8];
+    insn(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_8, -4, 0),
+    insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, _M_loads),
+    insn(0, 0, 0, 0, 0),
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+    insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4),
+    insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+
+    // if (!r0) goto pass;
+    insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 11, 0),
+
+    // if (*r0 < r9) r7 = r8;
+    insn(BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_1, BPF_REG_0, 0, 0),
+    insn(BPF_JMP | BPF_JGE | BPF_X, BPF_REG_1, BPF_REG_9, 1, 0),
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_8, 0, 0),
+
+    // select_reuseport(ctx, socks, &r7, 0);
+    insn(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_7, -4, 0),
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0),
+    insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_2, BPF_PSEUDO_MAP_FD, 0, socks),
+    insn(0, 0, 0, 0, 0),
+    insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_3, BPF_REG_10, 0, 0),
+    insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_3, 0, 0, -4),
+    insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, 0),
+    insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_sk_select_reuseport),
+
+    // pass: return SK_PASS;
+    insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, SK_PASS),
+    insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+  };
+
+  static const char license[] = "Dual MIT/GPL";
+
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(union bpf_attr));
+
+  attr.prog_type = BPF_PROG_TYPE_SK_REUSEPORT;
+  attr.expected_attach_type = BPF_SK_REUSEPORT_SELECT;
+  attr.insns = reinterpret_cast<uint64_t>(code);
+  attr.insn_cnt = sizeof(code) / sizeof(code[0]);
+  attr.license = reinterpret_cast<uint64_t>(license);
+
+  // Load program (it keeps a reference to the maps).
+  const int prog = static_cast<int>(syscall(SYS_bpf,
+                                            BPF_PROG_LOAD,
+                                            &attr,
+                                            sizeof(attr)));
+
+  close(socks);
+
+  if (prog != -1) {
+    // The program is attached to the whole reuseport group.
+    const bool ret = (setsockopt(fds[0],
+                                 SOL_SOCKET,
+                                 SO_ATTACH_REUSEPORT_EBPF,
+                                 &prog,
+                                 sizeof(int)) == 0);
+
+    close(prog);
+
+    return ret;
+  }
+
+  return false;
+}
+
+int net::tcp::steering::create_map(uint32_t type,
+                                   uint32_t key_size,
+                                   uint32_t value_size,
+                                   uint32_t max_entries,
+                                   uint32_t flags)
+{
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(union bpf_attr));
+
+  attr.map_type = type;
+  attr.key_size = key_size;
+  attr.value_size = value_size;
+  attr.max_entries = max_entries;
+  attr.map_flags = flags;
+
+  return static_cast<int>(syscall(SYS_bpf,
+                                  BPF_MAP_CREATE,
+                                  &attr,
+                                  sizeof(attr)));
+}
+
+struct bpf_insn insn(uint8_t code,
+                     uint8_t dst,
+                     uint8_t src,
+                     int16_t off,
+                     int32_t imm)
+{
+  struct bpf_insn i;
+  i.code = code;
+  i.dst_reg = dst;
+  i.src_reg = src;
+  i.off = off;
+  i.imm = imm;
+
+  return i;
+}
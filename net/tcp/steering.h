@@ -0,0 +1,67 @@
+#ifndef NET_TCP_STEERING_H
+#define NET_TCP_STEERING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace net {
+  namespace tcp {
+    // Steering of the connections of a reuseport group (the listeners of the
+    // same address, one per worker) to the workers.
+    class steering {
+      public:
+        // Constructor.
+        steering() = default;
+
+        // Destructor.
+        ~steering();
+
+        // Steer by CPU (classic BPF program): the connections whose packets
+        // are processed on the CPU `cpus[i]` go to the listener `fds[i]`
+        // (`cpus[i]` is -1 if the worker is not pinned to a single CPU); the
+        // rest go to the listener `fds[cpu % n]`.
+        static bool by_cpu(const int* fds, const int* cpus, size_t n);
+
+        // Create the map where the workers publish their load (number of
+        // active sessions).
+        bool create_loads(size_t nworkers);
+
+        // Get the load of a worker (shared with the kernel).
+        uint64_t* load(size_t nworker);
+
+        // Steer by load (extended BPF program): the connections go to the
+        // least loaded of two workers chosen at random.
+        // create_loads() has to be called first.
+        bool by_load(const int* fds, size_t n);
+
+      private:
+        // File descriptor of the map of loads.
+        int _M_loads = -1;
+
+        // Memory of the map of loads (mmap()ed).
+        uint64_t* _M_loadsmem = nullptr;
+        size_t _M_loadslen = 0;
+
+        // Number of workers.
+        size_t _M_nworkers = 0;
+
+        // Create map.
+        static int create_map(uint32_t type,
+                              uint32_t key_size,
+                              uint32_t value_size,
+                              uint32_t max_entries,
+                              uint32_t flags);
+
+        // Disable copy constructor and assignment operator.
+        steering(const steering&) = delete;
+        steering& operator=(const steering&) = delete;
+    };
+
+    inline uint64_t* steering::load(size_t nworker)
+    {
+      return (nworker < _M_nworkers) ? &_M_loadsmem[nworker] : nullptr;
+    }
+  }
+}
+
+#endif // NET_TCP_STEERING_H
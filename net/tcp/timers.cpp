@@ -0,0 +1,145 @@
+#include "net/tcp/timers.h"
+
+net::tcp::timers::timers()
+{
+  // Make each slot an empty circular list.
+  for (size_t level = 0; level < levels; level++) {
+    for (size_t i = 0; i < slots; i++) {
+      _M_slots[level][i].prev = &_M_slots[level][i];
+      _M_slots[level][i].next = &_M_slots[level][i];
+    }
+  }
+}
+
+void net::tcp::timers::add(timer* t, uint64_t expires)
+{
+  // Disarm the timer (if it is armed).
+  remove(t);
+
+  t->expires = (expires > _M_now) ? expires : _M_now + 1;
+
+  insert(t);
+
+  _M_count++;
+}
+
+void net::tcp::timers::expire(uint64_t now, expired_t callback)
+{
+  // While the time hasn't reached `now`...
+  while (_M_now < now) {
+    // If there are no timers, jump to `now`.
+    if (_M_count == 0) {
+      _M_now = now;
+      return;
+    }
+
+    _M_now++;
+
+    // If the time has entered a new slot of the level 1...
+    if ((_M_now & (slots - 1)) == 0) {
+      // Get the highest level whose slot has changed.
+      size_t level = 1;
+      while ((level + 1 < levels) &&
+             (((_M_now >> (bits * level)) & (slots - 1)) == 0)) {
+        level++;
+      }
+
+      // Move the timers of the new slots to the lower levels (from the
+      // highest level).
+      for (; level > 0; level--) {
+        cascade(level);
+      }
+    }
+
+    timer* const head = &_M_slots[0][_M_now & (slots - 1)];
+
+    // Invoke the callback for each timer of the slot (the callback might
+    // add and remove timers, also of this slot).
+    while (head->next != head) {
+      timer* const t = head->next;
+
+      remove(t);
+
+      callback(t);
+    }
+  }
+}
+
+int net::tcp::timers::timeout(int max) const
+{
+  uint64_t next = _M_now + static_cast<uint64_t>(max);
+
+  // If there are timers...
+  if (_M_count > 0) {
+    // For each level...
+    for (size_t level = 0; level < levels; level++) {
+      const unsigned shift = bits * level;
+
+      // Search the next slot of the level which is not empty (the timers
+      // of the level 0 expire then and the timers of the other levels are
+      // moved to the lower levels then).
+      for (uint64_t i = 1; i <= slots; i++) {
+        const uint64_t slot = (_M_now >> shift) + i;
+
+        // If the rest of slots are not earlier...
+        if ((slot << shift) >= next) {
+          break;
+        }
+
+        const timer* const head = &_M_slots[level][slot & (slots - 1)];
+
+        if (head->next != head) {
+          next = slot << shift;
+          break;
+        }
+      }
+    }
+  }
+
+  return static_cast<int>(next - _M_now);
+}
+
+void net::tcp::timers::insert(timer* t)
+{
+  const uint64_t delta = (t->expires > _M_now) ? t->expires - _M_now : 0;
+
+  // Choose the lowest level which spans the expiration time (the timers
+  // which expire later than the highest level spans are moved down when
+  // their slot is reached and inserted again).
+  size_t level = 0;
+  while ((level + 1 < levels) && (delta >= (1ull << (bits * (level + 1))))) {
+    level++;
+  }
+
+  const uint64_t expires =
+    (delta < (1ull << (bits * levels))) ?
+      t->expires :
+      _M_now + (1ull << (bits * levels)) - 1;
+
+  timer* const head =
+    &_M_slots[level][(expires >> (bits * level)) & (slots - 1)];
+
+  // Append the timer to the slot.
+  t->prev = head->prev;
+  t->next = head;
+
+  head->prev->next = t;
+  head->prev = t;
+}
+
+void net::tcp::timers::cascade(size_t level)
+{
+  timer* const head =
+    &_M_slots[level][(_M_now >> (bits * level)) & (slots - 1)];
+
+  // Move each timer of the slot to a lower level.
+  while (head->next != head) {
+    timer* const t = head->next;
+
+    // Unlink the timer (it stays armed).
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+
+    insert(t);
+  }
+}
@@ -0,0 +1,129 @@
+#ifndef NET_TCP_TIMERS_H
+#define NET_TCP_TIMERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace net {
+  namespace tcp {
+    // Hierarchical timer wheel (resolution: 1 millisecond).
+    // Each level has 64 slots and each slot of a level spans the whole
+    // previous level: the timers of the level 0 expire in the current
+    // 64 ms, the timers of the level 1 in the current 4 s and so on. When the
+    // time enters a new slot of a level, its timers are moved to the lower
+    // levels, so each timer is moved at most `levels - 1` times.
+    // The timers are intrusive (embedded in the objects which own them), so
+    // adding and removing a timer are O(1) and never allocate memory.
+    class timers {
+      public:
+        // Timer.
+        struct timer {
+          // Previous and next timers of the slot (nullptr if the timer is
+          // not armed).
+          timer* prev = nullptr;
+          timer* next = nullptr;
+
+          // Expiration time (milliseconds).
+          uint64_t expires;
+
+          // Owner of the timer.
+          void* data;
+        };
+
+        // Callback invoked for each expired timer.
+        typedef void (*expired_t)(timer*);
+
+        // Constructor.
+        timers();
+
+        // Destructor.
+        ~timers() = default;
+
+        // Arm the timer (if it is already armed, it is rearmed) to expire at
+        // `expires` (milliseconds; if it is not later than the current time,
+        // at the next millisecond).
+        void add(timer* t, uint64_t expires);
+
+        // Disarm the timer (if it is armed).
+        void remove(timer* t);
+
+        // Is the timer armed?
+        static bool armed(const timer* t);
+
+        // Advance the time to `now` (milliseconds) and invoke `callback` for
+        // each timer which has expired (the timers are disarmed before the
+        // callback is invoked, so they can be rearmed).
+        void expire(uint64_t now, expired_t callback);
+
+        // Get the current time (the time of the last call to expire()).
+        uint64_t now() const;
+
+        // Get the number of milliseconds until the next timer might expire
+        // (at most `max`).
+        int timeout(int max) const;
+
+        // Get the number of armed timers.
+        size_t count() const;
+
+      private:
+        // Number of bits of the index of a slot.
+        static constexpr const unsigned bits = 6;
+
+        // Number of slots per level.
+        static constexpr const size_t slots = 1 << bits;
+
+        // Number of levels.
+        static constexpr const size_t levels = 4;
+
+        // Slots (each one is the head of a circular list).
+        timer _M_slots[levels][slots];
+
+        // Current time.
+        uint64_t _M_now = 0;
+
+        // Number of armed timers.
+        size_t _M_count = 0;
+
+        // Link the timer into the slot where it expires.
+        void insert(timer* t);
+
+        // Move the timers of a slot to the lower levels.
+        void cascade(size_t level);
+
+        // Disable copy constructor and assignment operator.
+        timers(const timers&) = delete;
+        timers& operator=(const timers&) = delete;
+    };
+
+    inline void timers::remove(timer* t)
+    {
+      // If the timer is armed...
+      if (t->next) {
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+
+        t->prev = nullptr;
+        t->next = nullptr;
+
+        _M_count--;
+      }
+    }
+
+    inline bool timers::armed(const timer* t)
+    {
+      return (t->next != nullptr);
+    }
+
+    inline uint64_t timers::now() const
+    {
+      return _M_now;
+    }
+
+    inline size_t timers::count() const
+    {
+      return _M_count;
+    }
+  }
+}
+
+#endif // NET_TCP_TIMERS_H
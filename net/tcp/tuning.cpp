@@ -0,0 +1,94 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "net/tcp/tuning.h"
+
+bool net::tcp::tuning::apply(int fd) const
+{
+  static const int on = 1;
+
+  // Size of the send buffer.
+  if ((sndbuf > 0) &&
+      (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(int)) != 0)) {
+    return false;
+  }
+
+  // Size of the receive buffer.
+  if ((rcvbuf > 0) &&
+      (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(int)) != 0)) {
+    return false;
+  }
+
+  // Disable Nagle's algorithm.
+  if ((nodelay) &&
+      (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int)) != 0)) {
+    return false;
+  }
+
+  // Hold the partial segments.
+  if ((cork) &&
+      (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(int)) != 0)) {
+    return false;
+  }
+
+  // Limit the data not sent yet in the socket.
+  if ((notsent_lowat > 0) &&
+      (setsockopt(fd,
+                  IPPROTO_TCP,
+                  TCP_NOTSENT_LOWAT,
+                  &notsent_lowat,
+                  sizeof(int)) != 0)) {
+    return false;
+  }
+
+  // Busy poll.
+  if ((busy_poll > 0) &&
+      (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(int)) !=
+       0)) {
+    return false;
+  }
+
+  // Keepalive.
+  if ((keepalive_idle > 0) &&
+      ((setsockopt(fd,
+                   IPPROTO_TCP,
+                   TCP_KEEPIDLE,
+                   &keepalive_idle,
+                   sizeof(int)) != 0) ||
+       (setsockopt(fd,
+                   IPPROTO_TCP,
+                   TCP_KEEPINTVL,
+                   &keepalive_interval,
+                   sizeof(int)) != 0) ||
+       (setsockopt(fd,
+                   IPPROTO_TCP,
+                   TCP_KEEPCNT,
+                   &keepalive_count,
+                   sizeof(int)) != 0) ||
+       (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(int)) != 0))) {
+    return false;
+  }
+
+  // Congestion control algorithm.
+  if ((congestion[0]) &&
+      (setsockopt(fd,
+                  IPPROTO_TCP,
+                  TCP_CONGESTION,
+                  congestion,
+                  strlen(congestion)) != 0)) {
+    return false;
+  }
+
+  return true;
+}
+
+bool net::tcp::tuning::flush(int fd)
+{
+  static const int off = 0;
+  static const int on = 1;
+
+  // Uncorking the socket sends the partial segments at once.
+  return ((setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(int)) == 0) &&
+          (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(int)) == 0));
+}
@@ -0,0 +1,59 @@
+#ifndef NET_TCP_TUNING_H
+#define NET_TCP_TUNING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace net {
+  namespace tcp {
+    // Tuning profile of the sockets of a listener or an upstream server (the
+    // options which are not set keep the defaults of the kernel).
+    // The connections accepted by a listening socket inherit its options.
+    // With `cork`, the upstream connections hold the partial segments until
+    // the end of the iteration of the event loop, so the data sent in the
+    // same iteration goes out in as few segments as possible.
+    struct tuning {
+      // Maximum length of the name of a congestion control algorithm
+      // (including the terminating null byte).
+      static constexpr const size_t congestion_size = 16;
+
+      // Size of the send and receive buffers (bytes; 0: default).
+      int sndbuf = 0;
+      int rcvbuf = 0;
+
+      // Send the segments as soon as possible (TCP_NODELAY)?
+      bool nodelay = false;
+
+      // Hold the partial segments until the end of the iteration of the
+      // event loop (TCP_CORK)?
+      bool cork = false;
+
+      // Maximum number of bytes not sent yet in the socket (the rest stays
+      // in the queue of the connection; 0: default).
+      int notsent_lowat = 0;
+
+      // Microseconds to busy poll the device queue when there is no data to
+      // receive (0: default).
+      int busy_poll = 0;
+
+      // Seconds without data before the first keepalive probe, seconds
+      // between probes and number of unanswered probes which close the
+      // connection (0: keepalive is not enabled).
+      int keepalive_idle = 0;
+      int keepalive_interval = 0;
+      int keepalive_count = 0;
+
+      // Congestion control algorithm (empty: default).
+      char congestion[congestion_size] = {};
+
+      // Set the options of the profile on the socket.
+      bool apply(int fd) const;
+
+      // Send the partial segments held by a corked socket (the socket stays
+      // corked).
+      static bool flush(int fd);
+    };
+  }
+}
+
+#endif // NET_TCP_TUNING_H
@@ -0,0 +1,241 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "net/tcp/upgrade.h"
+
+int net::tcp::upgrade::listen(const char* path)
+{
+  struct sockaddr_un addr;
+
+  // If the path is too long...
+  const size_t len = strlen(path);
+  if (len >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, len + 1);
+
+  // Create socket.
+  const int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+  // If the socket could be created...
+  if (fd != -1) {
+    // Remove the socket of the previous process (if any), bind and listen.
+    unlink(path);
+
+    if ((bind(fd,
+              reinterpret_cast<const struct sockaddr*>(&addr),
+              sizeof(struct sockaddr_un)) == 0) &&
+        (::listen(fd, 1) == 0)) {
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+int net::tcp::upgrade::accept(int listener)
+{
+  // Accept connection.
+  const int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+  // If the connection could be accepted...
+  if (fd != -1) {
+    if (timeouts(fd)) {
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+int net::tcp::upgrade::connect(const char* path)
+{
+  struct sockaddr_un addr;
+
+  // If the path is too long...
+  const size_t len = strlen(path);
+  if (len >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, len + 1);
+
+  // Create socket.
+  const int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+  // If the socket could be created...
+  if (fd != -1) {
+    // Connect.
+    if ((timeouts(fd)) &&
+        (::connect(fd,
+                   reinterpret_cast<const struct sockaddr*>(&addr),
+                   sizeof(struct sockaddr_un)) == 0)) {
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+bool net::tcp::upgrade::send(int sock, const header& hdr)
+{
+  return (::send(sock, &hdr, sizeof(header), MSG_NOSIGNAL) ==
+          static_cast<ssize_t>(sizeof(header)));
+}
+
+bool net::tcp::upgrade::receive(int sock, header& hdr)
+{
+  return ((recv(sock, &hdr, sizeof(header), 0) ==
+           static_cast<ssize_t>(sizeof(header))) &&
+          (hdr.magic == magic));
+}
+
+bool net::tcp::upgrade::send(int sock, const int* fds, size_t nfds)
+{
+  // Send the sockets in batches.
+  while (nfds > 0) {
+    const size_t n = (nfds < max_fds) ? nfds : max_fds;
+
+    union {
+      struct cmsghdr cmsg;
+      uint8_t buf[CMSG_SPACE(max_fds * sizeof(int))];
+    } control;
+
+    // The sockets are attached to the number of sockets of the batch.
+    uint32_t count = static_cast<uint32_t>(n);
+
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(uint32_t);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+
+    struct cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) !=
+        static_cast<ssize_t>(sizeof(uint32_t))) {
+      return false;
+    }
+
+    fds += n;
+    nfds -= n;
+  }
+
+  return true;
+}
+
+bool net::tcp::upgrade::receive(int sock, int* fds, size_t nfds)
+{
+  size_t received = 0;
+
+  // Receive the sockets in batches.
+  while (received < nfds) {
+    union {
+      struct cmsghdr cmsg;
+      uint8_t buf[CMSG_SPACE(max_fds * sizeof(int))];
+    } control;
+
+    uint32_t count;
+
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(uint32_t);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) !=
+        static_cast<ssize_t>(sizeof(uint32_t))) {
+      break;
+    }
+
+    // Get the sockets.
+    const struct cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+    if ((!cmsg) ||
+        (cmsg->cmsg_level != SOL_SOCKET) ||
+        (cmsg->cmsg_type != SCM_RIGHTS)) {
+      break;
+    }
+
+    const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    // If the batch is complete...
+    if ((n == count) &&
+        (n <= nfds - received) &&
+        ((msg.msg_flags & MSG_CTRUNC) == 0)) {
+      memcpy(fds + received, CMSG_DATA(cmsg), n * sizeof(int));
+      received += n;
+    } else {
+      // Close the sockets of the batch.
+      for (size_t i = 0; i < n; i++) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg) + (i * sizeof(int)), sizeof(int));
+        close(fd);
+      }
+
+      break;
+    }
+  }
+
+  // If not all the sockets have been received...
+  if (received < nfds) {
+    // Close the sockets received so far.
+    for (size_t i = 0; i < received; i++) {
+      close(fds[i]);
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+bool net::tcp::upgrade::acknowledge(int sock)
+{
+  const uint32_t ack = magic;
+  return (::send(sock, &ack, sizeof(uint32_t), MSG_NOSIGNAL) ==
+          static_cast<ssize_t>(sizeof(uint32_t)));
+}
+
+bool net::tcp::upgrade::acknowledged(int sock)
+{
+  uint32_t ack;
+  return ((recv(sock, &ack, sizeof(uint32_t), 0) ==
+           static_cast<ssize_t>(sizeof(uint32_t))) &&
+          (ack == magic));
+}
+
+bool net::tcp::upgrade::timeouts(int sock)
+{
+  struct timeval tv;
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+
+  return ((setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0) &&
+          (setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0));
+}
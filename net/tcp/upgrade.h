@@ -0,0 +1,77 @@
+#ifndef NET_TCP_UPGRADE_H
+#define NET_TCP_UPGRADE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace net {
+  namespace tcp {
+    // Binary upgrade: the old process hands its listening sockets over to the
+    // new process through a UNIX socket (SOCK_SEQPACKET, SCM_RIGHTS).
+    // The new process connects to the UNIX socket of the old process and
+    // receives a header followed by the sockets of each listening address
+    // (one per worker thread); once it has started, it acknowledges them and
+    // the old process stops accepting and drains its sessions.
+    class upgrade {
+      public:
+        // Magic number of the header.
+        static constexpr const uint32_t magic = 0x54435046; // "TCPF"
+
+        // Milliseconds to wait for the other process.
+        static constexpr const int timeout = 30 * 1000;
+
+        // Maximum number of sockets per message (SCM_MAX_FD is 253).
+        static constexpr const size_t max_fds = 250;
+
+        // Header.
+        struct header {
+          uint32_t magic;
+
+          // Number of worker threads.
+          uint32_t nworkers;
+
+          // Number of listening addresses.
+          uint32_t nlisteners;
+
+          // Event loop.
+          uint32_t loop;
+        };
+
+        // Listen on the UNIX socket `path` (old process; returns -1 on
+        // error).
+        static int listen(const char* path);
+
+        // Accept the connection of the new process (old process; returns -1
+        // on error).
+        static int accept(int listener);
+
+        // Connect to the UNIX socket `path` (new process; returns -1 on
+        // error).
+        static int connect(const char* path);
+
+        // Send the header.
+        static bool send(int sock, const header& hdr);
+
+        // Receive the header.
+        static bool receive(int sock, header& hdr);
+
+        // Send sockets.
+        static bool send(int sock, const int* fds, size_t nfds);
+
+        // Receive sockets.
+        static bool receive(int sock, int* fds, size_t nfds);
+
+        // Acknowledge the sockets (new process).
+        static bool acknowledge(int sock);
+
+        // Wait for the acknowledgement (old process).
+        static bool acknowledged(int sock);
+
+      private:
+        // Set the timeouts of the socket.
+        static bool timeouts(int sock);
+    };
+  }
+}
+
+#endif // NET_TCP_UPGRADE_H
@@ -0,0 +1,34 @@
+#include <new>
+#include "net/tcp/upstreams.h"
+
+net::tcp::upstreams::~upstreams()
+{
+  if (_M_sessions) {
+    delete [] _M_sessions;
+  }
+}
+
+bool net::tcp::upstreams::build(size_t nworkers)
+{
+  // Build the round-robin schedules and the hash rings.
+  if (_M_router.build(_M_addresses.count())) {
+    // Allocate the session counters of the worker threads.
+    if ((_M_sessions = new (std::nothrow) metrics::counter[nworkers]) !=
+        nullptr) {
+      _M_nworkers = nworkers;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+uint64_t net::tcp::upstreams::sessions() const
+{
+  uint64_t n = 0;
+  for (size_t i = 0; i < _M_nworkers; i++) {
+    n += _M_sessions[i].get();
+  }
+
+  return n;
+}
@@ -0,0 +1,181 @@
+#ifndef NET_TCP_UPSTREAMS_H
+#define NET_TCP_UPSTREAMS_H
+
+#include <stdint.h>
+#include <atomic>
+#include "net/socket/addresses.h"
+#include "net/tcp/configuration.h"
+#include "net/tcp/metrics.h"
+#include "net/tcp/router.h"
+#include "net/tcp/tuning.h"
+
+namespace net {
+  namespace tcp {
+    // List of upstream servers: their socket addresses and their router.
+    // Once it has been published to the worker threads it is not modified
+    // anymore (read-copy-update): when the upstream servers are reloaded, a
+    // new list is published and the worker threads switch to it on their
+    // next iteration; the sessions keep the list they were routed with, and
+    // the old list is freed when all the worker threads have switched and
+    // its sessions are over.
+    class upstreams {
+      public:
+        // Constructor.
+        upstreams() = default;
+
+        // Destructor.
+        ~upstreams();
+
+        // Get socket addresses.
+        socket::addresses& addresses();
+        const socket::addresses& addresses() const;
+
+        // Get router.
+        tcp::router& router();
+        const tcp::router& router() const;
+
+        // Get the tuning profile of the sockets of an upstream server.
+        const tcp::tuning& tuning(size_t idx) const;
+
+        // Set the tuning profile of the sockets of an upstream server.
+        bool tuning(size_t idx, const tcp::tuning& tuning);
+
+        // Start a group with the upstream servers added from now on.
+        bool group(routing_policy policy);
+
+        // Set the quorum of the last group.
+        bool quorum(size_t quorum);
+
+        // Prepare the list to be published: build the router and allocate
+        // the session counters of the worker threads.
+        bool build(size_t nworkers);
+
+        // Get the epoch in which the list was replaced (0: it is the current
+        // list).
+        uint64_t retired() const;
+
+        // Set the epoch in which the list was replaced.
+        void retired(uint64_t epoch);
+
+        // A session of the worker thread has been routed with this list.
+        void attach(size_t nworker) const;
+
+        // A session of the worker thread routed with this list is over.
+        void detach(size_t nworker) const;
+
+        // Get number of sessions routed with this list.
+        uint64_t sessions() const;
+
+        // Get next list (lists which have been replaced).
+        upstreams* next() const;
+
+        // Set next list.
+        void next(upstreams* next);
+
+      private:
+        // Socket addresses.
+        socket::addresses _M_addresses;
+
+        // Router.
+        tcp::router _M_router;
+
+        // Tuning profiles of the upstream servers.
+        tcp::tuning _M_tunings[metrics::max_upstreams];
+
+        // Epoch in which the list was replaced.
+        uint64_t _M_retired = 0;
+
+        // Number of sessions per worker thread (each counter is only
+        // modified by its worker thread).
+        metrics::counter* _M_sessions = nullptr;
+        size_t _M_nworkers = 0;
+
+        // Next list.
+        upstreams* _M_next = nullptr;
+
+        // Disable copy constructor and assignment operator.
+        upstreams(const upstreams&) = delete;
+        upstreams& operator=(const upstreams&) = delete;
+    };
+
+    inline socket::addresses& upstreams::addresses()
+    {
+      return _M_addresses;
+    }
+
+    inline const socket::addresses& upstreams::addresses() const
+    {
+      return _M_addresses;
+    }
+
+    inline tcp::router& upstreams::router()
+    {
+      return _M_router;
+    }
+
+    inline const tcp::router& upstreams::router() const
+    {
+      return _M_router;
+    }
+
+    inline const tcp::tuning& upstreams::tuning(size_t idx) const
+    {
+      return _M_tunings[idx];
+    }
+
+    inline bool upstreams::tuning(size_t idx, const tcp::tuning& tuning)
+    {
+      if (idx < metrics::max_upstreams) {
+        _M_tunings[idx] = tuning;
+        return true;
+      }
+
+      return false;
+    }
+
+    inline bool upstreams::group(routing_policy policy)
+    {
+      return _M_router.add_group(_M_addresses.count(), policy);
+    }
+
+    inline bool upstreams::quorum(size_t quorum)
+    {
+      return _M_router.quorum(_M_router.number_groups() - 1, quorum);
+    }
+
+    inline uint64_t upstreams::retired() const
+    {
+      return _M_retired;
+    }
+
+    inline void upstreams::retired(uint64_t epoch)
+    {
+      _M_retired = epoch;
+    }
+
+    inline void upstreams::attach(size_t nworker) const
+    {
+      _M_sessions[nworker].add();
+    }
+
+    inline void upstreams::detach(size_t nworker) const
+    {
+      // The list might be freed as soon as the counter drops to 0.
+      std::atomic_thread_fence(std::memory_order_release);
+
+      _M_sessions[nworker].sub();
+    }
+
+    inline upstreams* upstreams::next() const
+    {
+      return _M_next;
+    }
+
+    inline void upstreams::next(upstreams* next)
+    {
+      _M_next = next;
+    }
+  }
+}
+
+#endif // NET_TCP_UPSTREAMS_H
@@ -1,8 +1,11 @@
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <sys/resource.h>
 #include "net/tcp/forwarder.h"
 #include "net/tcp/connection.h"
+#include "net/tcp/health.h"
 
 net::tcp::forwarder::worker::~worker()
 {
@@ -12,47 +15,147 @@ net::tcp::forwarder::worker::~worker()
   if (_M_epollfd != -1) {
     close(_M_epollfd);
   }
-}
 
-bool net::tcp::forwarder::worker::listen(const char* address)
-{
-  return _M_listeners.listen(address);
-}
+  if (_M_routes) {
+    free(_M_routes);
+  }
 
-bool net::tcp::forwarder::worker::listen(const char* address, in_port_t port)
-{
-  return _M_listeners.listen(address, port);
+  if (_M_deferred) {
+    free(_M_deferred);
+  }
 }
 
-bool net::tcp::forwarder::worker::listen(const char* address,
-                                         in_port_t minport,
-                                         in_port_t maxport)
+bool net::tcp::forwarder::worker::start(size_t nworker,
+                                        const configuration* config,
+                                        const forwarder* forwarder,
+                                        string::budget* budget,
+                                        tcp::health* health,
+                                        const cpu_set_t* cpus,
+                                        idle_t idle,
+                                        void* user)
 {
-  return _M_listeners.listen(address, minport, maxport);
-}
+  // Index the routing policies of the listeners by file descriptor.
+  for (size_t i = 0; i < forwarder->_M_nlisteners; i++) {
+    const listener& l = forwarder->_M_listeners[i];
 
-bool net::tcp::forwarder::worker::listen(const struct sockaddr& addr,
-                                         socklen_t addrlen)
-{
-  return _M_listeners.listen(addr, addrlen);
-}
+    if (!route(l.fds[nworker], l.routing)) {
+      return false;
+    }
+  }
 
-bool net::tcp::forwarder::worker::listen(const socket::address& addr)
-{
-  return _M_listeners.listen(addr);
-}
+  // Start with the current list of upstream servers.
+  const tcp::upstreams* const upstreams = forwarder->current();
 
-bool
-net::tcp::forwarder::worker::start(size_t nworker,
-                                   const socket::addresses* upstream_addresses,
-                                   idle_t idle,
-                                   void* user)
-{
-  // Open epoll file descriptor.
-  _M_epollfd = epoll_create1(0);
+  _M_epoch = forwarder->epoch();
+  _M_connections.metrics().epoch.set(_M_epoch);
+  _M_connections.upstreams(upstreams);
+
+  _M_connections.nworker(nworker);
+  _M_connections.config(config);
+
+  // Skip the upstream servers which are known to be down (if the circuit
+  // breakers can open).
+  if (health->threshold() > 0) {
+    _M_connections.health(health);
+  }
+
+  // Seed the random number generator (it must not be 0).
+  _M_random = 0x9e3779b97f4a7c15ull * (nworker + 1);
+
+  // If the worker thread is pinned...
+  if (cpus) {
+    // Get the first CPU of the worker.
+    unsigned cpu = 0;
+    while (!CPU_ISSET(cpu, cpus)) {
+      cpu++;
+    }
+
+    // Allocate the connections and the chunks on the NUMA node of the CPU.
+    _M_connections.node(os::cpus::node(cpu));
+
+    // If the worker thread runs on a single CPU, the kernel should steer the
+    // connections received on that CPU to the listeners of this worker
+    // (it is not an error if it cannot be set).
+    if (CPU_COUNT(cpus) == 1) {
+      _M_listeners.incoming_cpu(static_cast<int>(cpu));
+    }
+  }
+
+  // The number of connections is limited by the share of the worker of the
+  // maximum number of open files.
+  size_t max_connections = SIZE_MAX;
+
+  struct rlimit rlim;
+  if ((getrlimit(RLIMIT_NOFILE, &rlim) == 0) &&
+      (rlim.rlim_cur != RLIM_INFINITY)) {
+    // Set aside the file descriptors of the process, the listeners of all
+    // the workers and the sockets of the health checks.
+    const size_t reserved = reserved_files +
+                            (forwarder->_M_nlisteners *
+                             forwarder->_M_nworkers) +
+                            forwarder->number_slots();
+
+    size_t files = (static_cast<size_t>(rlim.rlim_cur) > reserved) ?
+                     (static_cast<size_t>(rlim.rlim_cur) - reserved) /
+                     forwarder->_M_nworkers :
+                     0;
+
+    // Set aside the file descriptors of the worker (and its spill files).
+    const size_t nworkerfiles = worker_files +
+                                ((config->spill_dir) ?
+                                   forwarder->number_slots() :
+                                   0);
+
+    files = (files > nworkerfiles) ? files - nworkerfiles : 0;
+
+    // With splice()/tee(), each connection also has a pipe.
+    max_connections = (config->splice) ? files / 3 : files;
+  }
+
+  if ((config->max_connections > 0) &&
+      (config->max_connections < max_connections)) {
+    max_connections = config->max_connections;
+  }
+
+  // Set the limits of the pool of connections.
+  _M_connections.limits(max_connections, config->connections_memory);
+
+  // Charge the chunks to the memory budget shared by the worker threads.
+  _M_connections.chunks().budget(budget);
+
+  // If the data which doesn't fit in the buffers of the client connections
+  // has to be spilled to disk (the channels of the multiplexer don't
+  // spill)...
+  if ((config->spill_dir) && (config->multiplex == 0)) {
+    // Create the spill queues of the upstream servers.
+    if (!_M_connections.spill(config->spill_dir,
+                              config->spill_size,
+                              forwarder->number_slots())) {
+      return false;
+    }
+  }
+
+  // If the data has to be forwarded with splice()/tee(), open /dev/null
+  // (where the data which has been duplicated is discarded).
+  if ((config->splice) && (!_M_connections.open_devnull())) {
+    return false;
+  }
+
+  // If the worker uses io_uring...
+  if (config->loop == event_loop::io_uring) {
+    // Set up io_uring.
+    if (!setup_uring()) {
+      return false;
+    }
+  } else {
+    // Open epoll file descriptor.
+    _M_epollfd = epoll_create1(0);
+
+    // If the epoll file descriptor couldn't be opened...
+    if (_M_epollfd == -1) {
+      return false;
+    }
 
-  // If the epoll file descriptor could be opened...
-  if (_M_epollfd != -1) {
     // Register listeners on the epoll instance.
     int fd;
     for (size_t i = 0; (fd = _M_listeners.fd(i)) != -1; i++) {
@@ -69,26 +172,57 @@ net::tcp::forwarder::worker::start(size_t nworker,
       }
     }
 
-    // Save worker number.
-    _M_nworker = nworker;
+    // The connections modify their events when their sessions are paused.
+    _M_connections.epollfd(_M_epollfd);
+
+    // If the sessions have to be multiplexed...
+    if (config->multiplex > 0) {
+      // Initialize multiplexer.
+      if (!_M_multiplexer.init(_M_epollfd, upstreams, config)) {
+        return false;
+      }
+
+      _M_connections.multiplexer(&_M_multiplexer);
+    }
+  }
+
+  // Save worker number.
+  _M_nworker = nworker;
+
+  // Spread the round-robin schedules among the workers.
+  seed_cursors();
 
-    // Save socket addresses of the upstream servers.
-    _M_upstream_addresses = upstream_addresses;
+  // Save configuration.
+  _M_config = config;
 
-    // Save idle callback.
-    _M_idle = idle;
+  // Save forwarder.
+  _M_forwarder = forwarder;
 
-    // Save pointer to user data.
-    _M_user = user;
+  // Save idle callback.
+  _M_idle = idle;
 
-    // Start thread.
-    if (pthread_create(&_M_thread, nullptr, run, this) == 0) {
+  // Save pointer to user data.
+  _M_user = user;
+
+  pthread_attr_t attr;
+  if (pthread_attr_init(&attr) == 0) {
+    // If the thread has to be pinned, set its affinity before creating it (so
+    // the memory it touches first is allocated on its NUMA node).
+    if ((!cpus) ||
+        (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus) == 0)) {
+      // Start thread (the flag has to be set before the thread checks it:
+      // the first wait might return at once).
       _M_running = true;
-      return true;
+
+      if (pthread_create(&_M_thread, &attr, run, this) != 0) {
+        _M_running = false;
+      }
     }
+
+    pthread_attr_destroy(&attr);
   }
 
-  return false;
+  return _M_running;
 }
 
 void net::tcp::forwarder::worker::stop()
@@ -97,26 +231,57 @@ void net::tcp::forwarder::worker::stop()
   if (_M_running) {
     _M_running = false;
     pthread_join(_M_thread, nullptr);
+
+    // Process the commands which have been posted after the last iteration
+    // (the listeners are closed with the worker).
+    process_commands();
+  }
+}
+
+bool net::tcp::forwarder::worker::post(const command& cmd)
+{
+  const size_t tail = _M_tail.load(std::memory_order_relaxed);
+
+  // If the mailbox is full...
+  if (tail - _M_head.load(std::memory_order_acquire) == max_commands) {
+    return false;
   }
+
+  _M_commands[tail % max_commands] = cmd;
+
+  // Publish the command.
+  _M_tail.store(tail + 1, std::memory_order_release);
+
+  return true;
 }
 
 void* net::tcp::forwarder::worker::run(void* arg)
 {
-  static_cast<worker*>(arg)->run();
+  worker* const w = static_cast<worker*>(arg);
+
+  // If the worker uses io_uring...
+  if (w->_M_config->loop == event_loop::io_uring) {
+    w->run_uring();
+  } else {
+    w->run();
+  }
+
   return nullptr;
 }
 
 void net::tcp::forwarder::worker::run()
 {
-  static constexpr const int timeout = 250; // Milliseconds.
-  static constexpr const int
-    maxevents = static_cast<int>(connections::max_connections);
-
   do {
-    struct epoll_event events[maxevents];
+    struct epoll_event events[max_events];
+
+    // Wait for event (until the next timer expires).
+    const int ret = epoll_wait(_M_epollfd,
+                               events,
+                               max_events,
+                               _M_connections.timeout(max_wait));
 
-    // Wait for event.
-    const int ret = epoll_wait(_M_epollfd, events, maxevents, timeout);
+    // Close the connections whose timeout has expired.
+    _M_connections.timeouts();
 
     switch (ret) {
       default: // At least one event was returned.
@@ -136,9 +301,210 @@ void net::tcp::forwarder::worker::run()
 
         break;
     }
+
+    // Close the client connections which have been stalled for too long.
+    if (_M_config->backpressure == backpressure_policy::drop_after_timeout) {
+      _M_connections.expire(_M_config->backpressure_timeout);
+    }
+
+    // Switch to the current list of upstream servers (if it has been
+    // replaced).
+    refresh();
+
+    // Add and remove listeners.
+    process_commands();
   } while (_M_running);
 }
 
+void net::tcp::forwarder::worker::refresh()
+{
+  // If the list of upstream servers hasn't been replaced...
+  const uint64_t epoch = _M_forwarder->epoch();
+  if (epoch == _M_epoch) {
+    return;
+  }
+
+  const tcp::upstreams* const upstreams = _M_forwarder->current();
+
+  // Reset the counters and the spill queues of the slots which have been
+  // freed (and maybe given to other upstream servers) since the last switch.
+  const size_t nslots = _M_forwarder->number_slots();
+  for (size_t i = 0; i < nslots; i++) {
+    const uint64_t version =
+      _M_forwarder->_M_slots[i].version.load(std::memory_order_relaxed);
+
+    if (version != _M_versions[i]) {
+      _M_connections.reset(i);
+      _M_versions[i] = version;
+    }
+  }
+
+  // Create the spill queues of the new upstream servers (if the file of a
+  // spill queue cannot be created, the data of the upstream server is not
+  // spilled).
+  if (_M_config->spill_dir) {
+    _M_connections.spill(_M_config->spill_dir,
+                         _M_config->spill_size,
+                         nslots);
+  }
+
+  // The new sessions are routed with the new list (the round-robin schedules
+  // of the new list start from the position of the worker).
+  _M_connections.upstreams(upstreams);
+  seed_cursors();
+
+  _M_epoch = epoch;
+
+  // Publish the epoch (the old list is not accessed anymore).
+  std::atomic_thread_fence(std::memory_order_release);
+  _M_connections.metrics().epoch.set(epoch);
+}
+
+void net::tcp::forwarder::worker::seed_cursors()
+{
+  const tcp::router& router = _M_connections.upstreams()->router();
+
+  // Each worker starts at a different position of the round-robin schedules
+  // (otherwise the first sessions of all the workers would go to the same
+  // upstream server).
+  for (size_t i = 0; i < router::max_groups; i++) {
+    _M_cursors[i] = ((i < router.number_groups()) &&
+                     (router.schedule_length(i) > 0)) ?
+                      _M_nworker % router.schedule_length(i) :
+                      0;
+  }
+}
+
+void net::tcp::forwarder::worker::process_commands()
+{
+  size_t head = _M_head.load(std::memory_order_relaxed);
+  const size_t tail = _M_tail.load(std::memory_order_acquire);
+
+  // For each command...
+  for (; head != tail; head++) {
+    const command& cmd = _M_commands[head % max_commands];
+
+    switch (cmd.type) {
+      case command::kind::add:
+        add_listener(cmd.fd, cmd.routing);
+        break;
+      case command::kind::remove:
+        remove_listener(cmd.fd);
+        break;
+      case command::kind::drain:
+        _M_connections.drain();
+
+        // Release the connections of the sessions which have been closed.
+        _M_connections.release_temporary();
+
+        // Publish the load of the worker.
+        publish_load();
+
+        break;
+    }
+  }
+
+  // Release the entries of the mailbox.
+  _M_head.store(head, std::memory_order_release);
+}
+
+void net::tcp::forwarder::worker::add_listener(int fd, routing_policy routing)
+{
+  // If the worker uses io_uring...
+  if (_M_config->loop == event_loop::io_uring) {
+    // The listener has to be blocking.
+    const int flags = fcntl(fd, F_GETFL);
+    if ((flags != -1) &&
+        (fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) != -1) &&
+        (route(fd, routing)) &&
+        (_M_listeners.add(fd))) {
+      if (reserve_deferred()) {
+        // Start accepting.
+        accept_next(fd);
+        return;
+      }
+
+      _M_listeners.remove(fd);
+      return;
+    }
+  } else if ((route(fd, routing)) && (_M_listeners.add(fd))) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = fd;
+
+    // Register the listener on the epoll instance.
+    if (epoll_ctl(_M_epollfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+      if (static_cast<uint64_t>(fd) > _M_maxlistener) {
+        _M_maxlistener = static_cast<uint64_t>(fd);
+      }
+
+      return;
+    }
+
+    _M_listeners.remove(fd);
+    return;
+  }
+
+  close(fd);
+}
+
+void net::tcp::forwarder::worker::remove_listener(int fd)
+{
+  // If the worker uses io_uring...
+  if (_M_config->loop == event_loop::io_uring) {
+    // Cancel the accept operation (the listening socket might be shared with
+    // another process, so closing it doesn't cancel it).
+    struct io_uring_sqe* const sqe = _M_ring.get_sqe();
+
+    if (sqe) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = (static_cast<uint64_t>(fd) << 3) | connection::op_accept;
+      sqe->user_data = connection::op_cancel;
+    }
+  } else {
+    // Unregister the listener (the listening socket might be shared with
+    // another process, so closing it doesn't unregister it).
+    epoll_ctl(_M_epollfd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+
+  _M_listeners.remove(fd);
+
+  // Forget the deferred accept operation of the listener (if any).
+  for (size_t i = 0; i < _M_ndeferred; i++) {
+    if (_M_deferred[i] == fd) {
+      _M_deferred[i] = _M_deferred[--_M_ndeferred];
+      break;
+    }
+  }
+}
+
+bool net::tcp::forwarder::worker::route(int listener, routing_policy routing)
+{
+  // If the routing policies have to be reallocated...
+  const size_t fd = static_cast<size_t>(listener);
+  if (fd >= _M_nroutes) {
+    const size_t nroutes = fd + 1;
+
+    routing_policy* const routes = static_cast<routing_policy*>(
+                                     realloc(_M_routes,
+                                             nroutes *
+                                             sizeof(routing_policy))
+                                   );
+
+    if (!routes) {
+      return false;
+    }
+
+    _M_routes = routes;
+    _M_nroutes = nroutes;
+  }
+
+  _M_routes[fd] = routing;
+
+  return true;
+}
+
 void net::tcp::forwarder::worker::process_events(struct epoll_event* events,
                                                  size_t nevents)
 {
@@ -157,8 +523,19 @@ void net::tcp::forwarder::worker::process_events(struct epoll_event* events,
     }
   }
 
+  // If the records of the sessions are aggregated, send them.
+  if ((_M_config->multiplex > 0) && (_M_config->aggregate)) {
+    _M_multiplexer.flush();
+  }
+
+  // Send the partial segments held by the corked connections.
+  _M_connections.flush();
+
   // Release temporary connections.
   _M_connections.release_temporary();
+
+  // Publish the load of the worker.
+  publish_load();
 }
 
 void net::tcp::forwarder::worker::accept(int listener)
@@ -169,6 +546,8 @@ void net::tcp::forwarder::worker::accept(int listener)
 
     // If the connection could be accepted...
     if (fd != -1) {
+      _M_connections.metrics().accepted.add();
+
       // Get new connection.
       connection* const conn = _M_connections.pop();
 
@@ -182,8 +561,20 @@ void net::tcp::forwarder::worker::accept(int listener)
           // Initialize connection.
           conn->init(fd);
 
+          // New session.
+          _M_connections.metrics().active.add();
+
+          // Arm the idle timeout.
+          conn->arm();
+
+          // If the data has to be forwarded with splice()/tee(), open pipe
+          // (if the pipe cannot be opened, the data is received with recv()).
+          if (_M_config->splice) {
+            conn->open_pipe();
+          }
+
           // Connect to the upstream servers.
-          if (!connect_upstream_servers(conn)) {
+          if (!connect_upstream_servers(conn, listener)) {
             // Remove server connection.
             conn->remove_server();
           }
@@ -195,6 +586,9 @@ void net::tcp::forwarder::worker::accept(int listener)
           close(fd);
         }
       } else {
+        // The limits of the pool of connections have been reached.
+        _M_connections.metrics().rejected.add();
+
         // Close socket.
         close(fd);
       }
@@ -213,65 +607,501 @@ void net::tcp::forwarder::worker::process(uint32_t events, connection* conn)
   }
 }
 
-bool net::tcp::forwarder::worker::connect_upstream_servers(connection* conn)
+void net::tcp::forwarder::worker::route(int listener,
+                                         int fd,
+                                         upstream_set& upstreams)
 {
-  size_t nclients = 0;
+  const tcp::router& router = _M_connections.upstreams()->router();
 
-  const socket::address* address;
-  for (size_t i = 0;
-       (address = _M_upstream_addresses->address(i)) != nullptr;
-       i++) {
-    const struct sockaddr& addr = static_cast<const struct sockaddr&>(*address);
+  const routing_policy listener_policy =
+    ((listener >= 0) && (static_cast<size_t>(listener) < _M_nroutes)) ?
+      _M_routes[listener] :
+      routing_policy::broadcast;
 
-    // Create socket.
-    const int fd = ::socket(addr.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  upstreams.clear();
 
-    // If the socket could be created...
-    if (fd != -1) {
-      // Connect to the upstream server.
-      do {
-        if ((connect(fd, &addr, address->length()) == 0) ||
-            (errno == EINPROGRESS)) {
-          // Get new connection.
-          connection* const client = _M_connections.pop();
-
-          if (client) {
-            struct epoll_event ev;
-            ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
-            ev.data.ptr = client;
-
-            // Add connection to the epoll file descriptor.
-            if (epoll_ctl(_M_epollfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
-              // Initialize client connection.
-              client->init(fd);
-
-              // Add client connection.
-              conn->add_client(client);
-
-              // Increment number of client connections.
-              nclients++;
-            } else {
-              // Return connection to the pool.
-              _M_connections.push(client);
-
-              // Close socket.
-              close(fd);
+  // If the upstream servers which are known to be down have to be skipped,
+  // get the current time.
+  const uint64_t now = (_M_connections.health()) ? connections::now() : 0;
+
+  struct sockaddr_storage addr;
+  int peer = 0;
+
+  // For each group of upstream servers...
+  for (size_t i = 0; i < router.number_groups(); i++) {
+    // Get the routing policy of the group.
+    routing_policy policy;
+    if (!router.policy(i, policy)) {
+      policy = listener_policy;
+    }
+
+    switch (policy) {
+      case routing_policy::broadcast:
+        // If the upstream servers which are known to be down don't have to
+        // be skipped...
+        if (!_M_connections.health()) {
+          upstreams.add(router.first(i), router.size(i));
+        } else {
+          // Add the upstream servers of the group which are available.
+          for (size_t j = router.first(i);
+               j < router.first(i) + router.size(i);
+               j++) {
+            if (_M_connections.health()->available(router.slot(j), now)) {
+              upstreams.add(j);
             }
-          } else {
-            // Close socket.
-            close(fd);
           }
+        }
 
-          break;
-        } else if (errno != EINTR) {
-          // Close socket.
-          close(fd);
+        break;
+      case routing_policy::round_robin:
+        route(i, router.round_robin(i, _M_cursors[i]), now, upstreams);
+        break;
+      case routing_policy::least_pending:
+        route(i,
+              router.least_pending(i, _M_connections.metrics(), random()),
+              now,
+              upstreams);
+
+        break;
+      case routing_policy::hash:
+        // If the address of the client hasn't been got yet...
+        if (peer == 0) {
+          socklen_t addrlen = sizeof(struct sockaddr_storage);
 
-          break;
+          peer = (getpeername(fd,
+                              reinterpret_cast<struct sockaddr*>(&addr),
+                              &addrlen) == 0) ? 1 : -1;
+        }
+
+        if (peer == 1) {
+          route(i,
+                reinterpret_cast<const struct sockaddr&>(addr),
+                now,
+                upstreams);
+        } else {
+          route(i, router.round_robin(i, _M_cursors[i]), now, upstreams);
         }
-      } while (true);
+
+        break;
+    }
+  }
+}
+
+void net::tcp::forwarder::worker::route(size_t group,
+                                         size_t idx,
+                                         uint64_t now,
+                                         upstream_set& upstreams)
+{
+  // If the upstream servers which are known to be down don't have to be
+  // skipped...
+  tcp::health* const health = _M_connections.health();
+  if (!health) {
+    upstreams.add(idx);
+    return;
+  }
+
+  const tcp::router& router = _M_connections.upstreams()->router();
+
+  const size_t first = router.first(group);
+  const size_t size = router.size(group);
+
+  // Try the upstream servers of the group, starting from `idx`.
+  for (size_t i = 0; i < size; i++) {
+    const size_t upstream = first + ((idx - first + i) % size);
+
+    if (health->available(router.slot(upstream), now)) {
+      upstreams.add(upstream);
+      return;
+    }
+  }
+}
+
+void net::tcp::forwarder::worker::route(size_t group,
+                                         const struct sockaddr& addr,
+                                         uint64_t now,
+                                         upstream_set& upstreams)
+{
+  const tcp::router& router = _M_connections.upstreams()->router();
+
+  size_t point;
+  size_t upstream = router.hash(group, addr, point);
+
+  // If the upstream servers which are known to be down don't have to be
+  // skipped...
+  tcp::health* const health = _M_connections.health();
+  if (!health) {
+    upstreams.add(upstream);
+    return;
+  }
+
+  // Upstream servers of the group which have been found to be down.
+  upstream_set down;
+  down.clear();
+  size_t ndown = 0;
+
+  // Walk the hash ring from the point of the client address (the sessions of
+  // an upstream server which is down are spread as if it had been removed
+  // from the ring, the rest keep their upstream servers).
+  do {
+    if (!down.contains(upstream)) {
+      if (health->available(router.slot(upstream), now)) {
+        upstreams.add(upstream);
+        return;
+      }
+
+      // If all the upstream servers of the group are down...
+      if (++ndown == router.size(group)) {
+        return;
+      }
+
+      down.add(upstream);
+    }
+
+    upstream = router.next_point(group, point);
+  } while (true);
+}
+
+uint64_t net::tcp::forwarder::worker::random()
+{
+  _M_random ^= _M_random >> 12;
+  _M_random ^= _M_random << 25;
+  _M_random ^= _M_random >> 27;
+
+  return _M_random * 0x2545f4914f6cdd1dull;
+}
+
+bool net::tcp::forwarder::worker::connect_upstream_servers(connection* conn,
+                                                           int listener)
+{
+  // Choose the upstream servers.
+  upstream_set upstreams;
+  route(listener, conn->fd(), upstreams);
+
+  // If the sessions are multiplexed...
+  if (_M_connections.multiplexer()) {
+    // Open the session on the channels.
+    return _M_connections.multiplexer()->open(conn, upstreams);
+  }
+
+  // The session is routed with the current list of upstream servers (it
+  // cannot be freed until the session is over).
+  const tcp::upstreams* const list = _M_connections.upstreams();
+  conn->upstreams(list);
+
+  const tcp::router& router = list->router();
+
+  size_t nclients = 0;
+
+  const socket::address* address;
+  for (size_t i = 0; (address = list->addresses().address(i)) != nullptr; i++) {
+    // If the session is not routed to this upstream server...
+    if (!upstreams.contains(i)) {
+      continue;
+    }
+
+    // Connect to the upstream server.
+    if (conn->open_client(*address,
+                          router.slot(i),
+                          router.group(i),
+                          list->tuning(i))) {
+      // Increment number of client connections.
+      nclients++;
+    }
+  }
+
+  // The session has to be forwarded to the quorum of each group.
+  return ((nclients > 0) && (conn->quorum()));
+}
+
+bool net::tcp::forwarder::worker::setup_uring()
+{
+  // Create io_uring instance.
+  if (_M_ring.init(uring_entries, uring_cq_entries)) {
+    // Register a sparse file table (the index of each socket in the table is
+    // the socket descriptor).
+    struct rlimit rlim;
+    if ((getrlimit(RLIMIT_NOFILE, &rlim) == 0) && (rlim.rlim_cur > 0)) {
+      _M_ring.register_files((rlim.rlim_cur < uring_files) ?
+                               static_cast<unsigned>(rlim.rlim_cur) :
+                               uring_files);
+    }
+
+    // Allocate chunks in a single memory region and register it, so the data
+    // can be received with IORING_OP_READ_FIXED (it is not an error if the
+    // buffer cannot be registered, e.g. because of RLIMIT_MEMLOCK).
+    struct iovec iov;
+    if ((_M_connections.chunks().reserve(uring_chunks,
+                                         connection::uring_read_size)) &&
+        (_M_connections.chunks().arena(iov))) {
+      _M_ring.register_buffers(&iov, 1);
+    }
+
+    // The listeners have to be blocking (io_uring takes care of not
+    // blocking).
+    int fd;
+    for (size_t i = 0; (fd = _M_listeners.fd(i)) != -1; i++) {
+      const int flags = fcntl(fd, F_GETFL);
+      if ((flags == -1) || (fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1)) {
+        return false;
+      }
+    }
+
+    // Make room for deferring the accept operations.
+    if (!reserve_deferred()) {
+      return false;
+    }
+
+    // Make the connections use the io_uring instance.
+    _M_connections.ring(&_M_ring);
+
+    return true;
+  }
+
+  return false;
+}
+
+void net::tcp::forwarder::worker::run_uring()
+{
+  // Submit an accept operation for each listener.
+  int fd;
+  for (size_t i = 0; (fd = _M_listeners.fd(i)) != -1; i++) {
+    if (!submit_accept(fd)) {
+      return;
+    }
+  }
+
+  do {
+    // Submit the operations prepared in the previous iteration (all of them
+    // with a single system call) and wait for completions (until the next
+    // timer expires).
+    if (!_M_ring.submit_and_wait(1, _M_connections.timeout(max_wait))) {
+      return;
+    }
+
+    // Queue the accept operations which didn't fit in the submission queue
+    // (it has just been emptied).
+    submit_deferred();
+
+    // Close the connections whose timeout has expired.
+    _M_connections.timeouts();
+
+    size_t ncompletions = 0;
+
+    // Process completions.
+    const struct io_uring_cqe* cqe;
+    while ((cqe = _M_ring.peek()) != nullptr) {
+      const uint64_t user_data = cqe->user_data;
+      const int res = cqe->res;
+
+      _M_ring.seen();
+
+      complete(user_data, res);
+
+      ncompletions++;
+    }
+
+    // If no completions were returned (timeout)...
+    if (ncompletions == 0) {
+      if (_M_idle) {
+        _M_idle(_M_nworker, _M_user);
+      }
+    } else {
+      // Send the partial segments held by the corked connections.
+      _M_connections.flush();
+
+      // Release temporary connections.
+      _M_connections.release_temporary();
+
+      // Publish the load of the worker.
+      publish_load();
+    }
+
+    // Close the client connections which have been stalled for too long.
+    if (_M_config->backpressure == backpressure_policy::drop_after_timeout) {
+      _M_connections.expire(_M_config->backpressure_timeout);
+    }
+
+    // Switch to the current list of upstream servers (if it has been
+    // replaced).
+    refresh();
+
+    // Add and remove listeners.
+    process_commands();
+  } while (_M_running);
+}
+
+bool net::tcp::forwarder::worker::submit_accept(int listener)
+{
+  struct io_uring_sqe* const sqe = _M_ring.get_sqe();
+
+  if (sqe) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener;
+    sqe->user_data = (static_cast<uint64_t>(listener) << 3) |
+                     connection::op_accept;
+
+    return true;
+  }
+
+  return false;
+}
+
+void net::tcp::forwarder::worker::accept_next(int listener)
+{
+  // If the submission queue is full...
+  if (!submit_accept(listener)) {
+    // Defer the accept operation (unless it is already deferred).
+    for (size_t i = 0; i < _M_ndeferred; i++) {
+      if (_M_deferred[i] == listener) {
+        return;
+      }
+    }
+
+    // There is room for all the listeners.
+    if (_M_ndeferred < _M_deferredsize) {
+      _M_deferred[_M_ndeferred++] = listener;
+    }
+  }
+}
+
+void net::tcp::forwarder::worker::submit_deferred()
+{
+  while (_M_ndeferred > 0) {
+    // If the accept operation couldn't be submitted...
+    if (!submit_accept(_M_deferred[_M_ndeferred - 1])) {
+      return;
     }
+
+    _M_ndeferred--;
   }
+}
+
+bool net::tcp::forwarder::worker::reserve_deferred()
+{
+  // If there is already room for all the listeners...
+  const size_t count = _M_listeners.count();
+  if (count <= _M_deferredsize) {
+    return true;
+  }
+
+  int* const deferred = static_cast<int*>(
+                          realloc(_M_deferred, count * sizeof(int))
+                        );
+
+  if (deferred) {
+    _M_deferred = deferred;
+    _M_deferredsize = count;
+
+    return true;
+  }
+
+  return false;
+}
+
+void net::tcp::forwarder::worker::complete(uint64_t user_data, int res)
+{
+  switch (const unsigned op = user_data & connection::op_mask) {
+    case connection::op_accept:
+      // If the connection could be accepted...
+      if (res >= 0) {
+        // Process accepted connection.
+        accepted(res, static_cast<int>(user_data >> 3));
+
+        // Accept next connection (unless the listener has been removed).
+        if (_M_listeners.contains(static_cast<int>(user_data >> 3))) {
+          accept_next(static_cast<int>(user_data >> 3));
+        }
+      } else if ((res == -EINTR) || (res == -ECONNABORTED)) {
+        // Accept next connection (unless the listener has been removed: the
+        // accept operation might have been interrupted by its cancellation).
+        if (_M_listeners.contains(static_cast<int>(user_data >> 3))) {
+          accept_next(static_cast<int>(user_data >> 3));
+        }
+      } else if (res != -ECANCELED) {
+        // Retry later (e.g. EMFILE).
+        static const struct __kernel_timespec
+          ts = {0, uring_accept_retry * 1000000L};
+
+        struct io_uring_sqe* const sqe = _M_ring.get_sqe();
+
+        if (sqe) {
+          sqe->opcode = IORING_OP_TIMEOUT;
+          sqe->fd = -1;
+          sqe->addr = reinterpret_cast<uint64_t>(&ts);
+          sqe->len = 1;
+          sqe->user_data = (user_data & ~static_cast<uint64_t>(
+                                           connection::op_mask
+                                         )) |
+                           connection::op_retry;
+        } else {
+          // Accept again after the next submission.
+          accept_next(static_cast<int>(user_data >> 3));
+        }
+      }
 
-  return (nclients > 0);
+      break;
+    case connection::op_retry:
+      // Accept next connection (unless the listener has been removed).
+      if (_M_listeners.contains(static_cast<int>(user_data >> 3))) {
+        accept_next(static_cast<int>(user_data >> 3));
+      }
+
+      break;
+    default:
+      {
+        connection* const
+          conn = reinterpret_cast<connection*>(
+                   user_data & ~static_cast<uint64_t>(connection::op_mask)
+                 );
+
+        // If the completion belongs to a connection...
+        if (conn) {
+          conn->complete(op, res);
+        }
+      }
+  }
+}
+
+void net::tcp::forwarder::worker::accepted(int fd, int listener)
+{
+  // If the sessions are being drained (the listener has been removed, but
+  // the accept operation completed before it was cancelled)...
+  if (_M_connections.draining()) {
+    close(fd);
+    return;
+  }
+
+  _M_connections.metrics().accepted.add();
+
+  // Get new connection.
+  connection* const conn = _M_connections.pop();
+
+  if (conn) {
+    // Initialize connection.
+    conn->init(fd);
+
+    // New session.
+    _M_connections.metrics().active.add();
+
+    // Arm the idle timeout.
+    conn->arm();
+
+    // Start receiving.
+    if (conn->receive()) {
+      // Connect to the upstream servers.
+      if (!connect_upstream_servers(conn, listener)) {
+        // Remove server connection.
+        conn->remove_server();
+      }
+    } else {
+      // Remove server connection.
+      conn->remove_server();
+    }
+  } else {
+    // The limits of the pool of connections have been reached.
+    _M_connections.metrics().rejected.add();
+
+    // Close socket.
+    close(fd);
+  }
 }
@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include "os/cpus.h"
+
+static bool read_file(const char* filename, char* buf, size_t size);
+
+bool os::cpus::load()
+{
+  // Get the affinity mask of the process.
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &_M_mask) == 0) {
+    _M_count = 0;
+
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &_M_mask)) {
+        _M_cpus[_M_count++] = static_cast<uint16_t>(cpu);
+      }
+    }
+
+    // Get the CPU quota.
+    _M_quota = quota();
+
+    return (_M_count > 0);
+  }
+
+  return false;
+}
+
+bool os::cpus::intersect(const cpu_set_t& set)
+{
+  cpu_set_t mask;
+  CPU_AND(&mask, &_M_mask, &set);
+
+  // If some CPUs would be left...
+  if (CPU_COUNT(&mask) > 0) {
+    _M_mask = mask;
+    _M_count = 0;
+
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &_M_mask)) {
+        _M_cpus[_M_count++] = static_cast<uint16_t>(cpu);
+      }
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+int os::cpus::node(unsigned cpu)
+{
+  char dirname[64];
+  snprintf(dirname, sizeof(dirname), "/sys/devices/system/cpu/cpu%u", cpu);
+
+  // The directory of the CPU contains a link "node<n>".
+  DIR* const dir = opendir(dirname);
+  if (dir) {
+    int node = -1;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if ((strncmp(entry->d_name, "node", 4) == 0) &&
+          (entry->d_name[4] >= '0') &&
+          (entry->d_name[4] <= '9')) {
+        node = atoi(entry->d_name + 4);
+        break;
+      }
+    }
+
+    closedir(dir);
+
+    return node;
+  }
+
+  return -1;
+}
+
+void os::cpus::node_cpus(unsigned cpu, cpu_set_t& set) const
+{
+  CPU_ZERO(&set);
+
+  // Get NUMA node of the CPU.
+  const int n = node(cpu);
+
+  if (n != -1) {
+    char filename[64];
+    snprintf(filename,
+             sizeof(filename),
+             "/sys/devices/system/node/node%d/cpulist",
+             n);
+
+    // Get the CPUs of the NUMA node.
+    char buf[4096];
+    if ((read_file(filename, buf, sizeof(buf))) && (parse_list(buf, set))) {
+      // Only the CPUs of the affinity mask.
+      CPU_AND(&set, &set, &_M_mask);
+
+      if (CPU_COUNT(&set) > 0) {
+        return;
+      }
+    }
+  }
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+}
+
+size_t os::cpus::quota()
+{
+  char buf[4096];
+  if (read_file("/proc/self/cgroup", buf, sizeof(buf))) {
+    size_t q = 0;
+
+    // For each line ("<id>:<controllers>:<path>")...
+    char* saveptr;
+    for (char* line = strtok_r(buf, "\n", &saveptr);
+         line;
+         line = strtok_r(nullptr, "\n", &saveptr)) {
+      char* const controllers = strchr(line, ':');
+      if (!controllers) {
+        continue;
+      }
+
+      char* const path = strchr(controllers + 1, ':');
+      if (!path) {
+        continue;
+      }
+
+      *controllers = 0;
+      *path = 0;
+
+      char filename[PATH_MAX];
+
+      // cgroup v2?
+      if ((strcmp(line, "0") == 0) && (controllers[1] == 0)) {
+        // Unified hierarchy mounted on /sys/fs/cgroup or on
+        // /sys/fs/cgroup/unified (hybrid mode).
+        static const char* const mounts[] = {
+          "/sys/fs/cgroup",
+          "/sys/fs/cgroup/unified"
+        };
+
+        for (size_t i = 0; i < sizeof(mounts) / sizeof(mounts[0]); i++) {
+          if ((q = quota_v2(mounts[i],
+                            (strcmp(path + 1, "/") != 0) ? path + 1 : "")) >
+              0) {
+            return q;
+          }
+        }
+      } else {
+        // cgroup v1: search the "cpu" controller.
+        char* saveptr2;
+        for (char* controller = strtok_r(controllers + 1, ",", &saveptr2);
+             controller;
+             controller = strtok_r(nullptr, ",", &saveptr2)) {
+          if (strcmp(controller, "cpu") == 0) {
+            if (snprintf(filename,
+                         sizeof(filename),
+                         "/sys/fs/cgroup/cpu%s",
+                         (strcmp(path + 1, "/") != 0) ? path + 1 : "") <
+                static_cast<int>(sizeof(filename))) {
+              if ((q = quota_v1(filename)) > 0) {
+                return q;
+              }
+            }
+
+            // The cgroup namespace might hide the path.
+            if ((q = quota_v1("/sys/fs/cgroup/cpu")) > 0) {
+              return q;
+            }
+
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // No quota.
+  return 0;
+}
+
+size_t os::cpus::quota_v2(const char* mount, const char* path)
+{
+  char dir[PATH_MAX];
+  if (snprintf(dir, sizeof(dir), "%s%s", mount, path) >=
+      static_cast<int>(sizeof(dir))) {
+    return 0;
+  }
+
+  const size_t mountlen = strlen(mount);
+
+  size_t q = 0;
+
+  // From the cgroup up to the root of the hierarchy (the root cgroup has no
+  // "cpu.max" file)...
+  do {
+    char filename[PATH_MAX];
+    if (snprintf(filename, sizeof(filename), "%s/cpu.max", dir) <
+        static_cast<int>(sizeof(filename))) {
+      // Keep the lowest quota.
+      const size_t n = quota_v2(filename);
+      if ((n > 0) && ((q == 0) || (n < q))) {
+        q = n;
+      }
+    }
+
+    // Go to the parent cgroup.
+    char* const slash = strrchr(dir + mountlen, '/');
+    if (!slash) {
+      return q;
+    }
+
+    *slash = 0;
+  } while (true);
+}
+
+size_t os::cpus::quota_v2(const char* filename)
+{
+  // Format: "<quota> <period>" or "max <period>".
+  char buf[64];
+  if (read_file(filename, buf, sizeof(buf))) {
+    char* end;
+    const long long quota = strtoll(buf, &end, 10);
+
+    if ((end != buf) && (quota > 0)) {
+      const long long period = strtoll(end, nullptr, 10);
+
+      if (period > 0) {
+        return static_cast<size_t>((quota + period - 1) / period);
+      }
+    }
+  }
+
+  return 0;
+}
+
+size_t os::cpus::quota_v1(const char* dir)
+{
+  char filename[PATH_MAX];
+  char buf[64];
+
+  // Read quota (-1 if unlimited).
+  if ((snprintf(filename,
+                sizeof(filename),
+                "%s/cpu.cfs_quota_us",
+                dir) < static_cast<int>(sizeof(filename))) &&
+      (read_file(filename, buf, sizeof(buf)))) {
+    const long long quota = strtoll(buf, nullptr, 10);
+
+    // Read period.
+    if ((quota > 0) &&
+        (snprintf(filename,
+                  sizeof(filename),
+                  "%s/cpu.cfs_period_us",
+                  dir) < static_cast<int>(sizeof(filename))) &&
+        (read_file(filename, buf, sizeof(buf)))) {
+      const long long period = strtoll(buf, nullptr, 10);
+
+      if (period > 0) {
+        return static_cast<size_t>((quota + period - 1) / period);
+      }
+    }
+  }
+
+  return 0;
+}
+
+bool os::cpus::parse_list(const char* s, cpu_set_t& set)
+{
+  CPU_ZERO(&set);
+
+  do {
+    // Parse first CPU of the range.
+    char* end;
+    const unsigned long first = strtoul(s, &end, 10);
+    if ((end == s) || (first >= CPU_SETSIZE)) {
+      return false;
+    }
+
+    unsigned long last = first;
+
+    // Range?
+    if (*end == '-') {
+      s = end + 1;
+
+      last = strtoul(s, &end, 10);
+      if ((end == s) || (last >= CPU_SETSIZE) || (last < first)) {
+        return false;
+      }
+    }
+
+    for (unsigned long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, &set);
+    }
+
+    // If there are no more ranges...
+    if (*end != ',') {
+      return true;
+    }
+
+    s = end + 1;
+  } while (true);
+}
+
+bool read_file(const char* filename, char* buf, size_t size)
+{
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+  if (fd != -1) {
+    size_t len = 0;
+
+    do {
+      const ssize_t ret = read(fd, buf + len, size - 1 - len);
+
+      if (ret > 0) {
+        len += ret;
+      } else if (ret == 0) {
+        break;
+      } else {
+        close(fd);
+        return false;
+      }
+    } while (len < size - 1);
+
+    close(fd);
+
+    buf[len] = 0;
+
+    return (len > 0);
+  }
+
+  return false;
+}
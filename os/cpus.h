@@ -0,0 +1,91 @@
+#ifndef OS_CPUS_H
+#define OS_CPUS_H
+
+#include <stdint.h>
+#include <sched.h>
+
+namespace os {
+  // CPUs the process can run on.
+  class cpus {
+    public:
+      // Constructor.
+      cpus() = default;
+
+      // Destructor.
+      ~cpus() = default;
+
+      // Load the affinity mask and the CPU quota of the process.
+      bool load();
+
+      // Intersect the affinity mask with the CPUs of `set` (it fails if no
+      // CPUs would be left).
+      bool intersect(const cpu_set_t& set);
+
+      // Get number of CPUs in the affinity mask.
+      size_t count() const;
+
+      // Get the number of CPUs the process can actually use (the number of
+      // CPUs in the affinity mask limited by the CPU quota of the cgroup).
+      size_t available() const;
+
+      // Get the CPU at position `idx` of the affinity mask (-1 if `idx` is
+      // out of range).
+      int cpu(size_t idx) const;
+
+      // Get the NUMA node of a CPU (-1 if unknown).
+      static int node(unsigned cpu);
+
+      // Get the CPUs of the affinity mask which belong to the same NUMA node
+      // as `cpu` (if the NUMA node is unknown, only `cpu`).
+      void node_cpus(unsigned cpu, cpu_set_t& set) const;
+
+      // Parse a list of CPUs (e.g. "0-3,8,10-11").
+      static bool parse_list(const char* s, cpu_set_t& set);
+
+    private:
+      // Affinity mask.
+      cpu_set_t _M_mask;
+
+      // CPUs of the affinity mask, in ascending order.
+      uint16_t _M_cpus[CPU_SETSIZE];
+      size_t _M_count = 0;
+
+      // CPU quota (number of CPUs, rounded up; 0 if unlimited).
+      size_t _M_quota = 0;
+
+      // Get the CPU quota from the cgroup (v2 or v1) of the process.
+      static size_t quota();
+
+      // Get the CPU quota of the cgroup v2 `path` of the hierarchy mounted
+      // on `mount`: the lowest quota of the cgroup and its ancestors (a quota
+      // set on a parent cgroup also limits its descendants).
+      static size_t quota_v2(const char* mount, const char* path);
+
+      // Get the CPU quota from a cgroup v2 "cpu.max" file.
+      static size_t quota_v2(const char* filename);
+
+      // Get the CPU quota from the cgroup v1 files of the directory `dir`.
+      static size_t quota_v1(const char* dir);
+
+      // Disable copy constructor and assignment operator.
+      cpus(const cpus&) = delete;
+      cpus& operator=(const cpus&) = delete;
+  };
+
+  inline size_t cpus::count() const
+  {
+    return _M_count;
+  }
+
+  inline size_t cpus::available() const
+  {
+    return ((_M_quota > 0) && (_M_quota < _M_count)) ? _M_quota : _M_count;
+  }
+
+  inline int cpus::cpu(size_t idx) const
+  {
+    return (idx < _M_count) ? _M_cpus[idx] : -1;
+  }
+}
+
+#endif // OS_CPUS_H
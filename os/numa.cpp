@@ -0,0 +1,26 @@
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "os/numa.h"
+
+bool os::numa::bind(void* addr, size_t len, int node)
+{
+  // If the NUMA node is valid...
+  if ((node >= 0) && (node < max_nodes)) {
+    static constexpr const size_t bits = 8 * sizeof(unsigned long);
+
+    unsigned long mask[max_nodes / bits] = {0};
+    mask[node / bits] = 1ul << (node % bits);
+
+    // The kernel expects the number of bits of the mask plus one.
+    return (syscall(SYS_mbind,
+                    addr,
+                    len,
+                    MPOL_PREFERRED,
+                    mask,
+                    max_nodes + 1,
+                    0) == 0);
+  }
+
+  return (node == -1);
+}
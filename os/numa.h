@@ -0,0 +1,21 @@
+#ifndef OS_NUMA_H
+#define OS_NUMA_H
+
+#include <stddef.h>
+
+namespace os {
+  // NUMA memory policy.
+  class numa {
+    public:
+      // Maximum number of NUMA nodes.
+      static constexpr const int max_nodes = 1024;
+
+      // Make the pages of the memory region be allocated on the NUMA node
+      // `node` (preferably: if the node runs out of memory, the pages are
+      // allocated on other nodes).
+      // If `node` is -1, nothing is done.
+      static bool bind(void* addr, size_t len, int node);
+  };
+}
+
+#endif // OS_NUMA_H
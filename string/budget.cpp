@@ -0,0 +1,43 @@
+#include "string/budget.h"
+
+bool string::budget::take(size_t n)
+{
+  const size_t used = _M_used.fetch_add(n, std::memory_order_relaxed) + n;
+
+  // If the limit has been exceeded...
+  if ((_M_limit > 0) && (used > _M_limit)) {
+    _M_used.fetch_sub(n, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Update the high-water mark.
+  size_t high = _M_high_water.load(std::memory_order_relaxed);
+  while ((used > high) &&
+         (!_M_high_water.compare_exchange_weak(high,
+                                               used,
+                                               std::memory_order_relaxed))) {
+  }
+
+  return true;
+}
+
+size_t string::budget::scale(size_t max) const
+{
+  // If the budget is unlimited or less than half of it is used...
+  const size_t used = _M_used.load(std::memory_order_relaxed);
+  if ((_M_limit == 0) || (used <= _M_limit / 2)) {
+    return max;
+  }
+
+  const size_t min = max / min_fraction;
+
+  // If the budget is exhausted...
+  if (used >= _M_limit) {
+    return min;
+  }
+
+  // Interpolate (in units of 1/1024 to avoid overflows).
+  const size_t left = ((_M_limit - used) * 1024) / (_M_limit - (_M_limit / 2));
+
+  return min + (((max - min) * left) / 1024);
+}
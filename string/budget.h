@@ -0,0 +1,90 @@
+#ifndef STRING_BUDGET_H
+#define STRING_BUDGET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace string {
+  // Memory budget shared by the pools of chunks of all the worker threads.
+  // The pools take credits from the budget in batches (`credit_size` bytes)
+  // and give them back when they have too many unused credits, so the shared
+  // counters are only touched once per batch.
+  class budget {
+    public:
+      // Size of the batches of credits.
+      static constexpr const size_t credit_size = 4 * 1024 * 1024;
+
+      // The limits scaled to the usage of the budget don't go below 1/16 of
+      // their maximum.
+      static constexpr const size_t min_fraction = 16;
+
+      // Constructor.
+      budget() = default;
+
+      // Set the limit (bytes; 0: unlimited).
+      void limit(size_t limit);
+
+      // Get the limit.
+      size_t limit() const;
+
+      // Take `n` bytes of credits (returns false if the limit would be
+      // exceeded).
+      bool take(size_t n);
+
+      // Give back `n` bytes of credits.
+      void give(size_t n);
+
+      // Get the number of bytes taken by the pools.
+      size_t used() const;
+
+      // Get the highest number of bytes taken by the pools.
+      size_t high_water() const;
+
+      // Scale a limit to the usage of the budget: `max` while less than half
+      // of the budget is used, then linearly down to `max / min_fraction`
+      // when the budget is exhausted.
+      size_t scale(size_t max) const;
+
+    private:
+      // Limit.
+      size_t _M_limit = 0;
+
+      // Bytes taken by the pools.
+      std::atomic<size_t> _M_used{0};
+
+      // High-water mark.
+      std::atomic<size_t> _M_high_water{0};
+
+      // Disable copy constructor and assignment operator.
+      budget(const budget&) = delete;
+      budget& operator=(const budget&) = delete;
+  };
+
+  inline void budget::limit(size_t limit)
+  {
+    _M_limit = limit;
+  }
+
+  inline size_t budget::limit() const
+  {
+    return _M_limit;
+  }
+
+  inline void budget::give(size_t n)
+  {
+    _M_used.fetch_sub(n, std::memory_order_relaxed);
+  }
+
+  inline size_t budget::used() const
+  {
+    return _M_used.load(std::memory_order_relaxed);
+  }
+
+  inline size_t budget::high_water() const
+  {
+    return _M_high_water.load(std::memory_order_relaxed);
+  }
+}
+
+#endif // STRING_BUDGET_H
@@ -0,0 +1,148 @@
+#ifndef STRING_CHUNK_H
+#define STRING_CHUNK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+namespace string {
+  // Forward declaration.
+  class chunks;
+
+  // Reference-counted block of data.
+  // A chunk is filled once and then shared (read-only) by all the queues
+  // which hold a reference to (part of) it.
+  // The data follows the header in the same memory block (the size of the
+  // block is the size of the size class the chunk belongs to).
+  class alignas(64) chunk {
+    friend class chunks;
+
+    public:
+      // Get data.
+      const uint8_t* data() const;
+
+      // Get length.
+      size_t length() const;
+
+      // Get capacity.
+      size_t capacity() const;
+
+      // Get remaining space available.
+      size_t remaining() const;
+
+      // Get pointer to the first free byte.
+      uint8_t* end();
+
+      // Commit `n` bytes written at the end of the chunk.
+      void commit(size_t n);
+
+      // Acquire reference.
+      void acquire();
+
+      // Release reference.
+      // When the last reference is released, the chunk is returned to the
+      // pool.
+      void release();
+
+    private:
+      // Constructor.
+      chunk(chunks& chunks, size_t cls, size_t capacity);
+
+      // Pool.
+      chunks& _M_chunks;
+
+      // Size class.
+      size_t _M_class;
+
+      // Capacity.
+      size_t _M_capacity;
+
+      // Number of references.
+      size_t _M_refs;
+
+      // Number of bytes used.
+      size_t _M_used;
+
+      // Next chunk (free list).
+      chunk* _M_next;
+
+      // Get data.
+      uint8_t* data();
+
+      // Disable copy constructor and assignment operator.
+      chunk(const chunk&) = delete;
+      chunk& operator=(const chunk&) = delete;
+  };
+
+  // Segment of a queue: fixed-size array of references to parts of chunks.
+  // The references are stored as an array of `struct iovec`, so they can be
+  // passed directly to sendmsg()/writev().
+  struct segment {
+    // Number of slots.
+    static constexpr const size_t slots = 64;
+
+    // Data.
+    struct iovec iov[slots];
+
+    // Chunks which hold the data.
+    chunk* owners[slots];
+
+    // First used slot.
+    size_t head;
+
+    // First free slot.
+    size_t tail;
+
+    // Next segment.
+    segment* next;
+  };
+
+  inline chunk::chunk(chunks& chunks, size_t cls, size_t capacity)
+    : _M_chunks(chunks),
+      _M_class(cls),
+      _M_capacity(capacity)
+  {
+  }
+
+  inline const uint8_t* chunk::data() const
+  {
+    return reinterpret_cast<const uint8_t*>(this + 1);
+  }
+
+  inline uint8_t* chunk::data()
+  {
+    return reinterpret_cast<uint8_t*>(this + 1);
+  }
+
+  inline size_t chunk::length() const
+  {
+    return _M_used;
+  }
+
+  inline size_t chunk::capacity() const
+  {
+    return _M_capacity;
+  }
+
+  inline size_t chunk::remaining() const
+  {
+    return _M_capacity - _M_used;
+  }
+
+  inline uint8_t* chunk::end()
+  {
+    return data() + _M_used;
+  }
+
+  inline void chunk::commit(size_t n)
+  {
+    _M_used += n;
+  }
+
+  inline void chunk::acquire()
+  {
+    _M_refs++;
+  }
+}
+
+#endif // STRING_CHUNK_H
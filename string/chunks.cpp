@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <new>
+#include <sys/mman.h>
+#include "string/chunks.h"
+#include "os/numa.h"
+
+string::chunks::~chunks()
+{
+  while (_M_free_segments) {
+    segment* const next = _M_free_segments->next;
+
+    delete _M_free_segments;
+
+    _M_free_segments = next;
+  }
+
+  // Free slabs (the chunks are trivially destructible).
+  if (_M_slabs) {
+    for (size_t i = _M_used; i > 0; i--) {
+      munmap(_M_slabs[i - 1], slab_size);
+    }
+
+    free(_M_slabs);
+  }
+
+  if (_M_arena) {
+    munmap(_M_arena, _M_arenasize);
+  }
+}
+
+bool string::chunks::reserve(size_t n, size_t size)
+{
+  // If the arena has not been allocated yet...
+  if (!_M_arena) {
+    const size_t cls = size_class(size);
+    const size_t len = n * class_size(cls);
+
+    void* const arena = mmap(nullptr,
+                             len,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS,
+                             -1,
+                             0);
+
+    // If the memory could be allocated...
+    if (arena != MAP_FAILED) {
+      // Allocate the pages on the NUMA node of the pool (before they are
+      // touched).
+      os::numa::bind(arena, len, _M_node);
+
+      // Add chunks to the free list.
+      carve(arena, len, cls);
+
+      _M_arena = arena;
+      _M_arenasize = len;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+string::chunk* string::chunks::pop(size_t size)
+{
+  const size_t cls = size_class(size);
+
+  // If the chunks are charged to a budget and there are not enough
+  // credits...
+  if ((_M_budget) && (_M_credits < class_size(cls))) {
+    // Take a batch of credits or, if the budget is almost exhausted, just the
+    // credits for this chunk.
+    if (_M_budget->take(string::budget::credit_size)) {
+      _M_credits += string::budget::credit_size;
+    } else if (_M_budget->take(class_size(cls))) {
+      _M_credits += class_size(cls);
+    } else {
+      return nullptr;
+    }
+  }
+
+  // If there are free chunks...
+  if (_M_free[cls]) {
+    _M_stats.hits[cls]++;
+  } else {
+    _M_stats.misses[cls]++;
+
+    // Allocate slab.
+    if (!allocate(cls)) {
+      return nullptr;
+    }
+  }
+
+  chunk* const c = _M_free[cls];
+  _M_free[cls] = c->_M_next;
+
+  c->_M_refs = 1;
+  c->_M_used = 0;
+
+  if (_M_budget) {
+    _M_credits -= class_size(cls);
+  }
+
+  return c;
+}
+
+string::segment* string::chunks::pop_segment()
+{
+  segment* s;
+
+  // If there are free segments...
+  if (_M_free_segments) {
+    s = _M_free_segments;
+    _M_free_segments = _M_free_segments->next;
+  } else if ((s = new (std::nothrow) segment) == nullptr) {
+    return nullptr;
+  }
+
+  s->head = 0;
+  s->tail = 0;
+  s->next = nullptr;
+
+  return s;
+}
+
+bool string::chunks::allocate(size_t cls)
+{
+  // Make room for the new slab.
+  if (_M_used == _M_size) {
+    const size_t size = (_M_size > 0) ? _M_size * 2 : 8;
+
+    void** slabs = static_cast<void**>(realloc(_M_slabs,
+                                               size * sizeof(void*)));
+
+    if (!slabs) {
+      return false;
+    }
+
+    _M_slabs = slabs;
+    _M_size = size;
+  }
+
+  // Allocate slab (page-aligned).
+  void* const slab = mmap(nullptr,
+                          slab_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1,
+                          0);
+
+  // If the slab could be allocated...
+  if (slab != MAP_FAILED) {
+    // Allocate the pages on the NUMA node of the pool (before they are
+    // touched).
+    os::numa::bind(slab, slab_size, _M_node);
+
+    _M_slabs[_M_used++] = slab;
+
+    _M_stats.slabs++;
+
+    // Add chunks to the free list.
+    carve(slab, slab_size, cls);
+
+    return true;
+  }
+
+  return false;
+}
+
+void string::chunks::carve(void* mem, size_t len, size_t cls)
+{
+  const size_t size = class_size(cls);
+
+  for (size_t off = len - (len % size); off > 0; off -= size) {
+    chunk* const c = new (static_cast<uint8_t*>(mem) + (off - size))
+                       chunk(*this, cls, class_capacity(cls));
+
+    c->_M_next = _M_free[cls];
+    _M_free[cls] = c;
+  }
+}
@@ -0,0 +1,227 @@
+#ifndef STRING_CHUNKS_H
+#define STRING_CHUNKS_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include "string/chunk.h"
+#include "string/budget.h"
+
+namespace string {
+  // Pool of chunks and queue segments.
+  // The chunks are grouped in size classes (16 KB, 64 KB, 256 KB and 1 MB,
+  // header included) and carved from 1 MB slabs; released chunks are
+  // recycled into the free list of their size class, so, once the pool has
+  // grown, no memory is allocated anymore.
+  // The chunks in use can be charged to a memory budget shared by all the
+  // pools.
+  // Not thread-safe: each worker thread has its own pool.
+  class chunks {
+    public:
+      // Number of size classes.
+      static constexpr const size_t nclasses = 4;
+
+      // Size of the smallest size class.
+      static constexpr const size_t min_class_size = 16 * 1024;
+
+      // Slab size.
+      static constexpr const size_t slab_size = 1024 * 1024;
+
+      // Statistics.
+      struct statistics {
+        // Chunks taken from the free lists (per size class).
+        uint64_t hits[nclasses];
+
+        // Chunks which required a new slab (per size class).
+        uint64_t misses[nclasses];
+
+        // Number of slabs.
+        uint64_t slabs;
+      };
+
+      // Constructor.
+      chunks() = default;
+
+      // Destructor.
+      ~chunks();
+
+      // Get the size of a size class.
+      static constexpr size_t class_size(size_t cls);
+
+      // Get the capacity of the chunks of a size class.
+      static constexpr size_t class_capacity(size_t cls);
+
+      // Allocate `n` chunks big enough to hold `size` bytes in a single
+      // contiguous memory region (arena), so the region can be registered with
+      // the kernel.
+      bool reserve(size_t n, size_t size);
+
+      // Get the memory region of the arena.
+      bool arena(struct iovec& iov) const;
+
+      // Is the chunk part of the arena?
+      bool in_arena(const chunk* c) const;
+
+      // Get new chunk (with one reference) of the smallest size class which
+      // can hold `size` bytes (or of the biggest size class).
+      chunk* pop(size_t size);
+
+      // Return chunk.
+      void push(chunk* c);
+
+      // Get new segment (empty).
+      segment* pop_segment();
+
+      // Return segment.
+      void push(segment* s);
+
+      // Get statistics.
+      const statistics& stats() const;
+
+      // Set the NUMA node where the memory has to be allocated (-1: any).
+      void node(int node);
+
+      // Get the memory budget (nullptr if the chunks are not charged to a
+      // budget).
+      const string::budget* budget() const;
+
+      // Set the memory budget.
+      void budget(string::budget* budget);
+
+    private:
+      // Free chunks (per size class).
+      chunk* _M_free[nclasses] = {nullptr, nullptr, nullptr, nullptr};
+
+      // Free segments.
+      segment* _M_free_segments = nullptr;
+
+      // Slabs.
+      void** _M_slabs = nullptr;
+      size_t _M_size = 0;
+      size_t _M_used = 0;
+
+      // Arena.
+      void* _M_arena = nullptr;
+      size_t _M_arenasize = 0;
+
+      // NUMA node where the memory has to be allocated (-1: any).
+      int _M_node = -1;
+
+      // Memory budget.
+      string::budget* _M_budget = nullptr;
+
+      // Credits taken from the budget and not used yet (bytes).
+      size_t _M_credits = 0;
+
+      // Statistics.
+      statistics _M_stats = {{0, 0, 0, 0}, {0, 0, 0, 0}, 0};
+
+      // Get the size class for `size` bytes.
+      static size_t size_class(size_t size);
+
+      // Allocate slab for the size class `cls`.
+      bool allocate(size_t cls);
+
+      // Carve chunks of the size class `cls` from the memory region `mem`
+      // and add them to the free list.
+      void carve(void* mem, size_t len, size_t cls);
+
+      // Disable copy constructor and assignment operator.
+      chunks(const chunks&) = delete;
+      chunks& operator=(const chunks&) = delete;
+  };
+
+  inline constexpr size_t chunks::class_size(size_t cls)
+  {
+    return min_class_size << (2 * cls);
+  }
+
+  inline constexpr size_t chunks::class_capacity(size_t cls)
+  {
+    return class_size(cls) - sizeof(chunk);
+  }
+
+  inline bool chunks::arena(struct iovec& iov) const
+  {
+    if (_M_arena) {
+      iov.iov_base = _M_arena;
+      iov.iov_len = _M_arenasize;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  inline bool chunks::in_arena(const chunk* c) const
+  {
+    return ((reinterpret_cast<const uint8_t*>(c) >=
+             static_cast<const uint8_t*>(_M_arena)) &&
+            (reinterpret_cast<const uint8_t*>(c) <
+             static_cast<const uint8_t*>(_M_arena) + _M_arenasize));
+  }
+
+  inline void chunks::push(chunk* c)
+  {
+    c->_M_next = _M_free[c->_M_class];
+    _M_free[c->_M_class] = c;
+
+    // If the chunks are charged to a budget...
+    if (_M_budget) {
+      _M_credits += class_size(c->_M_class);
+
+      // Give back the credits which are not needed.
+      if (_M_credits > 2 * string::budget::credit_size) {
+        _M_budget->give(string::budget::credit_size);
+        _M_credits -= string::budget::credit_size;
+      }
+    }
+  }
+
+  inline void chunks::push(segment* s)
+  {
+    s->next = _M_free_segments;
+    _M_free_segments = s;
+  }
+
+  inline const chunks::statistics& chunks::stats() const
+  {
+    return _M_stats;
+  }
+
+  inline void chunks::node(int node)
+  {
+    _M_node = node;
+  }
+
+  inline const string::budget* chunks::budget() const
+  {
+    return _M_budget;
+  }
+
+  inline void chunks::budget(string::budget* budget)
+  {
+    _M_budget = budget;
+  }
+
+  inline size_t chunks::size_class(size_t size)
+  {
+    for (size_t cls = 0; cls < nclasses - 1; cls++) {
+      if (size <= class_capacity(cls)) {
+        return cls;
+      }
+    }
+
+    return nclasses - 1;
+  }
+
+  inline void chunk::release()
+  {
+    // If this was the last reference...
+    if (--_M_refs == 0) {
+      // Return chunk to the pool.
+      _M_chunks.push(this);
+    }
+  }
+}
+
+#endif // STRING_CHUNKS_H
@@ -0,0 +1,127 @@
+#include "string/queue.h"
+
+void string::queue::clear()
+{
+  while (_M_first) {
+    segment* const next = _M_first->next;
+
+    // Release chunks.
+    for (size_t i = _M_first->head; i < _M_first->tail; i++) {
+      _M_first->owners[i]->release();
+    }
+
+    // Return segment to the pool.
+    _M_chunks.push(_M_first);
+
+    _M_first = next;
+  }
+
+  _M_last = nullptr;
+  _M_length = 0;
+}
+
+bool string::queue::push(chunk* c, const void* data, size_t len)
+{
+  // If the queue is not empty...
+  if ((_M_last) && (_M_last->tail > _M_last->head)) {
+    struct iovec& last = _M_last->iov[_M_last->tail - 1];
+
+    // If the data is contiguous to the data of the last slot...
+    if ((_M_last->owners[_M_last->tail - 1] == c) &&
+        (static_cast<const uint8_t*>(last.iov_base) + last.iov_len == data)) {
+      last.iov_len += len;
+      _M_length += len;
+
+      return true;
+    }
+  }
+
+  // If there is no segment or the last segment is full...
+  if ((!_M_last) || (_M_last->tail == segment::slots)) {
+    // Get new segment.
+    segment* const s = _M_chunks.pop_segment();
+
+    // If the segment couldn't be allocated...
+    if (!s) {
+      return false;
+    }
+
+    // If the queue is not empty...
+    if (_M_last) {
+      _M_last->next = s;
+    } else {
+      _M_first = s;
+    }
+
+    _M_last = s;
+  }
+
+  // Acquire reference to the chunk.
+  c->acquire();
+
+  const size_t slot = _M_last->tail++;
+
+  _M_last->iov[slot].iov_base = const_cast<void*>(data);
+  _M_last->iov[slot].iov_len = len;
+  _M_last->owners[slot] = c;
+
+  _M_length += len;
+
+  return true;
+}
+
+bool string::queue::push(const queue& q)
+{
+  // For each segment...
+  for (const segment* s = q._M_first; s; s = s->next) {
+    // For each slot...
+    for (size_t i = s->head; i < s->tail; i++) {
+      if (!push(s->owners[i], s->iov[i].iov_base, s->iov[i].iov_len)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void string::queue::erase(size_t n)
+{
+  _M_length -= n;
+
+  do {
+    struct iovec& first = _M_first->iov[_M_first->head];
+
+    // If the first slot has not been fully consumed...
+    if (n < first.iov_len) {
+      first.iov_base = static_cast<uint8_t*>(first.iov_base) + n;
+      first.iov_len -= n;
+
+      return;
+    }
+
+    n -= first.iov_len;
+
+    // Release chunk.
+    _M_first->owners[_M_first->head]->release();
+
+    // If the segment has been fully consumed...
+    if (++_M_first->head == _M_first->tail) {
+      // If this is the last segment...
+      if (_M_first == _M_last) {
+        // Reuse the segment.
+        _M_first->head = 0;
+        _M_first->tail = 0;
+
+        return;
+      }
+
+      segment* const next = _M_first->next;
+
+      // Return segment to the pool.
+      _M_chunks.push(_M_first);
+
+      _M_first = next;
+    }
+  } while (n > 0);
+}
@@ -0,0 +1,87 @@
+#ifndef STRING_QUEUE_H
+#define STRING_QUEUE_H
+
+#include "string/chunks.h"
+
+namespace string {
+  // Queue of references to parts of chunks.
+  // The data is not copied: the queue only holds a reference to the chunk
+  // which contains it. The references are stored in a chain of fixed-size
+  // segments, so sending data only advances a pointer (there is no need to
+  // shift memory) and the data of a whole segment can be sent with a single
+  // sendmsg().
+  class queue {
+    public:
+      // Constructor.
+      queue(chunks& chunks);
+
+      // Destructor.
+      ~queue();
+
+      // Clear queue (releases all the references).
+      void clear();
+
+      // Get length (number of bytes).
+      size_t length() const;
+
+      // Empty?
+      bool empty() const;
+
+      // Append `len` bytes pointed to by `data` (which must be part of the
+      // chunk `c`).
+      bool push(chunk* c, const void* data, size_t len);
+
+      // Append the data of the queue `q` (the data is not copied, `q` is not
+      // modified).
+      bool push(const queue& q);
+
+      // Get the data of the first segment.
+      const struct iovec* iov(size_t& iovcnt) const;
+
+      // Erase `n` bytes from the front of the queue.
+      void erase(size_t n);
+
+    private:
+      // Pool.
+      chunks& _M_chunks;
+
+      // First and last segments.
+      segment* _M_first = nullptr;
+      segment* _M_last = nullptr;
+
+      // Number of bytes.
+      size_t _M_length = 0;
+
+      // Disable copy constructor and assignment operator.
+      queue(const queue&) = delete;
+      queue& operator=(const queue&) = delete;
+  };
+
+  inline queue::queue(chunks& chunks)
+    : _M_chunks(chunks)
+  {
+  }
+
+  inline queue::~queue()
+  {
+    clear();
+  }
+
+  inline size_t queue::length() const
+  {
+    return _M_length;
+  }
+
+  inline bool queue::empty() const
+  {
+    return (_M_length == 0);
+  }
+
+  inline const struct iovec* queue::iov(size_t& iovcnt) const
+  {
+    iovcnt = _M_first->tail - _M_first->head;
+    return &_M_first->iov[_M_first->head];
+  }
+}
+
+#endif // STRING_QUEUE_H
@@ -1,25 +1,113 @@
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <signal.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <new>
 #include "net/tcp/forwarder.h"
+#include "net/tcp/connection.h"
+#include "net/tcp/upgrade.h"
+
+// State of the parsing of the upstream servers.
+struct upstream_parser {
+  // First upstream server and quorum of the current upstream group (the
+  // upstream servers before the first group can be none).
+  size_t group_first = 0;
+  uint64_t group_quorum = 0;
+
+  // Tuning profile of the next upstream servers.
+  net::tcp::tuning tuning;
+};
+
+// Options which are used once the forwarder has started.
+struct options {
+  // File of upstream servers (read again on SIGHUP).
+  const char* upstreams_file = nullptr;
+
+  // File of listeners (read again on SIGHUP).
+  const char* listeners_file = nullptr;
+
+  // UNIX socket where the new process connects to take over the listeners.
+  const char* upgrade_socket = nullptr;
+};
+
+// Listening addresses of a listeners file (one list per routing policy).
+struct listener_list {
+  net::socket::addresses addresses[
+    static_cast<size_t>(net::tcp::routing_policy::hash) + 1
+  ];
+};
 
 static void usage(const char* program);
+static void print_statistics(const net::tcp::forwarder& forwarder);
+static void raise_open_files_limit();
+
 static bool parse_number_workers(int argc,
                                  const char* argv[],
                                  size_t& nworkers);
 
+static bool parse_upgrade_from(int argc,
+                               const char* argv[],
+                               const char*& path);
+
 static bool parse_arguments(int argc,
                             const char* argv[],
-                            net::tcp::forwarder& forwarder);
+                            net::tcp::forwarder& forwarder,
+                            options& opts);
+
+static bool parse_upstream_server(const char* s,
+                                  net::tcp::upstreams& upstreams,
+                                  const upstream_parser& parser);
+
+static bool parse_upstream_group(const char* s,
+                                 net::tcp::upstreams& upstreams,
+                                 upstream_parser& parser);
+
+static bool check_upstreams(const net::tcp::upstreams& upstreams,
+                            const upstream_parser& parser);
+
+static bool load_upstreams(const char* filename,
+                           net::tcp::upstreams& upstreams);
+
+static void reload_upstreams(net::tcp::forwarder& forwarder,
+                             const char* filename);
+
+static bool load_listeners(const char* filename, listener_list& listeners);
+
+static bool update_listeners(net::tcp::forwarder& forwarder,
+                             const char* filename);
+
+static void reload_listeners(net::tcp::forwarder& forwarder,
+                             const char* filename);
+
+static bool inherit_listeners(net::tcp::forwarder& forwarder,
+                              const char* path,
+                              int& sock,
+                              net::tcp::event_loop& loop);
+
+static void wait_for_signal(net::tcp::forwarder& forwarder,
+                            const sigset_t& set,
+                            const options& opts,
+                            int upgrade);
 
 static bool parse_ip_ports(const char* s,
                            char* address,
                            in_port_t& minport,
                            in_port_t& maxport);
 
+static bool parse_delimiter(const char* s, uint8_t& delimiter);
+
+static bool parse_routing(const char* s, net::tcp::routing_policy& policy);
+
+static bool parse_tuning(const char* s, net::tcp::tuning& tuning);
+
 static bool parse_number(const char* s,
                          size_t len,
                          const char* name,
@@ -29,37 +117,101 @@ static bool parse_number(const char* s,
 
 int main(int argc, const char* argv[])
 {
-  // Parse number of workers.
+  // Parse number of workers and the UNIX socket of the old process (if the
+  // binary is being upgraded).
   size_t nworkers;
-  if (parse_number_workers(argc, argv, nworkers)) {
+  const char* upgrade_from;
+  if ((parse_number_workers(argc, argv, nworkers)) &&
+      (parse_upgrade_from(argc, argv, upgrade_from))) {
     net::tcp::forwarder forwarder(nworkers);
 
-    // Parse arguments.
-    if (parse_arguments(argc, argv, forwarder)) {
-      // Block signals SIGINT and SIGTERM.
-      sigset_t set;
-      sigemptyset(&set);
-      sigaddset(&set, SIGINT);
-      sigaddset(&set, SIGTERM);
-      if (pthread_sigmask(SIG_BLOCK, &set, nullptr) == 0) {
-        // Start TCP forwarder.
-        if (forwarder.start()) {
-          printf("Waiting for signal to arrive.\n");
+    // Receive the listening sockets of the old process (before listening).
+    int sock = -1;
+    net::tcp::event_loop loop = net::tcp::event_loop::epoll;
+    if ((!upgrade_from) ||
+        (inherit_listeners(forwarder, upgrade_from, sock, loop))) {
+      // Parse arguments.
+      options opts;
+      if (parse_arguments(argc, argv, forwarder, opts)) {
+        // Listen on the UNIX socket for the new process (if any).
+        int upgrade = -1;
+
+        // The listening sockets of the old process are blocking or
+        // non-blocking depending on its event loop.
+        if ((sock != -1) && (forwarder.config().loop != loop)) {
+          fprintf(stderr,
+                  "The event loop has to be the same as the one of the old "
+                  "process.\n");
+        } else if ((opts.upgrade_socket) &&
+                   ((upgrade = net::tcp::upgrade::listen(
+                                 opts.upgrade_socket
+                               )) == -1)) {
+          fprintf(stderr,
+                  "Error listening on the upgrade socket '%s'.\n",
+                  opts.upgrade_socket);
+        } else {
+          // Block signals SIGINT, SIGTERM and SIGHUP.
+          sigset_t set;
+          sigemptyset(&set);
+          sigaddset(&set, SIGINT);
+          sigaddset(&set, SIGTERM);
+          sigaddset(&set, SIGHUP);
+          // Ignore SIGPIPE (splice() into a closed socket raises it).
+          if ((signal(SIGPIPE, SIG_IGN) != SIG_ERR) &&
+              (pthread_sigmask(SIG_BLOCK, &set, nullptr) == 0)) {
+            // The number of connections is limited by the maximum number of
+            // open files.
+            raise_open_files_limit();
+
+            // Start TCP forwarder.
+            if (forwarder.start()) {
+              // If the listening sockets have been received from the old
+              // process, it can stop accepting connections.
+              if (sock != -1) {
+                if (!net::tcp::upgrade::acknowledge(sock)) {
+                  fprintf(stderr, "Error acknowledging the upgrade.\n");
+                }
 
-          // Wait for signal to arrive.
-          int sig;
-          while (sigwait(&set, &sig) != 0);
+                close(sock);
+              }
 
-          printf("Signal received.\n");
+              printf("Waiting for signal to arrive.\n");
 
-          forwarder.stop();
+              // Wait for signal to arrive (SIGHUP reloads the upstream
+              // servers and the listeners).
+              wait_for_signal(forwarder, set, opts, upgrade);
 
-          return 0;
-        } else {
-          fprintf(stderr, "Error starting TCP forwarder.\n");
+              forwarder.stop();
+
+              // Report the data which couldn't be sent to the upstream
+              // servers.
+              const uint64_t lost = forwarder.pending();
+              if (lost > 0) {
+                printf("%" PRIu64 " byte(s) lost.\n", lost);
+              }
+
+              if (upgrade != -1) {
+                close(upgrade);
+              }
+
+              print_statistics(forwarder);
+
+              return 0;
+            } else {
+              fprintf(stderr, "Error starting TCP forwarder.\n");
+            }
+          } else {
+            fprintf(stderr, "Error setting up signals.\n");
+          }
         }
-      } else {
-        fprintf(stderr, "Error blocking signals.\n");
+
+        if (upgrade != -1) {
+          close(upgrade);
+        }
+      }
+
+      if (sock != -1) {
+        close(sock);
       }
     }
   }
@@ -71,9 +223,44 @@ void usage(const char* program)
 {
   fprintf(stderr,
           "Usage: %s "
-          "[--bind <ip-port-range>]+ "
-          "[--upstream-server <ip-port>]+ "
-          "[--number-workers <number-workers>]\n",
+          "([[--routing <routing>] [--listener-tuning <tuning>] "
+          "--bind <ip-port-range>]+ | "
+          "--listeners-file <file>) "
+          "([[--upstream-group <routing>[/<quorum>]] "
+          "[[--upstream-tuning <tuning>] "
+          "--upstream-server <ip-port>[/<weight>]]+]+ | "
+          "--upstreams-file <file>) "
+          "[--number-workers <number-workers>] "
+          "[--event-loop <event-loop>] "
+          "[--splice] "
+          "[--pin-workers <pinning>] "
+          "[--cpu-affinity <cpu-list>] "
+          "[--steering <steering>] "
+          "[--multiplex <number-connections>] "
+          "[--aggregate <number-connections>] "
+          "[--record-delimiter <delimiter>] "
+          "[--record-length <length-size>] "
+          "[--backpressure <backpressure>] "
+          "[--backpressure-timeout <milliseconds>] "
+          "[--spill-dir <directory>] "
+          "[--spill-size <megabytes>] "
+          "[--max-connections <number-connections>] "
+          "[--connections-memory <megabytes>] "
+          "[--memory-budget <megabytes>] "
+          "[--drain-timeout <milliseconds>] "
+          "[--circuit-breaker <failures>] "
+          "[--health-check <milliseconds>] "
+          "[--connect-timeout <milliseconds>] "
+          "[--idle-timeout <milliseconds>] "
+          "[--write-timeout <milliseconds>] "
+          "[--replay-window <kilobytes>] "
+          "[--max-reconnects <number-connections>] "
+          "[--fastopen <queue-length>] "
+          "[--fastopen-connect] "
+          "[--defer-accept <seconds>] "
+          "[--upgrade-socket <path>] "
+          "[--upgrade-from <path>] "
+          "[--admin <ip-port>]+\n",
           program);
 
   fprintf(stderr,
@@ -82,6 +269,35 @@ void usage(const char* program)
   fprintf(stderr, "<ip-port> ::= <ip-address>:<port>\n");
   fprintf(stderr, "<ip-address> ::= <ipv4-address> | <ipv6-address>\n");
   fprintf(stderr, "<port-range> ::= <port>-<port>\n");
+  fprintf(stderr, "<event-loop> ::= epoll | io_uring\n");
+  fprintf(stderr, "<pinning> ::= none | core | node\n");
+  fprintf(stderr, "<cpu-list> ::= <cpus> | <cpus>,<cpu-list>\n");
+  fprintf(stderr, "<cpus> ::= <cpu> | <cpu>-<cpu>\n");
+  fprintf(stderr, "<steering> ::= hash | cpu | load\n");
+
+  fprintf(stderr,
+          "<routing> ::= broadcast | round-robin | least-pending | hash\n");
+
+  fprintf(stderr,
+          "<delimiter> ::= <character> | \\n | \\r | \\t | \\0 | "
+          "0x<hex-digit><hex-digit>\n");
+
+  fprintf(stderr, "<length-size> ::= 1 | 2 | 4\n");
+
+  fprintf(stderr,
+          "<backpressure> ::= drop-upstream | pause-downstream | "
+          "drop-after-timeout\n");
+
+  fprintf(stderr,
+          "<tuning> ::= default | <tuning-options>\n"
+          "<tuning-options> ::= <tuning-option> | "
+          "<tuning-option>,<tuning-options>\n"
+          "<tuning-option> ::= sndbuf=<bytes> | rcvbuf=<bytes> | nodelay | "
+          "cork |\n"
+          "                    notsent-lowat=<bytes> | "
+          "busy-poll=<microseconds> |\n"
+          "                    keepalive=<seconds>:<seconds>:<probes> |\n"
+          "                    congestion=<algorithm>\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Minimum number of workers: 1.\n");
 
@@ -90,18 +306,372 @@ void usage(const char* program)
           net::tcp::forwarder::max_workers);
 
   fprintf(stderr,
-          "Default number of workers: %zu.\n",
-          net::tcp::forwarder::default_workers);
+          "Default number of workers: number of available CPUs (affinity "
+          "mask and CPU quota).\n");
+
+  fprintf(stderr, "Default event loop: epoll.\n");
+
+  fprintf(stderr,
+          "--splice: forward the data with splice()/tee() "
+          "(only with epoll).\n");
+
+  fprintf(stderr,
+          "--pin-workers: run each worker on its own CPU (core) or on the "
+          "CPUs of\n"
+          "               the NUMA node of its CPU (node); default: none.\n");
+
+  fprintf(stderr,
+          "--cpu-affinity: run the workers only on these CPUs (by default, "
+          "one worker\n"
+          "                per CPU, each worker pinned to its CPU).\n");
+
+  fprintf(stderr,
+          "--steering: distribute the new connections among the workers by "
+          "the kernel's\n"
+          "            hash (default), by the CPU processing the packets (cpu) "
+          "or to the\n"
+          "            least loaded of two random workers (load).\n");
+
+  fprintf(stderr,
+          "--admin: serve the metrics (HTTP, Prometheus text format) on "
+          "<ip-port>.\n");
+
+  fprintf(stderr,
+          "--routing: routing of the sessions of the next listeners: to all "
+          "the upstream\n"
+          "           servers (broadcast, default), to one upstream server in "
+          "turns\n"
+          "           (round-robin), to the one with less bytes pending of two "
+          "random\n"
+          "           ones (least-pending) or by consistent hashing of the "
+          "client\n"
+          "           address (hash).\n");
+
+  fprintf(stderr,
+          "--listener-tuning: tuning profile of the sockets of the next "
+          "listeners and of\n"
+          "                   the listeners of \"--listeners-file\" (the "
+          "accepted\n"
+          "                   connections inherit it; default: default).\n");
+
+  fprintf(stderr,
+          "--listeners-file: read the listeners from <file> (\"--routing\" "
+          "and \"--bind\"\n"
+          "                  options, '#' starts a comment) and read it "
+          "again on SIGHUP or\n"
+          "                  \"POST /reload\" to the admin address: the "
+          "forwarder starts\n"
+          "                  listening on the new addresses and stops "
+          "listening on the\n"
+          "                  addresses which have been removed (the routing "
+          "of the\n"
+          "                  addresses already listened on doesn't change).\n");
+
+  fprintf(stderr,
+          "--upstream-group: the next upstream servers form a group where "
+          "the sessions\n"
+          "                  are routed with <routing>, independently of the "
+          "other\n"
+          "                  groups (the upstream servers before the first "
+          "group are\n"
+          "                  routed with the routing of the listener; maximum "
+          "number of\n"
+          "                  groups: %zu).\n",
+          net::tcp::router::max_groups - 1);
+
+  fprintf(stderr,
+          "<quorum>: the sessions are closed when they are forwarded to less "
+          "upstream\n"
+          "          servers of the group (only broadcast; default: 1).\n");
+
+  fprintf(stderr,
+          "<weight>: weight of the upstream server (round-robin, "
+          "least-pending and hash;\n"
+          "          1 - %u, default: 1).\n",
+          net::tcp::router::max_weight);
+
+  fprintf(stderr,
+          "--upstreams-file: read the upstream servers from <file> "
+          "(\"--upstream-group\" and\n"
+          "                  \"--upstream-server\" options, '#' starts a "
+          "comment) and read it\n"
+          "                  again on SIGHUP or \"POST /reload\" to the "
+          "admin address; the\n"
+          "                  new sessions are routed with the new list (not "
+          "with --multiplex\n"
+          "                  or --aggregate).\n");
+
+  fprintf(stderr,
+          "--upstream-tuning: tuning profile of the connections to the next "
+          "upstream\n"
+          "                   servers (also in \"--upstreams-file\"; "
+          "default: default).\n");
+
+  fprintf(stderr,
+          "<tuning>: socket options (the rest keep the kernel's defaults): "
+          "buffer sizes,\n"
+          "          TCP_NODELAY or TCP_CORK (the partial segments are sent at "
+          "the end of\n"
+          "          each iteration of the event loop), TCP_NOTSENT_LOWAT (the "
+          "rest of the\n"
+          "          data stays in the forwarder's queue), SO_BUSY_POLL, "
+          "keepalive (idle\n"
+          "          time, interval and number of probes) and congestion "
+          "control algorithm.\n");
+
+  fprintf(stderr,
+          "--multiplex: forward the sessions over <number-connections> "
+          "persistent\n"
+          "             connections per upstream server and worker (framing: "
+          "32-bit\n"
+          "             session id, 8-bit type (1: open, 2: data, 3: close), "
+          "24-bit\n"
+          "             payload length, payload; big endian; only epoll "
+          "without\n"
+          "             --splice).\n");
+
+  fprintf(stderr,
+          "--aggregate: append the complete records of all the sessions to "
+          "<number-\n"
+          "             connections> persistent connections per upstream "
+          "server and\n"
+          "             worker (only epoll without --splice).\n");
+
+  fprintf(stderr,
+          "--record-delimiter: the records end with <delimiter> (default: "
+          "\\n; only with\n"
+          "                    --aggregate).\n");
+
+  fprintf(stderr,
+          "--record-length: the records start with their length (big "
+          "endian,\n"
+          "                 <length-size> bytes; only with --aggregate).\n");
+
+  fprintf(stderr,
+          "--backpressure: when an upstream server cannot keep up (1 MB "
+          "pending), close its\n"
+          "                connection (drop-upstream, default) or stop "
+          "reading from the\n"
+          "                client until the upstream connections of the "
+          "session drain below\n"
+          "                256 KB (pause-downstream), closing the ones which "
+          "don't drain in\n"
+          "                time (drop-after-timeout).\n");
+
+  fprintf(stderr,
+          "--backpressure-timeout: milliseconds an upstream connection can "
+          "stay full\n"
+          "                        (drop-after-timeout; default: %" PRIu64
+          ").\n",
+          net::tcp::configuration().backpressure_timeout);
+
+  fprintf(stderr,
+          "--spill-dir: when the connection to an upstream server is full, "
+          "append the data\n"
+          "             to a memory-mapped ring file in <directory> and send "
+          "it once the\n"
+          "             upstream server catches up (the backpressure policy "
+          "applies when\n"
+          "             the ring is full; not with --splice, --multiplex or "
+          "--aggregate).\n");
+
+  fprintf(stderr,
+          "--spill-size: size of the ring file of each upstream server and "
+          "worker\n"
+          "              (default: %zu MB).\n",
+          net::tcp::spill::default_size / (1024 * 1024));
+
+  fprintf(stderr,
+          "--max-connections: maximum number of connections per worker "
+          "(default: maximum\n"
+          "                   number of open files divided among the "
+          "workers).\n");
+
+  fprintf(stderr,
+          "--connections-memory: maximum amount of memory for the connections "
+          "of each\n"
+          "                      worker (default: %zu MB).\n",
+          net::tcp::configuration::default_connections_memory /
+          (1024 * 1024));
+
+  fprintf(stderr,
+          "--memory-budget: maximum amount of memory for the data buffered by "
+          "all the\n"
+          "                 workers (default: unlimited); the buffers of the "
+          "upstream\n"
+          "                 connections shrink as the usage goes over half of "
+          "the budget.\n");
+
+  fprintf(stderr,
+          "--drain-timeout: on SIGTERM, stop accepting and reading from the "
+          "clients and\n"
+          "                 wait up to <milliseconds> for the data received "
+          "to be sent to\n"
+          "                 the upstream servers (default: %" PRIu64 "; "
+          "SIGINT or a second\n"
+          "                 SIGTERM stop at once); the data which couldn't "
+          "be sent is\n"
+          "                 reported.\n",
+          net::tcp::configuration().drain_timeout);
+
+  fprintf(stderr,
+          "--circuit-breaker: after <failures> consecutive failed connections "
+          "to an\n"
+          "                   upstream server, the new sessions skip it for "
+          "%" PRIu64 " ms,\n"
+          "                   then a single session tries it again "
+          "(doubling the time\n"
+          "                   up to %" PRIu64 " ms while it keeps failing; "
+          "default: disabled).\n",
+          net::tcp::health::min_backoff,
+          net::tcp::health::max_backoff);
+
+  fprintf(stderr,
+          "--health-check: connect to each upstream server every "
+          "<milliseconds> and\n"
+          "                count the result as if it was a session "
+          "(requires\n"
+          "                \"--circuit-breaker\").\n");
+
+  fprintf(stderr,
+          "--connect-timeout: close the upstream connections which are not "
+          "established\n"
+          "                   after <milliseconds> (default: no "
+          "timeout).\n");
+
+  fprintf(stderr,
+          "--idle-timeout: close the sessions which don't receive data from "
+          "the client\n"
+          "                for <milliseconds> (default: no timeout).\n");
+
+  fprintf(stderr,
+          "--write-timeout: close the upstream connections which have data "
+          "pending and\n"
+          "                 don't send anything for <milliseconds> (default: "
+          "no timeout).\n");
+
+  fprintf(stderr,
+          "--replay-window: keep up to <kilobytes> (at most %zu) from the "
+          "start of each\n"
+          "                 session and, when an upstream connection fails, "
+          "open a new\n"
+          "                 one (to the next upstream server of its group) "
+          "and replay the\n"
+          "                 session from its start; once a session outgrows "
+          "the window, it\n"
+          "                 is not replayed anymore (not with --splice, "
+          "--multiplex or\n"
+          "                 --aggregate).\n",
+          net::tcp::connection::max_buffer_size / 1024);
+
+  fprintf(stderr,
+          "--max-reconnects: maximum number of upstream connections opened "
+          "to replay a\n"
+          "                  session (default: %zu).\n",
+          net::tcp::configuration().max_reconnects);
+
+  fprintf(stderr,
+          "--fastopen: accept TCP Fast Open connections, with up to "
+          "<queue-length>\n"
+          "            pending requests per listener (the bit 2 of "
+          "net.ipv4.tcp_fastopen\n"
+          "            has to be set).\n");
+
+  fprintf(stderr,
+          "--fastopen-connect: connect to the upstream servers with TCP Fast "
+          "Open (the\n"
+          "                    first data of the session goes in the SYN once "
+          "the upstream\n"
+          "                    server has given a cookie; not with "
+          "--splice).\n");
+
+  fprintf(stderr,
+          "--defer-accept: accept the connections once the client has sent "
+          "data or after\n"
+          "                <seconds> (TCP_DEFER_ACCEPT; default: as soon as "
+          "they are\n"
+          "                established).\n");
+
+  fprintf(stderr,
+          "--upgrade-socket: hand the listening sockets over to a new process "
+          "which\n"
+          "                  connects to the UNIX socket <path> "
+          "(\"--upgrade-from\"), stop\n"
+          "                  accepting connections and exit once the "
+          "sessions end.\n");
+
+  fprintf(stderr,
+          "--upgrade-from: take over the listening sockets of the process "
+          "listening on\n"
+          "                the UNIX socket <path> (same number of workers and "
+          "event loop).\n");
+
+  fprintf(stderr,
+          "Maximum number of upstream servers: %zu.\n",
+          net::tcp::metrics::max_upstreams);
 
   fprintf(stderr, "\n");
 }
 
+void print_statistics(const net::tcp::forwarder& forwarder)
+{
+  net::tcp::connections::statistics stats;
+  for (size_t i = 0; forwarder.stats(i, stats); i++) {
+    printf("Worker %zu:\n", i);
+
+    // Connections.
+    uint64_t total = stats.hits + stats.misses;
+
+    printf("  Connections: %" PRIu64 " hit(s), %" PRIu64 " miss(es) "
+           "(hit rate: %.2f%%), %" PRIu64 " slab(s).\n",
+           stats.hits,
+           stats.misses,
+           (total > 0) ? (100.0 * stats.hits) / total : 0.0,
+           stats.slabs);
+
+    // Chunks.
+    for (size_t cls = 0; cls < string::chunks::nclasses; cls++) {
+      total = stats.chunks.hits[cls] + stats.chunks.misses[cls];
+
+      printf("  Chunks of %zu KB: %" PRIu64 " hit(s), %" PRIu64 " miss(es) "
+             "(hit rate: %.2f%%).\n",
+             string::chunks::class_size(cls) / 1024,
+             stats.chunks.hits[cls],
+             stats.chunks.misses[cls],
+             (total > 0) ? (100.0 * stats.chunks.hits[cls]) / total : 0.0);
+    }
+
+    printf("  Slabs of chunks: %" PRIu64 ".\n", stats.chunks.slabs);
+  }
+}
+
+void raise_open_files_limit()
+{
+  // Raise the soft limit to the hard limit.
+  struct rlimit rlim;
+  if ((getrlimit(RLIMIT_NOFILE, &rlim) == 0) &&
+      (rlim.rlim_cur < rlim.rlim_max)) {
+    rlim.rlim_cur = rlim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rlim);
+  }
+}
+
 bool parse_number_workers(int argc, const char* argv[], size_t& nworkers)
 {
-  nworkers = net::tcp::forwarder::default_workers;
+  // By default, one worker per available CPU.
+  nworkers = 0;
 
   int i = 1;
   while (i < argc) {
+    // If the CPU affinity has been set, by default, one worker per CPU of the
+    // list.
+    if ((strcasecmp(argv[i], "--cpu-affinity") == 0) && (i + 1 < argc)) {
+      cpu_set_t set;
+      if (os::cpus::parse_list(argv[i + 1], set)) {
+        nworkers = static_cast<size_t>(CPU_COUNT(&set));
+      }
+    }
+
     if (strcasecmp(argv[i], "--number-workers") == 0) {
       // If not the last argument...
       if (i + 1 < argc) {
@@ -132,12 +702,38 @@ bool parse_number_workers(int argc, const char* argv[], size_t& nworkers)
   return true;
 }
 
+bool parse_upgrade_from(int argc, const char* argv[], const char*& path)
+{
+  path = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcasecmp(argv[i], "--upgrade-from") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        path = argv[i + 1];
+        return true;
+      } else {
+        fprintf(stderr, "Expected path after \"--upgrade-from\".\n");
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 bool parse_arguments(int argc,
                      const char* argv[],
-                     net::tcp::forwarder& forwarder)
+                     net::tcp::forwarder& forwarder,
+                     options& opts)
 {
   size_t nbind = 0;
-  size_t nupstream = 0;
+
+  // Has the format of the records been specified?
+  bool records = false;
+
+  net::tcp::upstreams& upstreams = forwarder.upstreams();
+  upstream_parser parser;
 
   int i = 1;
   while (i < argc) {
@@ -183,13 +779,9 @@ bool parse_arguments(int argc,
       // If not the last argument...
       if (i + 1 < argc) {
         // Add upstream server.
-        if (forwarder.add_upstream_server(argv[i + 1])) {
-          // Increment number of upstream servers.
-          nupstream++;
-
+        if (parse_upstream_server(argv[i + 1], upstreams, parser)) {
           i += 2;
         } else {
-          fprintf(stderr, "Error adding upstream server '%s'.\n", argv[i + 1]);
           return false;
         }
       } else {
@@ -198,53 +790,1322 @@ bool parse_arguments(int argc,
 
         return false;
       }
-    } else if (strcasecmp(argv[i], "--number-workers") == 0) {
+    } else if (strcasecmp(argv[i], "--upstream-tuning") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (!parse_tuning(argv[i + 1], parser.tuning)) {
+          return false;
+        }
+
+        i += 2;
+      } else {
+        fprintf(stderr,
+                "Expected tuning profile after \"--upstream-tuning\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--upstream-group") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        // Add upstream group.
+        if (parse_upstream_group(argv[i + 1], upstreams, parser)) {
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected routing after \"--upstream-group\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--upstreams-file") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        opts.upstreams_file = argv[i + 1];
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected file after \"--upstreams-file\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--listeners-file") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        opts.listeners_file = argv[i + 1];
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected file after \"--listeners-file\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--upgrade-socket") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        opts.upgrade_socket = argv[i + 1];
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected path after \"--upgrade-socket\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--upgrade-from") == 0) {
       i += 2;
-    } else {
-      fprintf(stderr, "Invalid argument '%s'.\n", argv[i]);
-      return false;
-    }
-  }
+    } else if (strcasecmp(argv[i], "--routing") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        net::tcp::routing_policy policy;
+        if (!parse_routing(argv[i + 1], policy)) {
+          return false;
+        }
 
-  if (argc > 1) {
-    if ((nbind > 0) && (nupstream > 0)) {
-      return true;
-    } else if (nbind == 0) {
-      fprintf(stderr, "At least one bind address has to be specified.\n");
-    } else {
-      fprintf(stderr, "At least one upstream server has to be specified.\n");
-    }
-  } else {
-    usage(argv[0]);
-  }
+        forwarder.routing(policy);
 
-  return false;
-}
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected routing after \"--routing\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--listener-tuning") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        net::tcp::tuning tuning;
+        if (!parse_tuning(argv[i + 1], tuning)) {
+          return false;
+        }
 
-bool parse_ip_ports(const char* s,
-                    char* address,
-                    in_port_t& minport,
-                    in_port_t& maxport)
-{
-  // Search last colon.
-  const char* const last_colon = strrchr(s, ':');
+        forwarder.tuning(tuning);
 
-  // If the last colon was found...
-  if (last_colon) {
-    size_t len = last_colon - s;
-    if (len > 0) {
-      if (*s == '[') {
-        if ((len > 2) && (last_colon[-1] == ']')) {
-          // Skip '['.
-          s++;
+        i += 2;
+      } else {
+        fprintf(stderr,
+                "Expected tuning profile after \"--listener-tuning\".\n");
 
-          len -= 2;
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--number-workers") == 0) {
+      i += 2;
+    } else if (strcasecmp(argv[i], "--event-loop") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (strcasecmp(argv[i + 1], "epoll") == 0) {
+          forwarder.config().loop = net::tcp::event_loop::epoll;
+        } else if (strcasecmp(argv[i + 1], "io_uring") == 0) {
+          forwarder.config().loop = net::tcp::event_loop::io_uring;
         } else {
+          fprintf(stderr, "Invalid event loop '%s'.\n", argv[i + 1]);
           return false;
         }
+
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected event loop after \"--event-loop\".\n");
+        return false;
       }
+    } else if (strcasecmp(argv[i], "--splice") == 0) {
+      forwarder.config().splice = true;
+      i++;
+    } else if (strcasecmp(argv[i], "--pin-workers") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (strcasecmp(argv[i + 1], "none") == 0) {
+          forwarder.config().pin = net::tcp::pinning::none;
+        } else if (strcasecmp(argv[i + 1], "core") == 0) {
+          forwarder.config().pin = net::tcp::pinning::core;
+        } else if (strcasecmp(argv[i + 1], "node") == 0) {
+          forwarder.config().pin = net::tcp::pinning::node;
+        } else {
+          fprintf(stderr, "Invalid pinning '%s'.\n", argv[i + 1]);
+          return false;
+        }
 
-      if (len < INET6_ADDRSTRLEN) {
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected pinning after \"--pin-workers\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--cpu-affinity") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (forwarder.cpu_affinity(argv[i + 1])) {
+          i += 2;
+        } else {
+          fprintf(stderr, "Invalid CPU affinity '%s'.\n", argv[i + 1]);
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected list of CPUs after \"--cpu-affinity\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--steering") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (strcasecmp(argv[i + 1], "hash") == 0) {
+          forwarder.config().steer = net::tcp::steering_policy::hash;
+        } else if (strcasecmp(argv[i + 1], "cpu") == 0) {
+          forwarder.config().steer = net::tcp::steering_policy::cpu;
+        } else if (strcasecmp(argv[i + 1], "load") == 0) {
+          forwarder.config().steer = net::tcp::steering_policy::load;
+        } else {
+          fprintf(stderr, "Invalid steering '%s'.\n", argv[i + 1]);
+          return false;
+        }
+
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected steering after \"--steering\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--multiplex") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "number of multiplexed connections",
+                         n,
+                         1,
+                         1024)) {
+          forwarder.config().multiplex = static_cast<size_t>(n);
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected number of connections after \"--multiplex\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--aggregate") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "number of aggregated connections",
+                         n,
+                         1,
+                         1024)) {
+          forwarder.config().multiplex = static_cast<size_t>(n);
+          forwarder.config().aggregate = true;
+
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected number of connections after \"--aggregate\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--record-delimiter") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (parse_delimiter(argv[i + 1],
+                            forwarder.config().record_delimiter)) {
+          forwarder.config().records = net::tcp::record_format::delimiter;
+          records = true;
+
+          i += 2;
+        } else {
+          fprintf(stderr, "Invalid record delimiter '%s'.\n", argv[i + 1]);
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected delimiter after \"--record-delimiter\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--record-length") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "size of the record length",
+                         n,
+                         1,
+                         4)) {
+          if (n != 3) {
+            forwarder.config().records = net::tcp::record_format::length;
+            forwarder.config().record_length_size = static_cast<size_t>(n);
+            records = true;
+
+            i += 2;
+          } else {
+            fprintf(stderr,
+                    "Invalid size of the record length '%s' (1, 2 or 4).\n",
+                    argv[i + 1]);
+
+            return false;
+          }
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected size of the length after \"--record-length\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--backpressure") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (strcasecmp(argv[i + 1], "drop-upstream") == 0) {
+          forwarder.config().backpressure =
+            net::tcp::backpressure_policy::drop_upstream;
+        } else if (strcasecmp(argv[i + 1], "pause-downstream") == 0) {
+          forwarder.config().backpressure =
+            net::tcp::backpressure_policy::pause_downstream;
+        } else if (strcasecmp(argv[i + 1], "drop-after-timeout") == 0) {
+          forwarder.config().backpressure =
+            net::tcp::backpressure_policy::drop_after_timeout;
+        } else {
+          fprintf(stderr, "Invalid backpressure '%s'.\n", argv[i + 1]);
+          return false;
+        }
+
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected backpressure after \"--backpressure\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--backpressure-timeout") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "backpressure timeout",
+                         n,
+                         1,
+                         UINT32_MAX)) {
+          forwarder.config().backpressure_timeout = n;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected milliseconds after \"--backpressure-timeout\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--spill-dir") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        forwarder.config().spill_dir = argv[i + 1];
+        i += 2;
+      } else {
+        fprintf(stderr, "Expected directory after \"--spill-dir\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--spill-size") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "size of the spill queue",
+                         n,
+                         1,
+                         SIZE_MAX / (1024 * 1024))) {
+          forwarder.config().spill_size = static_cast<size_t>(n) * 1024 * 1024;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected megabytes after \"--spill-size\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--max-connections") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "maximum number of connections",
+                         n,
+                         1,
+                         SIZE_MAX)) {
+          forwarder.config().max_connections = static_cast<size_t>(n);
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected number of connections after "
+                "\"--max-connections\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--connections-memory") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "memory for the connections",
+                         n,
+                         1,
+                         SIZE_MAX / (1024 * 1024))) {
+          forwarder.config().connections_memory = static_cast<size_t>(n) *
+                                                  1024 *
+                                                  1024;
+
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected megabytes after \"--connections-memory\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--memory-budget") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "memory budget",
+                         n,
+                         1,
+                         SIZE_MAX / (1024 * 1024))) {
+          forwarder.config().memory_budget = static_cast<size_t>(n) *
+                                             1024 *
+                                             1024;
+
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected megabytes after \"--memory-budget\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--drain-timeout") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "drain timeout",
+                         n,
+                         0,
+                         UINT32_MAX)) {
+          forwarder.config().drain_timeout = n;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected milliseconds after \"--drain-timeout\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--circuit-breaker") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "number of failures",
+                         n,
+                         1,
+                         UINT32_MAX)) {
+          forwarder.config().breaker_failures = static_cast<size_t>(n);
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected number of failures after \"--circuit-breaker\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--health-check") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "health check interval",
+                         n,
+                         1,
+                         UINT32_MAX)) {
+          forwarder.config().health_interval = n;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected milliseconds after \"--health-check\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--connect-timeout") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "connect timeout",
+                         n,
+                         1,
+                         UINT32_MAX)) {
+          forwarder.config().connect_timeout = n;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected milliseconds after \"--connect-timeout\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--idle-timeout") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "idle timeout",
+                         n,
+                         1,
+                         UINT32_MAX)) {
+          forwarder.config().idle_timeout = n;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected milliseconds after \"--idle-timeout\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--write-timeout") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "write timeout",
+                         n,
+                         1,
+                         UINT32_MAX)) {
+          forwarder.config().write_timeout = n;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected milliseconds after \"--write-timeout\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--replay-window") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "replay window",
+                         n,
+                         1,
+                         net::tcp::connection::max_buffer_size / 1024)) {
+          forwarder.config().replay_window = static_cast<size_t>(n) * 1024;
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected kilobytes after \"--replay-window\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--fastopen") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "length of the TCP Fast Open queue",
+                         n,
+                         1,
+                         INT_MAX)) {
+          forwarder.config().fastopen = static_cast<size_t>(n);
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected queue length after \"--fastopen\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--fastopen-connect") == 0) {
+      forwarder.config().fastopen_connect = true;
+      i++;
+    } else if (strcasecmp(argv[i], "--defer-accept") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "defer accept timeout",
+                         n,
+                         1,
+                         INT_MAX)) {
+          forwarder.config().defer_accept = static_cast<unsigned>(n);
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected seconds after \"--defer-accept\".\n");
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--max-reconnects") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        uint64_t n;
+        if (parse_number(argv[i + 1],
+                         strlen(argv[i + 1]),
+                         "maximum number of reconnections",
+                         n,
+                         1,
+                         UINT32_MAX)) {
+          forwarder.config().max_reconnects = static_cast<size_t>(n);
+          i += 2;
+        } else {
+          return false;
+        }
+      } else {
+        fprintf(stderr,
+                "Expected number of connections after "
+                "\"--max-reconnects\".\n");
+
+        return false;
+      }
+    } else if (strcasecmp(argv[i], "--admin") == 0) {
+      // If not the last argument...
+      if (i + 1 < argc) {
+        if (forwarder.listen_admin(argv[i + 1])) {
+          i += 2;
+        } else {
+          fprintf(stderr,
+                  "Error listening on admin address '%s'.\n",
+                  argv[i + 1]);
+
+          return false;
+        }
+      } else {
+        fprintf(stderr, "Expected IP address and port after \"--admin\".\n");
+        return false;
+      }
+    } else {
+      fprintf(stderr, "Invalid argument '%s'.\n", argv[i]);
+      return false;
+    }
+  }
+
+  if (argc > 1) {
+    if ((forwarder.config().splice) &&
+        (forwarder.config().loop != net::tcp::event_loop::epoll)) {
+      fprintf(stderr, "\"--splice\" requires the epoll event loop.\n");
+    } else if ((forwarder.config().multiplex > 0) &&
+               ((forwarder.config().splice) ||
+                (forwarder.config().loop != net::tcp::event_loop::epoll))) {
+      fprintf(stderr,
+              "\"--multiplex\" and \"--aggregate\" require the epoll event "
+              "loop without \"--splice\".\n");
+    } else if ((records) && (!forwarder.config().aggregate)) {
+      fprintf(stderr,
+              "\"--record-delimiter\" and \"--record-length\" require "
+              "\"--aggregate\".\n");
+    } else if ((forwarder.config().health_interval > 0) &&
+               (forwarder.config().breaker_failures == 0)) {
+      fprintf(stderr,
+              "\"--health-check\" requires \"--circuit-breaker\".\n");
+    } else if ((forwarder.config().fastopen_connect) &&
+               (forwarder.config().splice)) {
+      fprintf(stderr,
+              "\"--fastopen-connect\" cannot be used with \"--splice\".\n");
+    } else if ((forwarder.config().replay_window > 0) &&
+               ((forwarder.config().splice) ||
+                (forwarder.config().multiplex > 0))) {
+      fprintf(stderr,
+              "\"--replay-window\" cannot be used with \"--splice\", "
+              "\"--multiplex\" and \"--aggregate\".\n");
+    } else if ((forwarder.config().spill_dir) &&
+               ((forwarder.config().splice) ||
+                (forwarder.config().multiplex > 0))) {
+      fprintf(stderr,
+              "\"--spill-dir\" cannot be used with \"--splice\", "
+              "\"--multiplex\" and \"--aggregate\".\n");
+    } else if ((forwarder.config().multiplex > 0) && (opts.upstreams_file)) {
+      fprintf(stderr,
+              "\"--upstreams-file\" cannot be used with \"--multiplex\" and "
+              "\"--aggregate\".\n");
+    } else if ((opts.upstreams_file) &&
+               ((upstreams.addresses().count() > 0) ||
+                (upstreams.router().number_groups() > 1))) {
+      fprintf(stderr,
+              "\"--upstreams-file\" cannot be used with "
+              "\"--upstream-server\" and \"--upstream-group\".\n");
+    } else if ((opts.upstreams_file) &&
+               (!load_upstreams(opts.upstreams_file, upstreams))) {
+      // The error has already been reported.
+    } else if ((opts.listeners_file) && (nbind > 0)) {
+      fprintf(stderr,
+              "\"--listeners-file\" cannot be used with \"--bind\".\n");
+    } else if ((opts.listeners_file) &&
+               (!update_listeners(forwarder, opts.listeners_file))) {
+      // The error has already been reported.
+    } else if (upstreams.addresses().count() - parser.group_first <
+               parser.group_quorum) {
+      fprintf(stderr,
+              "An upstream group has less upstream servers than its quorum.\n");
+    } else if ((forwarder.number_listeners() > 0) &&
+               (upstreams.addresses().count() > 0)) {
+      return true;
+    } else if (forwarder.number_listeners() == 0) {
+      fprintf(stderr, "At least one bind address has to be specified.\n");
+    } else {
+      fprintf(stderr, "At least one upstream server has to be specified.\n");
+    }
+  } else {
+    usage(argv[0]);
+  }
+
+  return false;
+}
+
+bool parse_upstream_server(const char* s,
+                           net::tcp::upstreams& upstreams,
+                           const upstream_parser& parser)
+{
+  // Weight?
+  const char* const slash = strchr(s, '/');
+
+  char address[64];
+  const char* upstream = s;
+
+  uint64_t weight = 1;
+
+  if (slash) {
+    const size_t len = slash - s;
+
+    if (len >= sizeof(address)) {
+      fprintf(stderr, "Upstream server '%s' is too long.\n", s);
+      return false;
+    }
+
+    if (!parse_number(slash + 1,
+                      strlen(slash + 1),
+                      "weight",
+                      weight,
+                      1,
+                      net::tcp::router::max_weight)) {
+      return false;
+    }
+
+    memcpy(address, s, len);
+    address[len] = 0;
+
+    upstream = address;
+  }
+
+  // Add upstream server.
+  if ((upstreams.addresses().add(upstream)) &&
+      (upstreams.router().weight(upstreams.addresses().count() - 1,
+                                 static_cast<unsigned>(weight))) &&
+      (upstreams.tuning(upstreams.addresses().count() - 1, parser.tuning))) {
+    return true;
+  }
+
+  fprintf(stderr, "Error adding upstream server '%s'.\n", s);
+  return false;
+}
+
+bool parse_upstream_group(const char* s,
+                          net::tcp::upstreams& upstreams,
+                          upstream_parser& parser)
+{
+  // If the previous group cannot reach its quorum...
+  if (upstreams.addresses().count() - parser.group_first <
+      parser.group_quorum) {
+    fprintf(stderr,
+            "An upstream group has less upstream servers than its quorum.\n");
+
+    return false;
+  }
+
+  // Quorum?
+  const char* const slash = strchr(s, '/');
+
+  char name[32];
+  const char* routing = s;
+
+  uint64_t quorum = 1;
+
+  if (slash) {
+    const size_t len = slash - s;
+
+    if (len >= sizeof(name)) {
+      fprintf(stderr, "Invalid routing '%s'.\n", s);
+      return false;
+    }
+
+    if (!parse_number(slash + 1,
+                      strlen(slash + 1),
+                      "quorum",
+                      quorum,
+                      1,
+                      net::tcp::metrics::max_upstreams)) {
+      return false;
+    }
+
+    memcpy(name, s, len);
+    name[len] = 0;
+
+    routing = name;
+  }
+
+  net::tcp::routing_policy policy;
+  if (!parse_routing(routing, policy)) {
+    return false;
+  }
+
+  // Only the broadcast groups can have a quorum higher than 1.
+  if ((quorum > 1) && (policy != net::tcp::routing_policy::broadcast)) {
+    fprintf(stderr,
+            "Only the upstream groups with broadcast routing can have a "
+            "quorum.\n");
+
+    return false;
+  }
+
+  // Add upstream group.
+  if ((!upstreams.group(policy)) || (!upstreams.quorum(quorum))) {
+    fprintf(stderr, "Too many upstream groups.\n");
+    return false;
+  }
+
+  parser.group_first = upstreams.addresses().count();
+  parser.group_quorum = quorum;
+
+  return true;
+}
+
+bool check_upstreams(const net::tcp::upstreams& upstreams,
+                     const upstream_parser& parser)
+{
+  if (upstreams.addresses().count() - parser.group_first <
+      parser.group_quorum) {
+    fprintf(stderr,
+            "An upstream group has less upstream servers than its quorum.\n");
+  } else if (upstreams.addresses().count() == 0) {
+    fprintf(stderr, "At least one upstream server has to be specified.\n");
+  } else {
+    return true;
+  }
+
+  return false;
+}
+
+bool load_upstreams(const char* filename, net::tcp::upstreams& upstreams)
+{
+  // Open file.
+  FILE* const file = fopen(filename, "r");
+  if (!file) {
+    fprintf(stderr, "Error opening upstreams file '%s'.\n", filename);
+    return false;
+  }
+
+  upstream_parser parser;
+
+  // Option waiting for its value.
+  const char* option = nullptr;
+
+  char* line = nullptr;
+  size_t size = 0;
+  unsigned nline = 0;
+
+  bool ret = true;
+
+  // For each line...
+  while ((ret) && (getline(&line, &size, file) != -1)) {
+    nline++;
+
+    // Remove comment (if any).
+    char* const comment = strchr(line, '#');
+    if (comment) {
+      *comment = 0;
+    }
+
+    // For each token...
+    char* saveptr;
+    for (char* token = strtok_r(line, " \t\r\n", &saveptr);
+         token;
+         token = strtok_r(nullptr, " \t\r\n", &saveptr)) {
+      // If the token is an option...
+      if (!option) {
+        if (strcasecmp(token, "--upstream-server") == 0) {
+          option = "--upstream-server";
+        } else if (strcasecmp(token, "--upstream-group") == 0) {
+          option = "--upstream-group";
+        } else if (strcasecmp(token, "--upstream-tuning") == 0) {
+          option = "--upstream-tuning";
+        } else {
+          fprintf(stderr,
+                  "Invalid argument '%s' in '%s' (line %u).\n",
+                  token,
+                  filename,
+                  nline);
+
+          ret = false;
+          break;
+        }
+      } else {
+        // Add upstream server or upstream group or set the tuning profile of
+        // the next upstream servers.
+        if (!((strcasecmp(option, "--upstream-server") == 0) ?
+                parse_upstream_server(token, upstreams, parser) :
+                (strcasecmp(option, "--upstream-group") == 0) ?
+                  parse_upstream_group(token, upstreams, parser) :
+                  parse_tuning(token, parser.tuning))) {
+          fprintf(stderr, "Error in '%s' (line %u).\n", filename, nline);
+
+          ret = false;
+          break;
+        }
+
+        option = nullptr;
+      }
+    }
+  }
+
+  if (line) {
+    free(line);
+  }
+
+  fclose(file);
+
+  if (ret) {
+    if (option) {
+      fprintf(stderr,
+              "Expected value after \"%s\" in '%s'.\n",
+              option,
+              filename);
+    } else {
+      return check_upstreams(upstreams, parser);
+    }
+  }
+
+  return false;
+}
+
+void reload_upstreams(net::tcp::forwarder& forwarder, const char* filename)
+{
+  if (!filename) {
+    fprintf(stderr,
+            "The upstream servers cannot be reloaded without "
+            "\"--upstreams-file\".\n");
+
+    return;
+  }
+
+  // Load the new list of upstream servers.
+  net::tcp::upstreams* const upstreams = new (std::nothrow)
+                                           net::tcp::upstreams();
+
+  if (!upstreams) {
+    fprintf(stderr, "Error allocating the list of upstream servers.\n");
+    return;
+  }
+
+  if (load_upstreams(filename, *upstreams)) {
+    const size_t count = upstreams->addresses().count();
+
+    // Replace the list of upstream servers (the forwarder takes ownership of
+    // the list).
+    if (forwarder.reload(upstreams)) {
+      printf("Upstream servers reloaded (%zu upstream server(s)).\n", count);
+      return;
+    }
+
+    fprintf(stderr, "Error reloading the upstream servers.\n");
+  }
+
+  delete upstreams;
+}
+
+bool load_listeners(const char* filename, listener_list& listeners)
+{
+  // Open file.
+  FILE* const file = fopen(filename, "r");
+  if (!file) {
+    fprintf(stderr, "Error opening listeners file '%s'.\n", filename);
+    return false;
+  }
+
+  // Routing policy of the next listeners.
+  net::tcp::routing_policy policy = net::tcp::routing_policy::broadcast;
+
+  // Option waiting for its value.
+  const char* option = nullptr;
+
+  char* line = nullptr;
+  size_t size = 0;
+  unsigned nline = 0;
+
+  bool ret = true;
+
+  // For each line...
+  while ((ret) && (getline(&line, &size, file) != -1)) {
+    nline++;
+
+    // Remove comment (if any).
+    char* const comment = strchr(line, '#');
+    if (comment) {
+      *comment = 0;
+    }
+
+    // For each token...
+    char* saveptr;
+    for (char* token = strtok_r(line, " \t\r\n", &saveptr);
+         token;
+         token = strtok_r(nullptr, " \t\r\n", &saveptr)) {
+      // If the token is an option...
+      if (!option) {
+        if (strcasecmp(token, "--bind") == 0) {
+          option = "--bind";
+        } else if (strcasecmp(token, "--routing") == 0) {
+          option = "--routing";
+        } else {
+          fprintf(stderr,
+                  "Invalid argument '%s' in '%s' (line %u).\n",
+                  token,
+                  filename,
+                  nline);
+
+          ret = false;
+          break;
+        }
+      } else {
+        // Add listening address(es) or set the routing policy of the next
+        // ones.
+        if (strcasecmp(option, "--bind") == 0) {
+          char address[INET6_ADDRSTRLEN];
+          in_port_t minport;
+          in_port_t maxport;
+
+          if ((!parse_ip_ports(token, address, minport, maxport)) ||
+              (!listeners.addresses[static_cast<size_t>(policy)].add(
+                  address,
+                  minport,
+                  maxport
+                ))) {
+            ret = false;
+          }
+        } else if (!parse_routing(token, policy)) {
+          ret = false;
+        }
+
+        if (!ret) {
+          fprintf(stderr, "Error in '%s' (line %u).\n", filename, nline);
+          break;
+        }
+
+        option = nullptr;
+      }
+    }
+  }
+
+  if (line) {
+    free(line);
+  }
+
+  fclose(file);
+
+  if (ret) {
+    if (!option) {
+      return true;
+    }
+
+    fprintf(stderr,
+            "Expected value after \"%s\" in '%s'.\n",
+            option,
+            filename);
+  }
+
+  return false;
+}
+
+bool update_listeners(net::tcp::forwarder& forwarder, const char* filename)
+{
+  // Load the listeners.
+  listener_list listeners;
+  if (!load_listeners(filename, listeners)) {
+    return false;
+  }
+
+  // Stop listening on the addresses which have been removed from the file.
+  for (size_t i = forwarder.number_listeners(); i > 0; i--) {
+    const net::socket::address addr = *forwarder.listener_address(i - 1);
+
+    bool found = false;
+    for (size_t j = 0;
+         (!found) &&
+         (j < sizeof(listeners.addresses) / sizeof(listeners.addresses[0]));
+         j++) {
+      const net::socket::address* address;
+      for (size_t k = 0;
+           (address = listeners.addresses[j].address(k)) != nullptr;
+           k++) {
+        if (*address == addr) {
+          found = true;
+          break;
+        }
+      }
+    }
+
+    if (!found) {
+      forwarder.unlisten(addr);
+    }
+  }
+
+  // Listen on the new addresses (the addresses which are already listened on
+  // keep their routing policy).
+  bool ret = true;
+  for (size_t i = 0;
+       i < sizeof(listeners.addresses) / sizeof(listeners.addresses[0]);
+       i++) {
+    forwarder.routing(static_cast<net::tcp::routing_policy>(i));
+
+    const net::socket::address* address;
+    for (size_t j = 0;
+         (address = listeners.addresses[i].address(j)) != nullptr;
+         j++) {
+      if (!forwarder.listen(*address)) {
+        char s[INET6_ADDRSTRLEN + 8];
+        fprintf(stderr,
+                "Error listening on '%s'.\n",
+                address->to_string(s, sizeof(s)) ? s : "?");
+
+        ret = false;
+      }
+    }
+  }
+
+  return ret;
+}
+
+void reload_listeners(net::tcp::forwarder& forwarder, const char* filename)
+{
+  if (update_listeners(forwarder, filename)) {
+    printf("Listeners reloaded (%zu listening address(es)).\n",
+           forwarder.number_listeners());
+  } else {
+    fprintf(stderr, "Error reloading the listeners.\n");
+  }
+}
+
+bool inherit_listeners(net::tcp::forwarder& forwarder,
+                       const char* path,
+                       int& sock,
+                       net::tcp::event_loop& loop)
+{
+  // Connect to the old process.
+  if ((sock = net::tcp::upgrade::connect(path)) == -1) {
+    fprintf(stderr, "Error connecting to the upgrade socket '%s'.\n", path);
+    return false;
+  }
+
+  // Receive its listening sockets.
+  size_t nworkers = 0;
+  if (forwarder.inherit(sock, nworkers, loop)) {
+    return true;
+  }
+
+  if ((nworkers > 0) && (nworkers != forwarder.number_workers())) {
+    fprintf(stderr,
+            "The number of workers has to be the same as the one of the old "
+            "process (%zu).\n",
+            nworkers);
+  } else {
+    fprintf(stderr,
+            "Error receiving the listening sockets of the old process.\n");
+  }
+
+  close(sock);
+  sock = -1;
+
+  return false;
+}
+
+void wait_for_signal(net::tcp::forwarder& forwarder,
+                     const sigset_t& set,
+                     const options& opts,
+                     int upgrade)
+{
+  static constexpr const uint64_t drain_interval = 100; // Milliseconds.
+
+  // Receive the signals through a file descriptor, so the process can also
+  // wait for the new process (binary upgrade).
+  const int sigfd = signalfd(-1, &set, SFD_CLOEXEC);
+  if (sigfd == -1) {
+    fprintf(stderr, "Error creating signal file descriptor.\n");
+    return;
+  }
+
+  struct pollfd fds[2];
+  fds[0].fd = sigfd;
+  fds[0].events = POLLIN;
+  fds[1].fd = upgrade;
+  fds[1].events = POLLIN;
+
+  // Have the listening sockets been handed over to a new process or has the
+  // forwarder been drained (SIGTERM)?
+  bool draining = false;
+
+  // When the drain ends (0: when the sessions end).
+  uint64_t deadline = 0;
+
+  do {
+    // While draining, check periodically whether the sessions have ended.
+    int timeout = -1;
+    if (draining) {
+      timeout = static_cast<int>(drain_interval);
+
+      if (deadline != 0) {
+        const uint64_t now = net::tcp::connections::now();
+        if (now >= deadline) {
+          printf("Drain timeout expired.\n");
+          break;
+        }
+
+        if (deadline - now < drain_interval) {
+          timeout = static_cast<int>(deadline - now);
+        }
+      }
+    }
+
+    if (poll(fds, 2, timeout) > 0) {
+      // Signal?
+      if (fds[0].revents & POLLIN) {
+        struct signalfd_siginfo info;
+        if (read(sigfd, &info, sizeof(info)) == sizeof(info)) {
+          if (info.ssi_signo == SIGTERM) {
+            // A second SIGTERM stops the forwarder.
+            if (deadline != 0) {
+              printf("Signal received.\n");
+              break;
+            }
+
+            // Drain the sessions: the data received is sent to the upstream
+            // servers (for `drain_timeout` milliseconds at most).
+            if (!forwarder.drain()) {
+              fprintf(stderr, "Error draining the sessions.\n");
+            }
+
+            printf("Draining %" PRIu64 " session(s) (%" PRIu64 " byte(s) "
+                   "pending).\n",
+                   forwarder.active_sessions(),
+                   forwarder.pending());
+
+            deadline = net::tcp::connections::now() +
+                       forwarder.config().drain_timeout;
+
+            // Stop waiting for new processes.
+            fds[1].fd = -1;
+
+            draining = true;
+          } else if (info.ssi_signo != SIGHUP) {
+            printf("Signal received.\n");
+            break;
+          } else if (draining) {
+            // The listeners belong to the new process or have been closed.
+            fprintf(stderr, "Not reloading while draining the sessions.\n");
+          } else {
+            // Reload the upstream servers and the listeners.
+            if ((opts.upstreams_file) || (!opts.listeners_file)) {
+              reload_upstreams(forwarder, opts.upstreams_file);
+            }
+
+            if (opts.listeners_file) {
+              reload_listeners(forwarder, opts.listeners_file);
+            }
+          }
+        }
+      }
+
+      // New process?
+      if (fds[1].revents & POLLIN) {
+        const int sock = net::tcp::upgrade::accept(upgrade);
+        if (sock != -1) {
+          // Hand the listening sockets over to the new process.
+          if (forwarder.handover(sock)) {
+            printf("Listening sockets handed over, draining %" PRIu64
+                   " session(s).\n",
+                   forwarder.active_sessions());
+
+            // Stop waiting for new processes.
+            fds[1].fd = -1;
+
+            draining = true;
+          } else {
+            fprintf(stderr, "Error handing over the listening sockets.\n");
+          }
+
+          close(sock);
+        }
+      }
+    }
+
+    // If the sessions have ended and their data has been sent...
+    if ((draining) &&
+        (forwarder.active_sessions() == 0) &&
+        (forwarder.pending() == 0)) {
+      printf("Sessions drained.\n");
+      break;
+    }
+  } while (true);
+
+  close(sigfd);
+}
+
+bool parse_ip_ports(const char* s,
+                    char* address,
+                    in_port_t& minport,
+                    in_port_t& maxport)
+{
+  // Search last colon.
+  const char* const last_colon = strrchr(s, ':');
+
+  // If the last colon was found...
+  if (last_colon) {
+    size_t len = last_colon - s;
+    if (len > 0) {
+      if (*s == '[') {
+        if ((len > 2) && (last_colon[-1] == ']')) {
+          // Skip '['.
+          s++;
+
+          len -= 2;
+        } else {
+          return false;
+        }
+      }
+
+      if (len < INET6_ADDRSTRLEN) {
         const char* const port = last_colon + 1;
         const char* const hyphen = strchr(port, '-');
 
@@ -301,6 +2162,210 @@ bool parse_ip_ports(const char* s,
   return false;
 }
 
+bool parse_routing(const char* s, net::tcp::routing_policy& policy)
+{
+  if (strcasecmp(s, "broadcast") == 0) {
+    policy = net::tcp::routing_policy::broadcast;
+  } else if (strcasecmp(s, "round-robin") == 0) {
+    policy = net::tcp::routing_policy::round_robin;
+  } else if (strcasecmp(s, "least-pending") == 0) {
+    policy = net::tcp::routing_policy::least_pending;
+  } else if (strcasecmp(s, "hash") == 0) {
+    policy = net::tcp::routing_policy::hash;
+  } else {
+    fprintf(stderr, "Invalid routing '%s'.\n", s);
+    return false;
+  }
+
+  return true;
+}
+
+bool parse_tuning(const char* s, net::tcp::tuning& tuning)
+{
+  net::tcp::tuning t;
+
+  // If the tuning profile is not the default one...
+  if (strcasecmp(s, "default") != 0) {
+    const char* option = s;
+
+    // For each option...
+    do {
+      const char* const comma = strchr(option, ',');
+      const size_t len = comma ? static_cast<size_t>(comma - option) :
+                                 strlen(option);
+
+      char name[32];
+      if (len >= sizeof(name)) {
+        fprintf(stderr, "Invalid tuning option in '%s'.\n", s);
+        return false;
+      }
+
+      memcpy(name, option, len);
+      name[len] = 0;
+
+      // Value (if any).
+      char* const value = strchr(name, '=');
+      if (value) {
+        *value = 0;
+      }
+
+      const char* const v = value ? value + 1 : "";
+      const size_t vlen = strlen(v);
+
+      uint64_t n;
+
+      if (strcasecmp(name, "nodelay") == 0) {
+        t.nodelay = true;
+      } else if (strcasecmp(name, "cork") == 0) {
+        t.cork = true;
+      } else if (!value) {
+        fprintf(stderr, "Invalid tuning option '%s'.\n", name);
+        return false;
+      } else if (strcasecmp(name, "sndbuf") == 0) {
+        if (!parse_number(v, vlen, "send buffer size", n, 1, INT_MAX / 2)) {
+          return false;
+        }
+
+        t.sndbuf = static_cast<int>(n);
+      } else if (strcasecmp(name, "rcvbuf") == 0) {
+        if (!parse_number(v, vlen, "receive buffer size", n, 1, INT_MAX / 2)) {
+          return false;
+        }
+
+        t.rcvbuf = static_cast<int>(n);
+      } else if (strcasecmp(name, "notsent-lowat") == 0) {
+        if (!parse_number(v, vlen, "unsent data limit", n, 1, INT_MAX)) {
+          return false;
+        }
+
+        t.notsent_lowat = static_cast<int>(n);
+      } else if (strcasecmp(name, "busy-poll") == 0) {
+        if (!parse_number(v, vlen, "busy poll time", n, 1, INT_MAX)) {
+          return false;
+        }
+
+        t.busy_poll = static_cast<int>(n);
+      } else if (strcasecmp(name, "keepalive") == 0) {
+        // <idle>:<interval>:<count>
+        const char* const colon1 = strchr(v, ':');
+        const char* const colon2 = colon1 ? strchr(colon1 + 1, ':') : nullptr;
+
+        if (!colon2) {
+          fprintf(stderr, "Invalid keepalive '%s'.\n", v);
+          return false;
+        }
+
+        if (!parse_number(v, colon1 - v, "keepalive idle time", n, 1, 32767)) {
+          return false;
+        }
+
+        t.keepalive_idle = static_cast<int>(n);
+
+        if (!parse_number(colon1 + 1,
+                          colon2 - colon1 - 1,
+                          "keepalive interval",
+                          n,
+                          1,
+                          32767)) {
+          return false;
+        }
+
+        t.keepalive_interval = static_cast<int>(n);
+
+        if (!parse_number(colon2 + 1,
+                          strlen(colon2 + 1),
+                          "keepalive probes",
+                          n,
+                          1,
+                          127)) {
+          return false;
+        }
+
+        t.keepalive_count = static_cast<int>(n);
+      } else if (strcasecmp(name, "congestion") == 0) {
+        if ((vlen == 0) || (vlen >= sizeof(t.congestion))) {
+          fprintf(stderr, "Invalid congestion control algorithm '%s'.\n", v);
+          return false;
+        }
+
+        memcpy(t.congestion, v, vlen + 1);
+      } else {
+        fprintf(stderr, "Invalid tuning option '%s'.\n", name);
+        return false;
+      }
+
+      option = comma ? comma + 1 : nullptr;
+    } while (option);
+
+    // The socket is either sent as soon as possible or corked.
+    if ((t.nodelay) && (t.cork)) {
+      fprintf(stderr,
+              "The tuning options \"nodelay\" and \"cork\" cannot be used "
+              "together.\n");
+
+      return false;
+    }
+
+    // Check that the kernel accepts the options (e.g. that the congestion
+    // control algorithm is available) on a socket which is never used.
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd != -1) {
+      const bool applied = t.apply(fd);
+      close(fd);
+
+      if (!applied) {
+        fprintf(stderr, "Error applying the tuning profile '%s'.\n", s);
+        return false;
+      }
+    }
+  }
+
+  tuning = t;
+
+  return true;
+}
+
+bool parse_delimiter(const char* s, uint8_t& delimiter)
+{
+  // Single character?
+  if ((s[0]) && (!s[1])) {
+    delimiter = static_cast<uint8_t>(s[0]);
+    return true;
+  }
+
+  // Escape sequence?
+  if ((s[0] == '\\') && (s[1]) && (!s[2])) {
+    switch (s[1]) {
+      case 'n':
+        delimiter = '\n';
+        return true;
+      case 'r':
+        delimiter = '\r';
+        return true;
+      case 't':
+        delimiter = '\t';
+        return true;
+      case '0':
+        delimiter = 0;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Hexadecimal value?
+  if ((s[0] == '0') &&
+      ((s[1] == 'x') || (s[1] == 'X')) &&
+      (isxdigit(s[2])) &&
+      (isxdigit(s[3])) &&
+      (!s[4])) {
+    delimiter = static_cast<uint8_t>(strtoul(s + 2, nullptr, 16));
+    return true;
+  }
+
+  return false;
+}
+
 bool parse_number(const char* s,
                   size_t len,
                   const char* name,